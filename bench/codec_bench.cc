@@ -0,0 +1,102 @@
+// Compares the object codecs: store size, write and read throughput.
+//
+//   make bench && ./bench/codec_bench [megabytes]
+//
+// The data is synthetic: half source-like text, half random bytes, split into
+// objects of a few KiB to a few hundred KiB like a working tree would be.
+
+#include "compression.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static std::vector<std::string> makeObjects(size_t totalBytes) {
+  static const char *words[] = {"int",    "return", "const",  "std::string", "if",     "for",
+                                "auto",   "{",      "}",      "(",           ")",      ";",
+                                "inline", "size_t", "vector", "path",        "hash",   "=",
+                                "\n",     "  ",     "//",     "#include",    "object", "tree"};
+  std::mt19937_64 rng(42);
+  std::vector<std::string> objects;
+  size_t produced = 0;
+
+  while (produced < totalBytes) {
+    const size_t size = 4096 + rng() % (256 << 10);
+    std::string object;
+    object.reserve(size);
+
+    if (objects.size() % 2 == 0) {
+      while (object.size() < size) {
+        object += words[rng() % std::size(words)];
+        object += ' ';
+      }
+    } else {
+      while (object.size() < size) object.push_back(static_cast<char>(rng()));
+    }
+
+    produced += object.size();
+    objects.push_back(std::move(object));
+  }
+
+  return objects;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+  const std::vector<std::string> objects = makeObjects(megabytes << 20);
+
+  size_t rawBytes = 0;
+  for (const std::string &object : objects) rawBytes += object.size();
+
+  const fs::path dir = fs::temp_directory_path() / "gid-codec-bench";
+  std::printf("%zu objects, %.1f MiB\n", objects.size(), rawBytes / 1048576.0);
+  std::printf("%-6s %12s %8s %14s %14s\n", "codec", "stored MiB", "ratio", "write MiB/s", "read MiB/s");
+
+  for (Codec codec : {Codec::None, Codec::Zlib, Codec::Zstd}) {
+    if (!Compression::codecAvailable(codec)) continue;
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    const auto writeStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < objects.size(); i++) {
+      Compression::ObjectWriter writer(dir / std::to_string(i), objects[i].size(), codec, -1);
+      writer.write(objects[i]);
+      writer.commit();
+    }
+    const double writeSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count();
+
+    size_t storedBytes = 0;
+    for (const auto &entry : fs::directory_iterator(dir)) storedBytes += entry.file_size();
+
+    const auto readStart = std::chrono::steady_clock::now();
+    std::vector<char> buffer(1 << 20);
+    size_t readBytes = 0;
+    for (size_t i = 0; i < objects.size(); i++) {
+      auto in = Compression::openDecoded(std::make_unique<std::ifstream>(dir / std::to_string(i), std::ios::binary));
+      while (in->read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || in->gcount() > 0) {
+        readBytes += static_cast<size_t>(in->gcount());
+      }
+    }
+    const double readSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - readStart).count();
+
+    if (readBytes != rawBytes) {
+      std::fprintf(stderr, "%s: read back %zu bytes, expected %zu\n", Compression::codecName(codec),
+                   readBytes, rawBytes);
+      return 1;
+    }
+
+    const double mib = rawBytes / 1048576.0;
+    std::printf("%-6s %12.1f %8.2f %14.1f %14.1f\n", Compression::codecName(codec), storedBytes / 1048576.0,
+                static_cast<double>(rawBytes) / storedBytes, mib / writeSeconds, mib / readSeconds);
+  }
+
+  fs::remove_all(dir);
+  return 0;
+}
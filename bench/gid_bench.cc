@@ -0,0 +1,341 @@
+// Times gid's commands end to end on a generated repository and prints the
+// results as JSON, to compare versions with each other.
+//
+//   make bench && ./bench/gid_bench [options] > results.json
+//
+//   --files N        files in the generated tree (10000)
+//   --depth N        deepest directory level (4)
+//   --fanout N       directories per level (8)
+//   --min-size N     smallest file in bytes (256)
+//   --max-size N     largest file in bytes (1048576), sizes are log-uniform
+//                    in between: as many 1-10 KiB files as 10-100 KiB ones
+//   --binary R       share of files with random bytes instead of text (0.1)
+//   --edit R         share of files touched between commits (0.01): most are
+//                    modified, some deleted and as many created
+//   --commits N      commits made after init (3)
+//   --seed N         the same seed generates the same trees (1)
+//   -j N             threads, as for gid (GID_THREADS, then the cores)
+//   --dir PATH       where the repository is made (<tmp>/gid-bench), erased
+//   --keep           leave the repository behind
+//
+// Every command runs in a child process started in the repository, through
+// the functions main.cc calls, so its wall time, CPU time and peak RSS are
+// its own. The sequence is init, then for every commit an edit, add and
+// commit, then add on a clean tree, log, a full retrieve of HEAD and a
+// retrieve of the commit before it on top of that.
+
+#include "commands.hpp"
+#include "commitgraph.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+struct Options {
+  size_t files = 10000;
+  size_t depth = 4;
+  size_t fanout = 8;
+  size_t minSize = 256;
+  size_t maxSize = 1 << 20;
+  double binary = 0.1;
+  double edit = 0.01;
+  size_t commits = 3;
+  uint64_t seed = 1;
+  size_t threads = 0;
+  fs::path dir = fs::temp_directory_path() / "gid-bench";
+  bool keep = false;
+};
+
+// Draws everything from one seeded generator, with its own arithmetic so the
+// trees are the same whatever the standard library.
+class Generator {
+public:
+  explicit Generator(uint64_t seed) : m_rng(seed) {}
+
+  uint64_t below(uint64_t bound) { return bound == 0 ? 0 : m_rng() % bound; }
+  double unit() { return static_cast<double>(m_rng() >> 11) * 0x1.0p-53; }
+
+  size_t size(const Options &options) {
+    const double low = std::log(static_cast<double>(std::max<size_t>(options.minSize, 1)));
+    const double high = std::log(static_cast<double>(std::max(options.maxSize, options.minSize)));
+    return static_cast<size_t>(std::exp(low + (high - low) * unit()));
+  }
+
+  std::string text(size_t size) {
+    static const char *words[] = {"int",    "return", "const",  "std::string", "if",     "for",
+                                  "auto",   "{",      "}",      "(",           ")",      ";",
+                                  "inline", "size_t", "vector", "path",        "hash",   "=",
+                                  "\n",     "  ",     "//",     "#include",    "object", "tree"};
+    std::string content;
+    content.reserve(size + 16);
+
+    while (content.size() < size) {
+      content += words[below(std::size(words))];
+      content += ' ';
+    }
+    content.resize(size);
+    return content;
+  }
+
+  std::string bytes(size_t size) {
+    std::string content(size, '\0');
+    for (size_t i = 0; i < size; i += 8) {
+      const uint64_t value = m_rng();
+      std::memcpy(content.data() + i, &value, std::min<size_t>(8, size - i));
+    }
+    return content;
+  }
+
+private:
+  std::mt19937_64 m_rng;
+};
+
+struct TreeStats {
+  size_t files = 0;
+  uint64_t bytes = 0;
+};
+
+static void writeFile(const fs::path &path, const std::string &content) {
+  fs::create_directories(path.parent_path());
+  std::ofstream(path, std::ios::binary | std::ios::trunc).write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+
+static fs::path newPath(Generator &generator, const Options &options, size_t id) {
+  fs::path path;
+  const size_t depth = generator.below(options.depth + 1);
+  for (size_t level = 0; level < depth; level++) path /= "d" + std::to_string(generator.below(options.fanout));
+  return path / ("f" + std::to_string(id) + (generator.unit() < options.binary ? ".bin" : ".txt"));
+}
+
+static void createFile(Generator &generator, const Options &options, const fs::path &root, const fs::path &path) {
+  const size_t size = generator.size(options);
+  writeFile(root / path, path.extension() == ".bin" ? generator.bytes(size) : generator.text(size));
+}
+
+// Touches `edit` of the files: 80% modified in place, 10% deleted and as
+// many new ones created.
+static void editTree(Generator &generator, const Options &options, const fs::path &root,
+                     std::vector<fs::path> &files, size_t &nextId) {
+  const size_t edits = std::max<size_t>(1, static_cast<size_t>(options.edit * files.size()));
+
+  for (size_t i = 0; i < edits && !files.empty(); i++) {
+    const uint64_t kind = generator.below(10);
+    const size_t victim = generator.below(files.size());
+
+    if (kind == 0) {
+      fs::remove(root / files[victim]);
+      files[victim] = files.back();
+      files.pop_back();
+    } else if (kind == 1) {
+      files.push_back(newPath(generator, options, nextId++));
+      createFile(generator, options, root, files.back());
+    } else {
+      // A small change somewhere in the file, like most edits are.
+      const fs::path path = root / files[victim];
+      std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+      const uint64_t size = fs::file_size(path);
+      const size_t length = std::min<uint64_t>(size, 64);
+      file.seekp(static_cast<std::streamoff>(generator.below(size - length + 1)));
+      const std::string patch =
+          files[victim].extension() == ".bin" ? generator.bytes(length) : generator.text(length);
+      file.write(patch.data(), static_cast<std::streamsize>(patch.size()));
+    }
+  }
+}
+
+static TreeStats measureTree(const fs::path &root) {
+  TreeStats stats;
+  for (auto it = fs::recursive_directory_iterator(root); it != fs::recursive_directory_iterator(); ++it) {
+    if (it->path().filename() == ".gid") {
+      it.disable_recursion_pending();
+      continue;
+    }
+    if (it->is_regular_file()) {
+      stats.files++;
+      stats.bytes += it->file_size();
+    }
+  }
+  return stats;
+}
+
+// Runs a command in a child started in the repository, its output dropped.
+static bool runCommand(const Options &options, const fs::path &root, const std::vector<std::string> &args,
+                       double &wall, double &cpu, long &peakKiB) {
+  const auto start = std::chrono::steady_clock::now();
+  const pid_t pid = ::fork();
+
+  if (pid == 0) {
+    const int null = ::open("/dev/null", O_WRONLY);
+    ::dup2(null, STDOUT_FILENO);
+    ::dup2(null, STDERR_FILENO);
+    if (::chdir(root.c_str()) != 0) ::_exit(127);
+
+    // Exec'd again so the paths main.cc takes at startup are the repository's.
+    std::vector<std::string> childArgs = {"gid_bench", "--run"};
+    if (options.threads > 0) childArgs.push_back("-j" + std::to_string(options.threads));
+    childArgs.insert(childArgs.end(), args.begin(), args.end());
+
+    std::vector<char *> argv;
+    for (std::string &arg : childArgs) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+    ::execv("/proc/self/exe", argv.data());
+    ::_exit(127);
+  }
+
+  int status = 0;
+  rusage usage{};
+  if (pid < 0 || ::wait4(pid, &status, 0, &usage) < 0) return false;
+
+  wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+  peakKiB = usage.ru_maxrss;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// The child side of runCommand.
+static int runChild(int argc, char *argv[]) {
+  std::vector<std::string> args(argv + 2, argv + argc);
+  if (!args.empty() && args[0].rfind("-j", 0) == 0) {
+    Scheduler::setThreads(std::strtoul(args[0].c_str() + 2, nullptr, 10));
+    args.erase(args.begin());
+  }
+  if (args.empty()) return 2;
+
+  if (args[0] == "init") initCommand();
+  else if (args[0] == "add") addCommand();
+  else if (args[0] == "commit") commitCommand();
+  else if (args[0] == "log") logCommand();
+  else if (args[0] == "retrieve" && args.size() == 2) retrieveCommand(args[1]);
+  else return 2;
+
+  return 0;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (arg == "--keep") {
+      options.keep = true;
+      continue;
+    }
+    if (!value) return false;
+    i++;
+
+    if (arg == "--files") options.files = std::strtoul(value, nullptr, 10);
+    else if (arg == "--depth") options.depth = std::strtoul(value, nullptr, 10);
+    else if (arg == "--fanout") options.fanout = std::max<size_t>(1, std::strtoul(value, nullptr, 10));
+    else if (arg == "--min-size") options.minSize = std::strtoul(value, nullptr, 10);
+    else if (arg == "--max-size") options.maxSize = std::strtoul(value, nullptr, 10);
+    else if (arg == "--binary") options.binary = std::atof(value);
+    else if (arg == "--edit") options.edit = std::atof(value);
+    else if (arg == "--commits") options.commits = std::strtoul(value, nullptr, 10);
+    else if (arg == "--seed") options.seed = std::strtoull(value, nullptr, 10);
+    else if (arg == "-j") options.threads = std::strtoul(value, nullptr, 10);
+    else if (arg == "--dir") options.dir = value;
+    else return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && std::strcmp(argv[1], "--run") == 0) return runChild(argc, argv);
+
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    std::fprintf(stderr, "usage: %s [--files N] [--depth N] [--fanout N] [--min-size N] [--max-size N] "
+                         "[--binary R] [--edit R] [--commits N] [--seed N] [-j N] [--dir PATH] [--keep]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  const fs::path root = options.dir / "proj"; // retrieve writes next to it, in ../repo
+  fs::remove_all(options.dir);
+  fs::create_directories(root);
+
+  Generator generator(options.seed);
+  std::vector<fs::path> files;
+  size_t nextId = 0;
+
+  const auto generateStart = std::chrono::steady_clock::now();
+  for (; nextId < options.files; nextId++) {
+    files.push_back(newPath(generator, options, nextId));
+    createFile(generator, options, root, files.back());
+  }
+  const double generateSeconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - generateStart).count();
+
+  std::string results;
+  bool failed = false;
+
+  // Throughput is over the whole tree, which every command looks at.
+  auto bench = [&](const std::string &name, size_t round, const std::vector<std::string> &args) {
+    const TreeStats tree = measureTree(root);
+    double wall = 0, cpu = 0;
+    long peakKiB = 0;
+
+    if (!runCommand(options, root, args, wall, cpu, peakKiB)) {
+      std::fprintf(stderr, "%s failed\n", name.c_str());
+      failed = true;
+    }
+
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "%s    {\"command\": \"%s\", \"round\": %zu, \"wall_s\": %.6f, \"cpu_s\": %.6f, "
+                  "\"peak_rss_kib\": %ld, \"files\": %zu, \"bytes\": %llu, \"files_per_s\": %.1f, "
+                  "\"mb_per_s\": %.2f}",
+                  results.empty() ? "" : ",\n", name.c_str(), round, wall, cpu, peakKiB, tree.files,
+                  static_cast<unsigned long long>(tree.bytes), tree.files / wall, tree.bytes / 1e6 / wall);
+    results += line;
+  };
+
+  bench("init", 0, {"init"});
+  for (size_t round = 1; round <= options.commits; round++) {
+    editTree(generator, options, root, files, nextId);
+    bench("add", round, {"add"});
+    bench("commit", round, {"commit"});
+  }
+  bench("add-clean", 0, {"add"});
+  bench("log", 0, {"log"});
+
+  // Read in the repository, where the commit graph is.
+  const fs::path previous = fs::current_path();
+  fs::current_path(root);
+  CommitGraph graph;
+  const std::string head = graph.head().commitHash.hex();
+  const std::string parent = graph.size() > 1 ? graph.at(graph.size() - 2).commitHash.hex() : head;
+  fs::current_path(previous);
+
+  bench("retrieve", 0, {"retrieve", head});
+  bench("retrieve-incremental", 0, {"retrieve", parent});
+
+  const TreeStats tree = measureTree(root);
+  std::printf("{\n  \"config\": {\"files\": %zu, \"depth\": %zu, \"fanout\": %zu, \"min_size\": %zu, "
+              "\"max_size\": %zu, \"binary\": %.3f, \"edit\": %.3f, \"commits\": %zu, \"seed\": %llu, "
+              "\"threads\": %zu},\n",
+              options.files, options.depth, options.fanout, options.minSize, options.maxSize, options.binary,
+              options.edit, options.commits, static_cast<unsigned long long>(options.seed),
+              options.threads > 0 ? options.threads : Scheduler::defaultThreads());
+  std::printf("  \"tree\": {\"files\": %zu, \"bytes\": %llu, \"generate_s\": %.6f},\n", tree.files,
+              static_cast<unsigned long long>(tree.bytes), generateSeconds);
+  std::printf("  \"results\": [\n%s\n  ]\n}\n", results.c_str());
+
+  if (!options.keep) fs::remove_all(options.dir);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+// Compares FlatSet with std::unordered_set on the lookups add and commit do:
+// interning path strings, and sets of interned paths.
+//
+//   make bench && ./bench/hashmap_bench [paths]
+//
+// The paths look like a source tree: a few levels of directories, many files
+// per directory sharing a handful of extensions, under one absolute root.
+
+#include "flatmap.hpp"
+#include "pathtable.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+static std::vector<std::string> makePaths(size_t count, uint64_t seed) {
+  static const char *dirs[] = {"src", "include", "lib", "test", "tools", "core", "net", "ui", "util", "third_party"};
+  static const char *stems[] = {"main", "object", "tree", "index", "commit", "parser", "buffer", "hash", "store",
+                                "config", "monitor", "checkout", "delta", "pack", "trace"};
+  static const char *extensions[] = {".cc", ".hpp", ".h", ".c", ".txt", ".md", ".py", ".json"};
+  std::mt19937_64 rng(seed);
+  std::vector<std::string> paths;
+  paths.reserve(count);
+
+  while (paths.size() < count) {
+    std::string path = "/home/user/projects/repository";
+    const size_t depth = 1 + rng() % 5;
+    for (size_t level = 0; level < depth; level++) {
+      path += '/';
+      path += dirs[rng() % std::size(dirs)];
+      path += '_';
+      path += std::to_string(rng() % 8);
+    }
+    path += '/';
+    path += stems[rng() % std::size(stems)];
+    path += '_';
+    path += std::to_string(paths.size());
+    path += extensions[rng() % std::size(extensions)];
+    paths.push_back(std::move(path));
+  }
+
+  return paths;
+}
+
+template <typename Function> static double nanosecondsPer(size_t operations, Function &&function) {
+  double best = 1e300;
+  for (int round = 0; round < 5; round++) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    best = std::min(best, seconds);
+  }
+  return best * 1e9 / static_cast<double>(operations);
+}
+
+// Inserts the keys, then looks up the same keys and as many absent ones.
+template <typename Set, typename Key>
+static void run(const char *name, const std::vector<Key> &keys, const std::vector<Key> &absent) {
+  size_t found = 0;
+
+  const double insert = nanosecondsPer(keys.size(), [&] {
+    Set set;
+    for (const Key &key : keys) set.insert(key);
+    found = set.size();
+  });
+
+  Set set;
+  for (const Key &key : keys) set.insert(key);
+
+  const double hit = nanosecondsPer(keys.size(), [&] {
+    found = 0;
+    for (const Key &key : keys) found += set.count(key);
+  });
+  if (found != keys.size()) {
+    std::fprintf(stderr, "%s: found %zu of %zu keys\n", name, found, keys.size());
+    std::exit(1);
+  }
+
+  const double miss = nanosecondsPer(absent.size(), [&] {
+    found = 0;
+    for (const Key &key : absent) found += set.count(key);
+  });
+  if (found != 0) {
+    std::fprintf(stderr, "%s: found %zu absent keys\n", name, found);
+    std::exit(1);
+  }
+
+  std::printf("%-34s %12.1f %12.1f %12.1f\n", name, insert, hit, miss);
+}
+
+int main(int argc, char *argv[]) {
+  const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  const std::vector<std::string> paths = makePaths(count, 1);
+  // Never among the paths, the ~ is not in any of them.
+  std::vector<std::string> others = makePaths(count, 2);
+  for (std::string &path : others) path += '~';
+
+  // Shuffled, the keys are not visited in the order of their strings in memory.
+  std::vector<std::string_view> views(paths.begin(), paths.end()), absentViews(others.begin(), others.end());
+  std::shuffle(views.begin(), views.end(), std::mt19937_64(3));
+
+  PathTable table;
+  std::vector<PathId> ids, absentIds;
+  for (std::string_view path : views) ids.push_back(table.intern(path));
+  for (std::string_view path : absentViews) absentIds.push_back(table.intern(path));
+
+  std::printf("%zu paths\n", count);
+  std::printf("%-34s %12s %12s %12s\n", "ns per operation", "insert", "hit", "miss");
+  run<std::unordered_set<std::string_view>>("std::unordered_set<string_view>", views, absentViews);
+  run<FlatSet<std::string_view>>("FlatSet<string_view>", views, absentViews);
+  run<std::unordered_set<PathId, PathId::Hash>>("std::unordered_set<PathId>", ids, absentIds);
+  run<FlatSet<PathId, PathId::Hash>>("FlatSet<PathId>", ids, absentIds);
+  return 0;
+}
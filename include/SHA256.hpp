@@ -4,20 +4,41 @@
 #include <string>
 #include <array>
 #include <cstdint>
+#include <cstddef>
+#include <atomic>
 
 // TODO Understand the code better.
 
 class SHA256 {
 
 public:
+	/**
+	 * Compression kernels. `Auto` picks the fastest one the CPU supports,
+	 * the others can be forced (e.g. to compare outputs) if they are supported.
+	 */
+	enum class Kernel { Auto, Scalar, SSE4, AVX2, SHANI };
+
 	SHA256();
 	void update(const uint8_t * data, size_t length);
 	void update(const std::string &data);
 	uint8_t * digest();
+	// Writes the 32 byte digest to `hash`, without allocating.
+	void digest(uint8_t * hash);
 
 	static std::string toString(const uint8_t * digest);
+	static bool fromString(const std::string &hex, uint8_t * digest);
+
+	static bool isSupported(Kernel kernel);
+	static bool setKernel(Kernel kernel);
+	static Kernel activeKernel();
+	static const char * kernelName(Kernel kernel);
+
+	// Compresses `blocks` consecutive 64 byte blocks of `data` into `state`.
+	using CompressFn = void (*)(uint32_t state[8], const uint8_t * data, size_t blocks);
 
 private:
+	friend class SHA256Batch;
+
 	uint8_t  m_data[64];
 	uint32_t m_blocklen;
 	uint64_t m_bitlen;
@@ -50,6 +71,20 @@ private:
 	void transform();
 	void pad();
 	void revert(uint8_t * hash);
+
+	static std::atomic<CompressFn> s_compress;
+	static std::atomic<Kernel> s_kernel;
+
+	// Runs the 64 rounds over an already expanded message schedule (W[i] + K[i]).
+	static void rounds(uint32_t state[8], const uint32_t wk[64]);
+
+	static void compressScalar(uint32_t state[8], const uint8_t * data, size_t blocks);
+	static void compressSSE4(uint32_t state[8], const uint8_t * data, size_t blocks);
+	static void compressAVX2(uint32_t state[8], const uint8_t * data, size_t blocks);
+	static void compressSHANI(uint32_t state[8], const uint8_t * data, size_t blocks);
+	static CompressFn compressFor(Kernel kernel);
+	static Kernel detectKernel();
+	static void compressDispatch(uint32_t state[8], const uint8_t * data, size_t blocks);
 };
 
-#endif
\ No newline at end of file
+#endif
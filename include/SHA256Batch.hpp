@@ -0,0 +1,46 @@
+#ifndef SHA256_BATCH_H
+#define SHA256_BATCH_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/*
+ * Multi-buffer SHA256: hashes many independent messages at once, one message per
+ * SIMD lane (4 lanes generic/SSE2, 8 with AVX2, 16 with AVX-512). Messages are
+ * grouped by length so lanes in a group finish at about the same block.
+ *
+ * The output is identical to running each message through the SHA256 class.
+ */
+class SHA256Batch {
+
+public:
+	using Digest = std::array<uint8_t, 32>;
+
+	// Number of lanes hashed in parallel, `Auto` picks the widest supported.
+	enum class Width { Auto, X4, X8, X16 };
+
+	/**
+	 * Hashes every message. `lanesOnly` sends all of them through the lane
+	 * kernels, even those the single buffer path would take (the rest of a
+	 * group, everything on SHA-NI), so the kernels can be checked.
+	 */
+	static std::vector<Digest> hash(const std::vector<std::string_view> &messages, bool lanesOnly = false);
+
+	static bool isSupported(Width width);
+	static bool setWidth(Width width);
+	static size_t lanes();
+
+private:
+	static std::atomic<Width> s_width;
+
+	static Width detectWidth();
+	static void hashX4(const std::vector<std::string_view> &messages, const size_t * order, size_t count, Digest * out);
+	static void hashX8(const std::vector<std::string_view> &messages, const size_t * order, size_t count, Digest * out);
+	static void hashX16(const std::vector<std::string_view> &messages, const size_t * order, size_t count, Digest * out);
+};
+
+#endif
@@ -0,0 +1,492 @@
+#ifndef CHECKOUT_HPP
+#define CHECKOUT_HPP
+
+#include "filecopy.hpp"
+#include "global.hpp"
+#include "scheduler.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Writes out the files of a commit. The list of (blob, destination) pairs to
+ * write is collected from the trees first and every directory is created in
+ * one pass, then the files are written in batches on the shared scheduler
+ * (see Scheduler for the thread count) through a large buffer straight into
+ * the file descriptor.
+ *
+ * The commit last written out, the directory it went to and the mode (see
+ * below) are kept in .gid/checkout, the hash and stat data of every file written in
+ * .gid/checkout-index (an Index). Retrieving into the same directory again
+ * walks the two trees together and skips the subtrees whose hash did not
+ * change without reading them, so the cost follows the number of changed
+ * files. In the subtrees that differ it writes the paths whose blob differs,
+ * or whose file was changed since it was written, and removes the paths that
+ * are gone. Files there that stay the same cost one lstat, or a hash of their
+ * content when the stat data can not be trusted (see Index). Files changed by
+ * hand in an unchanged subtree are left as they are.
+ *
+ * Raw blobs (see objectstore.hpp) are not streamed but copied file to file,
+ * as set by `checkout.mode` in .gid/config or the retrieve options:
+ *   reflink    share the extents of the object (the default), falling back to
+ *              copy_file_range and then a buffered copy, see FileCopy
+ *   hardlink   link the object itself, read-only; falls back to reflink
+ *   copy       never share anything with the object
+ * A destination is always unlinked before it is written, so writing never
+ * goes through a link into the store.
+ */
+
+namespace Checkout {
+
+namespace fs = std::filesystem;
+
+// Buffer every file is copied through.
+constexpr size_t BUFFER_SIZE = 1 << 20;
+
+// How many files one task writes.
+constexpr size_t BATCH_FILES = 64;
+
+const fs::path STATE_PATH = ".gid/checkout";
+const fs::path INDEX_PATH = ".gid/checkout-index";
+
+enum class Mode {
+  Copy,
+  Reflink,
+  Hardlink,
+};
+
+inline const char *modeName(Mode mode) {
+  switch (mode) {
+  case Mode::Copy: return "copy";
+  case Mode::Reflink: return "reflink";
+  case Mode::Hardlink: return "hardlink";
+  }
+  return "unknown";
+}
+
+inline bool modeFromName(const std::string &name, Mode &mode) {
+  if (name == "copy") mode = Mode::Copy;
+  else if (name == "reflink") mode = Mode::Reflink;
+  else if (name == "hardlink") mode = Mode::Hardlink;
+  else return false;
+  return true;
+}
+
+inline std::optional<Mode> &requestedMode() {
+  static std::optional<Mode> mode;
+  return mode;
+}
+
+// Sets the mode for this run, over the one in .gid/config.
+inline void setMode(Mode mode) { requestedMode() = mode; }
+
+inline Mode mode() {
+  if (requestedMode()) return *requestedMode();
+
+  static const Mode configured = [] {
+    Mode result = Mode::Reflink;
+    const std::string *name = Settings::get("checkout.mode");
+    if (name && !modeFromName(*name, result)) {
+      std::cerr << "Unknown checkout.mode '" << *name << "', using reflink." << std::endl;
+    }
+    return result;
+  }();
+  return configured;
+}
+
+struct Item {
+  ObjectId hash;
+  fs::path destination;
+};
+
+// What the last checkout wrote, as kept in STATE_PATH.
+struct State {
+  ObjectId commitHash;
+  ObjectId treeHash;
+  std::string mode;
+  fs::path outputDir;
+};
+
+inline bool readState(State &state) {
+  std::ifstream file(STATE_PATH);
+  std::string commitHash, treeHash, outputDir;
+  if (!(file >> commitHash >> treeHash >> state.mode) || !std::getline(file >> std::ws, outputDir) ||
+      !ObjectId::fromHex(commitHash, state.commitHash) || !ObjectId::fromHex(treeHash, state.treeHash)) {
+    return false;
+  }
+
+  state.outputDir = outputDir;
+  return true;
+}
+
+inline void writeState(const State &state) {
+  std::ofstream file(STATE_PATH, std::ios::trunc);
+  file << state.commitHash << " " << state.treeHash << " " << state.mode << " " << state.outputDir.string() << "\n";
+  if (file.fail()) std::cerr << "Error writing " << STATE_PATH << std::endl;
+}
+
+/**
+ * Lists what writing out a tree changes in a directory holding another one.
+ * Subtrees with the same hash hold the same files and are not read.
+ *
+ * @param oldHash The tree in the directory, null for none.
+ * @param newHash The tree to write out.
+ * @param directory Where the trees go.
+ * @param changed Filled with the files that are new or have another blob.
+ * @param same Filled with the files that have the same blob in both, in
+ *             subtrees that differ.
+ * @param removed Filled with the files that are only in the old tree.
+ */
+inline void diffTrees(const ObjectId &oldHash, const ObjectId &newHash, const fs::path &directory,
+                      std::vector<Item> &changed, std::vector<Item> &same, std::vector<fs::path> &removed) {
+  if (oldHash == newHash) return;
+
+  const ObjectStore::Object oldTree = General::readTree(oldHash);
+  const ObjectStore::Object newTree = General::readTree(newHash);
+
+  // By name, trees are written that way but legacy ones may not be.
+  auto sorted = [](const ObjectStore::Object &tree) {
+    const ObjectStore::TreeView view(tree);
+    std::vector<TreeFormat::Entry> entries(view.begin(), view.end());
+    std::sort(entries.begin(), entries.end(),
+              [](const TreeFormat::Entry &a, const TreeFormat::Entry &b) { return a.name < b.name; });
+    return entries;
+  };
+  const std::vector<TreeFormat::Entry> olds = sorted(oldTree), news = sorted(newTree);
+
+  for (size_t i = 0, j = 0; i < olds.size() || j < news.size();) {
+    const TreeFormat::Entry *oldEntry = nullptr, *newEntry = nullptr;
+    if (j == news.size() || (i < olds.size() && olds[i].name < news[j].name)) {
+      oldEntry = &olds[i++];
+    } else if (i == olds.size() || news[j].name < olds[i].name) {
+      newEntry = &news[j++];
+    } else {
+      oldEntry = &olds[i++];
+      newEntry = &news[j++];
+    }
+
+    const fs::path path = directory / (oldEntry ? oldEntry->name : newEntry->name);
+
+    if (oldEntry && newEntry && oldEntry->type == newEntry->type) {
+      if (newEntry->isTree()) diffTrees(oldEntry->id, newEntry->id, path, changed, same, removed);
+      else (oldEntry->id == newEntry->id ? same : changed).push_back({newEntry->id, path});
+      continue;
+    }
+
+    // Added, removed, or a file that became a directory or the other way round.
+    if (oldEntry) {
+      if (oldEntry->isTree()) diffTrees(oldEntry->id, ObjectId(), path, changed, same, removed);
+      else removed.push_back(path);
+    }
+    if (newEntry) {
+      if (newEntry->isTree()) diffTrees(ObjectId(), newEntry->id, path, changed, same, removed);
+      else changed.push_back({newEntry->id, path});
+    }
+  }
+}
+
+// Creates the parent directory of every item, each one once.
+inline void createDirectories(const std::vector<Item> &items) {
+  std::set<fs::path> directories;
+  for (const Item &item : items) directories.insert(item.destination.parent_path());
+
+  for (const fs::path &directory : directories) {
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    if (ec) std::cerr << "Failed to create " << directory << ": " << ec.message() << std::endl;
+  }
+}
+
+/**
+ * Copies or links a raw blob to its destination.
+ *
+ * @param source The raw blob in the store.
+ * @param destination Where it goes, already unlinked.
+ * @param mode How to copy it.
+ * @param size The size of the file.
+ * @return How it was written, Failed on error.
+ */
+inline FileCopy::Method writeRawFile(const fs::path &source, const fs::path &destination, Mode mode,
+                                     uint64_t &size) {
+  Trace::Scope scope("Checkout::writeRawFile");
+  if (mode == Mode::Hardlink && ::link(source.c_str(), destination.c_str()) == 0) {
+    struct stat st;
+    size = ::stat(destination.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    return FileCopy::Method::Hardlink;
+  }
+
+  const int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) return FileCopy::Method::Failed;
+
+  struct stat st;
+  const int out = ::fstat(in, &st) == 0
+                      ? ::open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)
+                      : -1;
+  if (out < 0) {
+    ::close(in);
+    return FileCopy::Method::Failed;
+  }
+
+  size = static_cast<uint64_t>(st.st_size);
+  FileCopy::Method method = FileCopy::copy(in, out, size, mode != Mode::Copy);
+  ::close(in);
+  if (::close(out) != 0) method = FileCopy::Method::Failed;
+  return method;
+}
+
+// Writes all of `data`, however many calls it takes.
+inline bool writeAll(int fd, const char *data, size_t size) {
+  for (size_t done = 0; done < size;) {
+    const ssize_t written = ::write(fd, data + done, size - done);
+    if (written < 0) return false;
+    done += static_cast<size_t>(written);
+  }
+  return true;
+}
+
+/**
+ * Writes one blob to its destination.
+ *
+ * @param item The blob and where it goes.
+ * @param buffer A BUFFER_SIZE scratch buffer.
+ * @param mode How raw blobs are copied.
+ * @param size The number of bytes written.
+ * @return How the file was written, Failed on error.
+ */
+inline FileCopy::Method writeFile(const Item &item, char *buffer, Mode mode, uint64_t &size) {
+  Trace::Scope scope("Checkout::writeFile");
+  // Never write through a link into the store.
+  if (::unlink(item.destination.c_str()) != 0 && errno != ENOENT) {
+    std::cerr << "Failed to replace " << item.destination << std::endl;
+    return FileCopy::Method::Failed;
+  }
+
+  const ObjectStore::ObjectPath raw = ObjectStore::rawPath(item.hash);
+  if (::access(raw.c_str(), F_OK) == 0) {
+    const FileCopy::Method method = writeRawFile(raw, item.destination, mode, size);
+    if (method == FileCopy::Method::Failed) std::cerr << "Failed to write " << item.destination << std::endl;
+    return method;
+  }
+
+  // Chunked blobs are only listed, they are streamed below.
+  ObjectStore::Object blob = ObjectStore::read(item.hash, false);
+  const bool chunked = blob.type() == ObjectStore::ObjectType::Manifest;
+  if (!chunked && !ObjectStore::BlobView(blob).valid()) {
+    std::cerr << "Failed to open blob " << item.hash << std::endl;
+    return FileCopy::Method::Failed;
+  }
+
+  const int fd = ::open(item.destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    std::cerr << "Failed to create " << item.destination << std::endl;
+    return FileCopy::Method::Failed;
+  }
+
+  bool failed = false;
+  size = 0;
+
+  if (!chunked) {
+    const std::string_view content = ObjectStore::BlobView(blob).content();
+    failed = !writeAll(fd, content.data(), content.size());
+    size = content.size();
+  } else {
+    // The first line is the header, everything after it is the file as is.
+    ObjectStore::ObjectStream stream(std::move(blob));
+    std::string header;
+    failed = !std::getline(stream, header);
+    std::streambuf *source = stream.rdbuf();
+
+    while (!failed) {
+      const std::streamsize count = source->sgetn(buffer, BUFFER_SIZE);
+      if (count <= 0) break;
+
+      failed = !writeAll(fd, buffer, static_cast<size_t>(count));
+      size += static_cast<uint64_t>(count);
+    }
+  }
+
+  if (::close(fd) != 0 || failed) {
+    std::cerr << "Failed to write " << item.destination << std::endl;
+    return FileCopy::Method::Failed;
+  }
+  return FileCopy::Method::Buffered;
+}
+
+/**
+ * Counts what was written and reports it on stderr, at most every 200 ms.
+ */
+class Progress {
+public:
+  explicit Progress(size_t total) : m_total(total), m_start(std::chrono::steady_clock::now()) {}
+
+  void add(size_t files, uint64_t bytes, FileCopy::Method method) {
+    m_methods[static_cast<size_t>(method)].fetch_add(files, std::memory_order_relaxed);
+    m_files.fetch_add(files, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    const int64_t now = elapsedMs();
+    int64_t last = m_lastReport.load(std::memory_order_relaxed);
+    if (now - last < 200 || !m_lastReport.compare_exchange_strong(last, now)) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::fprintf(stderr, "\rChecking out files: %zu/%zu", m_files.load(std::memory_order_relaxed), m_total);
+  }
+
+  // The final line, with the throughput.
+  void finish() const {
+    const double seconds = std::max<int64_t>(elapsedMs(), 1) / 1000.0;
+    const double mib = static_cast<double>(m_bytes.load()) / (1 << 20);
+
+    std::fprintf(stderr, "\rChecked out %zu files, %.1f MiB in %.2f s (%.0f files/s, %.1f MiB/s).\n",
+                 m_files.load(), mib, seconds, static_cast<double>(m_files.load()) / seconds, mib / seconds);
+
+    const size_t linked = m_methods[static_cast<size_t>(FileCopy::Method::Hardlink)].load();
+    const size_t reflinked = m_methods[static_cast<size_t>(FileCopy::Method::Reflink)].load();
+    const size_t ranged = m_methods[static_cast<size_t>(FileCopy::Method::CopyRange)].load();
+    if (linked + reflinked + ranged > 0) {
+      std::fprintf(stderr, "%zu hardlinked, %zu reflinked, %zu copied with copy_file_range.\n", linked, reflinked,
+                   ranged);
+    }
+  }
+
+private:
+  int64_t elapsedMs() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_start)
+        .count();
+  }
+
+  const size_t m_total;
+  const std::chrono::steady_clock::time_point m_start;
+  std::atomic<size_t> m_files{0};
+  std::atomic<uint64_t> m_bytes{0};
+  std::atomic<int64_t> m_lastReport{0};
+  std::atomic<size_t> m_methods[static_cast<size_t>(FileCopy::Method::Failed) + 1] = {};
+  std::mutex m_mutex;
+};
+
+// Removes the directories a removed file leaves empty, up to the output directory.
+inline void removeEmptyParents(fs::path directory, const fs::path &outputDir) {
+  std::error_code ec;
+  while (directory != outputDir && directory.has_relative_path() && fs::is_empty(directory, ec) && !ec) {
+    if (!fs::remove(directory, ec)) break;
+    directory = directory.parent_path();
+  }
+}
+
+/**
+ * Writes out a commit under a directory. If the directory holds the commit
+ * written out last, only the differences are applied.
+ *
+ * @param commitHash The commit.
+ * @param treeHash Its root tree.
+ * @param outputDir Where the files go.
+ * @return false if a file could not be written.
+ */
+inline bool run(const ObjectId &commitHash, const ObjectId &treeHash, const fs::path &outputDir) {
+  Trace::Scope scope("Checkout::run");
+  // Loaded up front, the tasks only read them.
+  ObjectStore::packs();
+
+  const fs::path absoluteOutput = fs::absolute(outputDir).lexically_normal();
+  State previous;
+  // A different mode rewrites everything, linked files must not stay linked.
+  const bool incremental = readState(previous) && previous.outputDir == absoluteOutput &&
+                           previous.mode == modeName(mode()) && fs::is_directory(outputDir);
+  if (!incremental) fs::remove(INDEX_PATH);
+
+  Index cache(INDEX_PATH);
+  std::vector<Item> items, same;
+  std::vector<fs::path> removed;
+  diffTrees(incremental ? previous.treeHash : ObjectId(), treeHash, outputDir, items, same, removed);
+
+  // A file with the same blob is kept if it was not touched since.
+  size_t unchanged = 0;
+  for (Item &item : same) {
+    StatData stat;
+    if (StatData::read(item.destination, stat)) {
+      const ObjectId *cached = cache.lookup(item.destination.native(), stat);
+      if (cached && *cached == item.hash) {
+        unchanged++;
+        continue;
+      }
+
+      // Written in the same timestamp tick as the cache, so its stat data
+      // proves nothing: the content is hashed instead of written again.
+      const IndexEntry *entry = cache.find(item.destination.native());
+      if (entry && entry->hash == item.hash && entry->stat.size == stat.size &&
+          General::calculateSHA256(MappedFile(item.destination)) == item.hash) {
+        cache.update(item.destination.native(), item.hash, stat);
+        unchanged++;
+        continue;
+      }
+    }
+    items.push_back(std::move(item));
+  }
+
+  for (const fs::path &destination : removed) {
+    std::error_code ec;
+    fs::remove(destination, ec);
+    cache.erase(destination.native());
+    removeEmptyParents(destination.parent_path(), outputDir);
+  }
+
+  createDirectories(items);
+
+  Progress progress(items.size());
+  std::atomic<bool> failed{false};
+  std::mutex cacheMutex;
+  TaskGroup group;
+
+  for (size_t begin = 0; begin < items.size(); begin += BATCH_FILES) {
+    const size_t end = std::min(items.size(), begin + BATCH_FILES);
+
+    group.run([&items, &progress, &failed, &cache, &cacheMutex, begin, end] {
+      std::unique_ptr<char[]> buffer(new char[BUFFER_SIZE]);
+      const Mode checkoutMode = mode();
+
+      for (size_t i = begin; i < end; i++) {
+        uint64_t written = 0;
+        const FileCopy::Method method = writeFile(items[i], buffer.get(), checkoutMode, written);
+        if (method == FileCopy::Method::Failed) {
+          failed = true;
+          continue;
+        }
+        progress.add(1, written, method);
+
+        StatData stat;
+        if (StatData::read(items[i].destination, stat)) {
+          std::lock_guard<std::mutex> lock(cacheMutex);
+          cache.update(items[i].destination.native(), items[i].hash, stat);
+        }
+      }
+    });
+  }
+
+  group.wait();
+  progress.finish();
+  if (incremental) std::cerr << unchanged << " files were unchanged, " << removed.size() << " removed." << std::endl;
+
+  cache.save();
+  writeState({commitHash, treeHash, modeName(mode()), absoluteOutput});
+  return !failed;
+}
+
+} // namespace Checkout
+
+#endif
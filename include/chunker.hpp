@@ -0,0 +1,113 @@
+#ifndef CHUNKER_HPP
+#define CHUNKER_HPP
+
+#include "config.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Content defined chunking, FastCDC style. A gear hash rolls over the data
+ * and a chunk ends where its top bits are all zero, so boundaries depend on
+ * the bytes around them and not on their offset: inserting or appending data
+ * only changes the chunks next to the edit, and equal regions of different
+ * files cut into equal chunks.
+ *
+ * Like FastCDC, no boundary is looked for in the first `min` bytes, a harder
+ * mask is used before `avg` and an easier one after it, which keeps chunk
+ * sizes close to `avg`, and a chunk never goes past `max`.
+ *
+ * Sizes come from .gid/config:
+ *   chunking.threshold = 8388608   files at least this big are chunked
+ *   chunking.min = 65536
+ *   chunking.avg = 262144          rounded down to a power of two
+ *   chunking.max = 1048576
+ */
+
+namespace Chunker {
+
+struct Config {
+  size_t threshold = 8 << 20;
+  size_t min = 64 << 10;
+  size_t avg = 256 << 10;
+  size_t max = 1 << 20;
+};
+
+inline const Config &config() {
+  static const Config loaded = [] {
+    Config result;
+    result.threshold = static_cast<size_t>(Settings::getNumber("chunking.threshold", result.threshold));
+    result.min = static_cast<size_t>(Settings::getNumber("chunking.min", result.min));
+    result.avg = static_cast<size_t>(Settings::getNumber("chunking.avg", result.avg));
+    result.max = static_cast<size_t>(Settings::getNumber("chunking.max", result.max));
+
+    // Keep the sizes ordered, whatever the file says.
+    result.min = std::max<size_t>(result.min, 64);
+    result.avg = std::bit_floor(std::max(result.avg, result.min * 2));
+    result.max = std::max(result.max, result.avg * 2);
+    return result;
+  }();
+
+  return loaded;
+}
+
+namespace detail {
+
+// Random values for every byte, fixed so chunk boundaries never change.
+constexpr std::array<uint64_t, 256> makeGear() {
+  std::array<uint64_t, 256> gear{};
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+  for (uint64_t &value : gear) {
+    // splitmix64
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    value = z ^ (z >> 31);
+  }
+
+  return gear;
+}
+
+inline constexpr std::array<uint64_t, 256> GEAR = makeGear();
+
+// A mask of the top `bits` bits, the ones that depend on the most bytes.
+constexpr uint64_t topBits(unsigned bits) { return bits == 0 ? 0 : ~0ULL << (64 - bits); }
+
+} // namespace detail
+
+/**
+ * Finds where the chunk starting at `data` ends.
+ *
+ * @param data The rest of the file.
+ * @param config The chunk sizes.
+ * @return The size of the chunk, never 0 unless `data` is empty.
+ */
+inline size_t cut(std::string_view data, const Config &config = Chunker::config()) {
+  if (data.size() <= config.min) return data.size();
+
+  const unsigned bits = static_cast<unsigned>(std::countr_zero(config.avg));
+  const uint64_t hardMask = detail::topBits(bits + 2), easyMask = detail::topBits(bits - 2);
+  const size_t normal = std::min(config.avg, data.size()), end = std::min(config.max, data.size());
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  uint64_t hash = 0;
+  size_t i = config.min;
+
+  for (; i < normal; i++) {
+    hash = (hash << 1) + detail::GEAR[bytes[i]];
+    if (!(hash & hardMask)) return i + 1;
+  }
+  for (; i < end; i++) {
+    hash = (hash << 1) + detail::GEAR[bytes[i]];
+    if (!(hash & easyMask)) return i + 1;
+  }
+
+  return end;
+}
+
+} // namespace Chunker
+
+#endif
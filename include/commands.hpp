@@ -1,15 +1,24 @@
 #ifndef COMMANDS_HPP
 #define COMMANDS_HPP
 
+#include "checkout.hpp"
+#include "commitgraph.hpp"
+#include "diff.hpp"
 #include "global.hpp"
+#include "monitor.hpp"
 #include "objects.hpp"
+#include "trace.hpp"
+#include <climits>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <tuple>
 #include <unordered_set>
+#include <vector>
 
 // TODO: Implement The Commands Here For better Organization:
 
@@ -31,6 +40,7 @@ const fs::path GID_DIRECTORY = CURRENT_PATH / ".gid";
  * `description` files.
  */
 inline void initCommand() {
+  Trace::Scope scope("init");
  
   // OPTIONAL Add various things in config and description.
   // TODO find a way to get author name and commit message.
@@ -53,6 +63,7 @@ inline void initCommand() {
   std::ofstream configFile(configPath);
   // configFile << "repository=" << repoName << std::endl;  // Set repository
   // name
+  configFile << "compression = zlib" << std::endl; // none, zlib or zstd
   configFile.close();
 
   // Create the HEAD file (adjust contents for your initial state)
@@ -74,8 +85,9 @@ inline void initCommand() {
   std::ofstream commitsFile(commitsPath);
   commitsFile.close();
 
-  Tree initialTree = createTree(CURRENT_PATH);
-  std::string hashedTree { serializeObject<Tree>(initialTree) };
+  Index index;
+  Tree initialTree = createTree(CURRENT_PATH, &index);
+  const ObjectId hashedTree { serializeObject<Tree>(initialTree) };
   
   Commit initialCommit(AUTHOR_NAME, COMMIT_MESSAGE,
                       hashedTree);
@@ -84,135 +96,217 @@ inline void initCommand() {
    two chars of hashes being subdirectory name and rest being
   the name of the file that contains content of the objects. */
 
-  storeObject<Commit>(initialCommit, "");
+  storeObject<Commit>(initialCommit);
   storeObject<Tree>(initialTree, initialCommit.treeHash);
+  index.save();
 
   std::cout << "Repository is Created Successfully." << std::endl;
 }
 
 inline void addCommand() {
-  const std::unordered_set<std::string> seenPaths = Add::identify_changes_and_update_index(); 
-  Add::store_added_content(seenPaths);
+  Trace::Scope scope("add");
+  Index index;
+
+  // With a monitor running only the paths it saw change are looked at. It
+  // can not vouch for its list after it started or overflowed, the whole
+  // worktree is scanned then and its list cleared afterwards.
+  Monitor::Changes changes;
+  const bool monitored = Monitor::query(changes);
+
+  if (monitored && !changes.overflowed) {
+    Add::identify_monitored_changes(index, changes.paths);
+  } else {
+    const PathSet seenPaths = Add::identify_changes_and_update_index(index);
+    Add::store_added_content(index, seenPaths);
+  }
+  index.save();
+
+  if (monitored) Monitor::clear(changes.token);
 }
 
 inline void commitCommand() {
-  std::string line, storedPath, storedHash, newHash, op;
-  // Get the content of the index file.
-  std::ifstream indexFile("./.gid/index");
+  Trace::Scope scope("commit");
+  Index index;
 
-  // Check if the index file is empty
-  if (indexFile.peek() == std::ifstream::traits_type::eof()) {
+  // Check if anything is staged
+  if (!index.hasChanges()) {
     std::cout << "Index file is empty. No changes to commit." << std::endl;
-    indexFile.close(); // Close the file
     return; // Exit the function without committing
   }
 
-  // Reset the file pointer to the beginning of the file
-  indexFile.clear();
-  indexFile.seekg(0);
-
-  const fs::path masterTreePath { General::getMasterTreePath() };
-  const std::unordered_set<TreeEntry, TreeEntry::Hash> storedEntries { General::getStoredEntries(masterTreePath) };
-
-  const fs::path objectsPath = fs::current_path() / ".gid/objects";
-  std::unordered_set<std::string> indexPaths;
-
-  while (std::getline(indexFile, line)) {
-    std::istringstream iss(line);
-
-    iss >> op >> storedPath >> storedHash >> newHash; 
-    indexPaths.insert(storedPath);
-    
-    if (op == "DELETED ") {
-      std::cout << "DELETED" << storedPath << "\n";
-      continue;
+  for (const IndexEntry *entry : index.changes()) {
+    if (entry->op == Operation::DELETED) {
+      std::cout << "DELETED " << entry->path << "\n";
     }
-
-    if (!fs::exists(storedPath)) continue; 
   }
 
-  indexFile.close(); // Close the file before reopening in write mode
-
-  // Reopen the index file in write mode and truncate its content
-  std::ofstream indexFileClear("./.gid/index", std::ios::out | std::ios::trunc);
-  indexFileClear.close(); // Close the file after truncating
+  // Only what is staged is committed, the rest of the tree is the one of the
+  // last commit. The staged base hashes are still needed here, new versions
+  // of changed files are stored as deltas against them.
+  Tree tree { createStagedTree(CURRENT_PATH, General::getMasterTreeHash(), index) };
+  index.clearChanges();
 
-  Tree tree { createTree(CURRENT_PATH, storedEntries) };
-
-  std::string treeHash { serializeObject<Tree>(tree) };
+  const ObjectId treeHash { serializeObject<Tree>(tree) };
   Commit commit("Ahmet Yusuf Demir", "Commit Test", 
           treeHash);
 
-  storeObject<Commit>(commit, "");
+  storeObject<Commit>(commit);
   storeObject<Tree>(tree, commit.treeHash);
+  index.save();
 
   std::cout << "Commit is Successfully Made!!" << std::endl;
 }
 
 
-inline void retrieveCommand(const std::string& commitHash) {
-
-  fs::path objectsPath = "./.gid/objects";
-  fs::path commitPath = objectsPath / commitHash.substr(0, 2) / commitHash.substr(2);
+inline void retrieveCommand(const std::string& commitHex) {
+  Trace::Scope scope("retrieve");
 
-  if (!fs::exists(commitPath)) {
+  ObjectId commitHash;
+  if (!ObjectId::fromHex(commitHex, commitHash) || !ObjectStore::exists(commitHash)) {
     std::cerr << "Commit Path does not exist.\nUse `./gid log` to see valid commits." << std::endl;
     return;
   }
 
-  std::ifstream commitFile(commitPath);
-  if (!commitFile.is_open()) {
+  const ObjectStore::Object commit = ObjectStore::read(commitHash);
+  const ObjectStore::CommitView view(commit);
+  if (!view.valid()) {
     std::cerr << "Failed to open commit file." << std::endl;
     return;
   }
 
-  std::string treeHash; 
-  std::string line;
-  while (std::getline(commitFile, line)) {
-    // Store the last non-empty line
-    if (!line.empty()) {
-        treeHash = line;
-    }
+  const ObjectId treeHash = view.treeHash();
+  if (treeHash.isNull()) {
+    std::cerr << "Commit " << commitHash << " has no tree." << std::endl;
+    return;
   }
 
-  size_t colonPos = treeHash.find(':');
-  if (colonPos != std::string::npos) {
-    // Extract the substring after ':'
-    treeHash = treeHash.substr(colonPos + 1);
+  if (!Checkout::run(commitHash, treeHash, "../repo")) std::cerr << "Some files could not be retrieved." << std::endl;
 
-    treeHash.erase(0, treeHash.find_first_not_of(" \t\r\n"));
-    treeHash.erase(treeHash.find_last_not_of(" \t\r\n") + 1);
-    
-    // std::cout << treeHash << std::endl;
+  std::cout << "Retrieved repo path: " << fs::canonical(fs::absolute("../repo")) << 
+    "\nKeep in mind that if you try to retrieve another repo, it will overwrite the repo folder." << std::endl;
+}
+
+/**
+ * Shows the commits, oldest first, read from the commit graph alone: the
+ * graph is walked back from HEAD and the walk stops as soon as enough commits
+ * are found, so the cost follows what is shown and not the length of history.
+ *
+ * @param limit Show at most this many of the latest commits, 0 for all.
+ * @param since Only commits made at or after this time, seconds since the epoch.
+ * @param until Only commits made at or before this time.
+ */
+inline void logCommand(size_t limit = 0, int64_t since = INT64_MIN, int64_t until = INT64_MAX) {
+  Trace::Scope scope("log");
+  const CommitGraph graph;
+  std::vector<size_t> shown;
+
+  for (uint32_t i = graph.empty() ? CommitGraph::NO_PARENT : static_cast<uint32_t>(graph.size() - 1);
+       i != CommitGraph::NO_PARENT && (limit == 0 || shown.size() < limit); i = graph.parent(i)) {
+    const int64_t time = graph.time(i);
+
+    // History only gets older from here.
+    if (time < since) break;
+    if (time <= until) shown.push_back(i);
   }
-  commitFile.close();
-   
-  fs::path treePath = objectsPath / treeHash.substr(0, 2) / treeHash.substr(2);
 
-  createRetrievedFile(treePath);
+  for (auto it = shown.rbegin(); it != shown.rend(); ++it) {
+    const CommitGraph::Entry entry = graph.at(*it);
 
-  std::cout << "Retrieved repo path: " << fs::canonical(fs::absolute("../repo")) << 
-    "\nKeep in mind that if you try to retrieve another repo, it will overwrite the repo folder." << std::endl;
+    std::cout << "Commit Hash is: " << entry.commitHash << "\n"
+              << "timestamp:" << Commit::formatTime(static_cast<time_t>(entry.time)) << "\n"
+              << "treehash:" << entry.treeHash << "\n\n";
+  }
 }
 
-inline void logCommand() {
-  std::ifstream commitsFile("./.gid/commits");
-  std::string commitHash;
+inline void repackCommand() {
+  Trace::Scope scope("repack");
+  const std::optional<size_t> packed = ObjectStore::repack();
+  if (!packed) return;
+
+  if (*packed == 0) {
+    std::cout << "No loose objects to pack." << std::endl;
+    return;
+  }
+
+  std::cout << "Packed " << *packed << " objects." << std::endl;
+}
+
+/**
+ * Shows what changed, in the unified diff format.
+ *
+ *   gid diff            the working tree against the last commit
+ *   gid diff <a>        the working tree against commit a
+ *   gid diff <a> <b>    commit a against commit b
+ *
+ * @param commits Zero, one or two commit hashes.
+ * @param algorithm The diff algorithm to use.
+ */
+inline void diffCommand(const std::vector<std::string> &commits,
+                        Diff::Algorithm algorithm = Diff::Algorithm::Histogram) {
+  Trace::Scope scope("diff");
+  std::vector<ObjectId> ids(commits.size());
+  for (size_t i = 0; i < commits.size(); i++) {
+    if (!ObjectId::fromHex(commits[i], ids[i]) || !ObjectStore::exists(ids[i])) {
+      std::cerr << "Commit " << commits[i] << " does not exist.\nUse `./gid log` to see valid commits." << std::endl;
+      return;
+    }
+  }
+  const ObjectId oldCommit = ids.empty() ? General::getLastCommitHash() : ids[0];
+
+  std::map<std::string, ObjectId> oldBlobs, newBlobs;
+  General::collectTreeBlobs(General::getCommitTreeHash(oldCommit), CURRENT_PATH.string(), oldBlobs);
 
-  while (std::getline(commitsFile, commitHash)) {
-    std::cout << "Commit Hash is: " << commitHash << "\n";
+  const bool workingTree = commits.size() < 2;
+  if (workingTree) {
+    for (auto it = fs::recursive_directory_iterator(CURRENT_PATH); it != fs::recursive_directory_iterator(); ++it) {
+      if (Ignore::ignored(it->path(), it->is_directory())) {
+        it.disable_recursion_pending();
+        continue;
+      }
 
-    fs::path objectsPath = "./.gid/objects";
-    fs::path commitPath = objectsPath / commitHash.substr(0, 2) / commitHash.substr(2);
+      if (it->is_regular_file()) newBlobs[it->path().string()] = ObjectId();
+    }
+  } else {
+    General::collectTreeBlobs(General::getCommitTreeHash(ids[1]), CURRENT_PATH.string(), newBlobs);
+  }
+
+  auto loadBlob = [](const ObjectId &hash, ObjectStore::Object &blob) {
+    blob = ObjectStore::read(hash);
+    const ObjectStore::BlobView view(blob);
+    if (!view.valid()) std::cerr << "Failed to read blob " << hash << std::endl;
+    return view.content();
+  };
+
+  std::map<std::string, std::pair<const ObjectId *, const ObjectId *>> paths;
+  for (const auto &[path, hash] : oldBlobs) paths[path].first = &hash;
+  for (const auto &[path, hash] : newBlobs) paths[path].second = &hash;
+
+  Index index;
+  for (const auto &[path, hashes] : paths) {
+    const auto [oldHash, newHash] = hashes;
+    if (oldHash && newHash && *oldHash == *newHash) continue;
+
+    // Working tree files the index knows to be unchanged are not read.
+    StatData stat;
+    if (workingTree && oldHash && newHash && StatData::read(path, stat)) {
+      const ObjectId *cached = index.lookup(path, stat);
+      if (cached && *cached == *oldHash) continue;
+    }
 
-    std::ifstream commitFile(commitPath);
-    std::string line;
+    ObjectStore::Object oldBlob, newBlob;
+    std::string_view oldText, newText;
+    if (oldHash) oldText = loadBlob(*oldHash, oldBlob);
 
-    while (std::getline(commitFile, line)) {
-      std::cout << line << "\n";  
+    std::optional<MappedFile> file;
+    if (newHash && workingTree) {
+      file.emplace(path, SIZE_MAX);
+      newText = file->view();
+    } else if (newHash) {
+      newText = loadBlob(*newHash, newBlob);
     }
 
-    std::cout << "\n";
+    Diff::writeFileDiff(std::cout, fs::relative(path, CURRENT_PATH).string(), oldText, newText,
+                        oldHash != nullptr, newHash != nullptr, algorithm);
   }
 }
 
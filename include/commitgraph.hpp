@@ -0,0 +1,208 @@
+#ifndef COMMITGRAPH_HPP
+#define COMMITGRAPH_HPP
+
+#include "mappedfile.hpp"
+#include "objectid.hpp"
+#include "objectstore.hpp"
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * The commit graph: every commit in the order it was made, as a table of fixed
+ * width records, so history walks and HEAD lookups never open a commit object.
+ *
+ *   header  "GCGR" <u32 version> <u64 reserved>
+ *   record  <commit hash, 32 bytes> <tree hash, 32 bytes> <i64 time>
+ *           <u32 parent record, NO_PARENT for the first commit> <u32 reserved>
+ *
+ * Record i is found at a fixed offset, the file is memory mapped and a commit
+ * only appends its record. A repository made before the graph existed gets it
+ * built from .gid/commits the first time it is needed.
+ */
+class CommitGraph {
+public:
+  static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+  struct Entry {
+    ObjectId commitHash;
+    ObjectId treeHash;
+    int64_t time = 0; // Seconds since the epoch
+    uint32_t parent = NO_PARENT;
+  };
+
+  explicit CommitGraph(const std::filesystem::path &path = ".gid/commit-graph") : m_path(path) {
+    if (!std::filesystem::exists(m_path) && std::filesystem::exists(COMMITS_PATH)) rebuild(m_path);
+
+    m_file = MappedFile(m_path, SIZE_MAX);
+    const std::string_view data = m_file.view();
+    Header header;
+
+    if (data.size() < sizeof(header)) return;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, "GCGR", 4) != 0 || header.version != VERSION) {
+      std::cerr << "The commit graph is corrupted, remove " << m_path << " to rebuild it." << std::endl;
+      m_corrupted = true;
+      return;
+    }
+
+    // A record cut short by a crash is ignored.
+    m_count = (data.size() - sizeof(header)) / sizeof(Record);
+  }
+
+  size_t size() const { return m_count; }
+  bool empty() const { return m_count == 0; }
+
+  Entry at(size_t i) const {
+    const Record record = read(i);
+    return {ObjectId::fromDigest(record.commit), ObjectId::fromDigest(record.tree), record.time, record.parent};
+  }
+
+  int64_t time(size_t i) const { return read(i).time; }
+  uint32_t parent(size_t i) const { return read(i).parent; }
+
+  // The last commit made, or an empty entry if there is none.
+  Entry head() const { return empty() ? Entry() : at(m_count - 1); }
+
+  /**
+   * Adds a commit on top of the current head.
+   *
+   * @param commitHash The new commit.
+   * @param treeHash Its root tree.
+   * @param time When it was made, in seconds since the epoch.
+   * @return false if the graph could not be written.
+   */
+  bool append(const ObjectId &commitHash, const ObjectId &treeHash, int64_t time) {
+    if (m_corrupted || commitHash.isNull() || treeHash.isNull()) return false;
+
+    Record record{};
+    std::memcpy(record.commit, commitHash.data(), sizeof(record.commit));
+    std::memcpy(record.tree, treeHash.data(), sizeof(record.tree));
+    record.time = time;
+    record.parent = m_count == 0 ? NO_PARENT : static_cast<uint32_t>(m_count - 1);
+
+    std::string buffer;
+    if (m_file.size() < sizeof(Header)) {
+      const Header header{{'G', 'C', 'G', 'R'}, VERSION, 0};
+      buffer.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+    buffer.append(reinterpret_cast<const char *>(&record), sizeof(record));
+
+    // Drop a record cut short by a crash, so the new one lands on its slot.
+    const off_t end = static_cast<off_t>(m_file.size() < sizeof(Header) ? 0 : sizeof(Header) + m_count * sizeof(Record));
+
+    const int fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    const bool written = ::ftruncate(fd, end) == 0 &&
+                         ::pwrite(fd, buffer.data(), buffer.size(), end) == static_cast<ssize_t>(buffer.size());
+    ::close(fd);
+
+    if (written) m_count++;
+    m_file = MappedFile(m_path, SIZE_MAX);
+    return written;
+  }
+
+  /**
+   * Parses a date given to `log --since/--until`, in local time.
+   *
+   * @param text "YYYY-MM-DD", "YYYY-MM-DD HH:MM", "YYYY-MM-DD HH:MM:SS" or
+   *             "@<seconds since the epoch>".
+   * @param out The time in seconds since the epoch.
+   * @return false if the date can not be parsed.
+   */
+  static bool parseDate(const std::string &text, int64_t &out) {
+    if (!text.empty() && text[0] == '@') {
+      char *end = nullptr;
+      out = std::strtoll(text.c_str() + 1, &end, 10);
+      return end && *end == '\0' && end != text.c_str() + 1;
+    }
+
+    for (const char *format : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"}) {
+      std::tm tm{};
+      tm.tm_isdst = -1;
+      const char *end = ::strptime(text.c_str(), format, &tm);
+      if (end && *end == '\0') {
+        out = static_cast<int64_t>(std::mktime(&tm));
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  static constexpr uint32_t VERSION = 1;
+  static inline const std::filesystem::path COMMITS_PATH = ".gid/commits";
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t reserved;
+  };
+
+  struct Record {
+    uint8_t commit[32];
+    uint8_t tree[32];
+    int64_t time;
+    uint32_t parent;
+    uint32_t reserved;
+  };
+  static_assert(sizeof(Header) == 16 && sizeof(Record) == 80);
+
+  Record read(size_t i) const {
+    Record record;
+    std::memcpy(&record, m_file.view().data() + sizeof(Header) + i * sizeof(Record), sizeof(record));
+    return record;
+  }
+
+  // Builds the graph of an existing repository from .gid/commits, reading
+  // each commit object once.
+  static void rebuild(const std::filesystem::path &path) {
+    std::ifstream commits(COMMITS_PATH);
+    const std::filesystem::path tmpPath = path.string() + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (out.fail()) {
+      std::cerr << "Error writing the commit graph: " << path << std::endl;
+      return;
+    }
+
+    const Header header{{'G', 'C', 'G', 'R'}, VERSION, 0};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    std::string hex;
+    uint32_t count = 0;
+
+    while (std::getline(commits, hex)) {
+      Record record{};
+      ObjectId commitHash;
+      if (!ObjectId::fromHex(hex, commitHash)) continue;
+      std::memcpy(record.commit, commitHash.data(), sizeof(record.commit));
+
+      const ObjectStore::Object commit = ObjectStore::read(commitHash);
+      const ObjectStore::CommitView view(commit);
+      parseDate(std::string(view.timestamp()), record.time);
+      std::memcpy(record.tree, view.treeHash().data(), sizeof(record.tree));
+
+      record.parent = count == 0 ? NO_PARENT : count - 1;
+      out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+      count++;
+    }
+
+    out.close();
+    std::filesystem::rename(tmpPath, path);
+  }
+
+  std::filesystem::path m_path;
+  MappedFile m_file{"", 0};
+  size_t m_count = 0;
+  bool m_corrupted = false;
+};
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include "config.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+#include <zlib.h>
+#ifdef GID_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * Per object compression. A compressed object starts with a 12 byte header:
+ *   "\0GZ", u8 codec, u64 uncompressed size (host byte order)
+ * followed by the compressed stream. Objects stored with Codec::None have no
+ * header at all, they are the plain content, which is also how objects written
+ * before compression existed look (they never start with a zero byte).
+ *
+ * The codec for new objects comes from .gid/config:
+ *   compression = zlib        (none, zlib, zstd)
+ *   compression.level = 6
+ * zstd is only there when gid is built against libzstd (GID_HAVE_ZSTD).
+ */
+
+enum class Codec : uint8_t {
+  None = 0,
+  Zlib = 1,
+  Zstd = 2,
+};
+
+namespace Compression {
+
+constexpr size_t HEADER_SIZE = 12;
+constexpr size_t CHUNK = 64 << 10;
+
+inline const char *codecName(Codec codec) {
+  switch (codec) {
+  case Codec::Zlib: return "zlib";
+  case Codec::Zstd: return "zstd";
+  default:          return "none";
+  }
+}
+
+inline bool codecAvailable(Codec codec) {
+#ifdef GID_HAVE_ZSTD
+  return codec == Codec::None || codec == Codec::Zlib || codec == Codec::Zstd;
+#else
+  return codec == Codec::None || codec == Codec::Zlib;
+#endif
+}
+
+inline bool codecFromName(const std::string &name, Codec &codec) {
+  for (Codec c : {Codec::None, Codec::Zlib, Codec::Zstd}) {
+    if (name == codecName(c)) {
+      codec = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct Config {
+  Codec codec = Codec::Zlib;
+  int level = -1; // Codec default
+};
+
+/**
+ * Reads the compression settings from .gid/config, once per run. Unknown or
+ * unavailable codecs fall back to zlib with a warning.
+ */
+inline const Config &config() {
+  static const Config loaded = [] {
+    Config result;
+
+    if (const std::string *name = Settings::get("compression")) {
+      Codec codec;
+      if (codecFromName(*name, codec) && codecAvailable(codec)) result.codec = codec;
+      else std::cerr << "Compression codec '" << *name << "' is not available, using zlib." << std::endl;
+    }
+    result.level = static_cast<int>(Settings::getNumber("compression.level", result.level));
+
+    return result;
+  }();
+
+  return loaded;
+}
+
+/**
+ * Writes an object to a temporary file next to its final path, compressing it
+ * on the fly, and renames it into place on commit().
+ */
+class ObjectWriter {
+public:
+  ObjectWriter(const std::filesystem::path &path, uint64_t size, Codec codec = config().codec,
+               int level = config().level)
+      : m_path(path), m_tmpPath(tmpPath(path)), m_codec(codec) {
+    std::error_code ec;
+    std::filesystem::create_directories(m_path.parent_path(), ec);
+    m_out.open(m_tmpPath, std::ios::binary | std::ios::trunc);
+    if (m_out.fail()) return;
+
+    if (m_codec != Codec::None) {
+      char header[HEADER_SIZE] = {'\0', 'G', 'Z', static_cast<char>(m_codec)};
+      std::memcpy(header + 4, &size, sizeof(size));
+      m_out.write(header, HEADER_SIZE);
+    }
+
+    // An encoder that cannot start fails the write, commit() then keeps nothing.
+    if (m_codec == Codec::Zlib) {
+      m_zlib = std::make_unique<z_stream>();
+      if (deflateInit(m_zlib.get(), level < 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK) {
+        m_zlib.reset();
+        m_out.setstate(std::ios::failbit);
+      }
+    }
+#ifdef GID_HAVE_ZSTD
+    if (m_codec == Codec::Zstd) {
+      m_zstd = ZSTD_createCCtx();
+      if (!m_zstd) {
+        m_out.setstate(std::ios::failbit);
+        return;
+      }
+      ZSTD_CCtx_setParameter(m_zstd, ZSTD_c_compressionLevel, level < 0 ? 3 : level);
+      ZSTD_CCtx_setPledgedSrcSize(m_zstd, size);
+    }
+#endif
+  }
+
+  ObjectWriter(const ObjectWriter &) = delete;
+  ObjectWriter &operator=(const ObjectWriter &) = delete;
+
+  ~ObjectWriter() {
+    if (m_zlib) deflateEnd(m_zlib.get());
+#ifdef GID_HAVE_ZSTD
+    if (m_zstd) ZSTD_freeCCtx(m_zstd);
+#endif
+    if (!m_committed) {
+      m_out.close();
+      std::error_code ec;
+      std::filesystem::remove(m_tmpPath, ec);
+    }
+  }
+
+  bool fail() const { return m_out.fail(); }
+
+  void write(const void *data, size_t size) {
+    if (m_codec == Codec::None) {
+      m_out.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+      return;
+    }
+    encode(data, size, false);
+  }
+
+  void write(std::string_view data) { write(data.data(), data.size()); }
+
+  // Flushes the encoder and moves the object into place. On failure the
+  // temporary file is removed by the destructor.
+  bool commit() {
+    if (m_out.fail()) return false;
+    if (m_codec != Codec::None) encode(nullptr, 0, true);
+    m_out.close();
+    if (m_out.fail()) return false;
+
+    std::error_code ec;
+    std::filesystem::rename(m_tmpPath, m_path, ec);
+    if (ec) return false;
+    m_committed = true;
+    return true;
+  }
+
+  // Unique per writer, two threads may write the same object at once.
+  static std::filesystem::path tmpPath(const std::filesystem::path &path) {
+    static std::atomic<uint64_t> counter{0};
+    return path.string() + ".tmp" + std::to_string(::getpid()) + "-" +
+           std::to_string(counter.fetch_add(1, std::memory_order_relaxed));
+  }
+
+private:
+
+  void encode(const void *data, size_t size, bool finish) {
+    char out[CHUNK];
+
+    if (m_zlib) {
+      m_zlib->next_in = static_cast<Bytef *>(const_cast<void *>(data));
+      m_zlib->avail_in = static_cast<uInt>(size);
+      int result;
+      do {
+        m_zlib->next_out = reinterpret_cast<Bytef *>(out);
+        m_zlib->avail_out = CHUNK;
+        result = deflate(m_zlib.get(), finish ? Z_FINISH : Z_NO_FLUSH);
+        m_out.write(out, static_cast<std::streamsize>(CHUNK - m_zlib->avail_out));
+      } while (m_zlib->avail_out == 0 || (finish && result != Z_STREAM_END && result != Z_STREAM_ERROR));
+    }
+#ifdef GID_HAVE_ZSTD
+    if (m_zstd) {
+      ZSTD_inBuffer in{data, size, 0};
+      size_t remaining;
+      do {
+        ZSTD_outBuffer outBuf{out, CHUNK, 0};
+        remaining = ZSTD_compressStream2(m_zstd, &outBuf, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(remaining)) {
+          m_out.setstate(std::ios::failbit);
+          return;
+        }
+        m_out.write(out, static_cast<std::streamsize>(outBuf.pos));
+      } while (finish ? remaining != 0 : in.pos < in.size);
+    }
+#endif
+  }
+
+  std::filesystem::path m_path, m_tmpPath;
+  Codec m_codec;
+  std::ofstream m_out;
+  std::unique_ptr<z_stream> m_zlib;
+#ifdef GID_HAVE_ZSTD
+  ZSTD_CCtx *m_zstd = nullptr;
+#endif
+  bool m_committed = false;
+};
+
+/**
+ * Decompresses an object while it is read. Compressed input is pulled in
+ * fixed size chunks from the source stream and inflated straight into the get
+ * area, so a reader never holds more than two chunks of the object.
+ */
+class DecompressStreambuf : public std::streambuf {
+public:
+  DecompressStreambuf(std::unique_ptr<std::istream> source, Codec codec)
+      : m_source(std::move(source)), m_codec(codec) {
+    // A decoder that cannot start fails the read at its first byte.
+    if (m_codec == Codec::Zlib) {
+      m_zlib = std::make_unique<z_stream>();
+      if (inflateInit(m_zlib.get()) != Z_OK) {
+        m_zlib.reset();
+        m_failed = true;
+      }
+    }
+#ifdef GID_HAVE_ZSTD
+    if (m_codec == Codec::Zstd) {
+      m_zstd = ZSTD_createDCtx();
+      if (!m_zstd) m_failed = true;
+    }
+#endif
+  }
+
+  ~DecompressStreambuf() override {
+    if (m_zlib) inflateEnd(m_zlib.get());
+#ifdef GID_HAVE_ZSTD
+    if (m_zstd) ZSTD_freeDCtx(m_zstd);
+#endif
+  }
+
+  bool failed() const { return m_failed; }
+
+protected:
+  int_type underflow() override {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+    while (!m_done && !m_failed) {
+      if (m_inPos == m_inSize && !refill()) {
+        m_failed = true; // Truncated stream
+        break;
+      }
+
+      size_t produced = 0;
+      if (m_zlib) {
+        m_zlib->next_in = reinterpret_cast<Bytef *>(m_in + m_inPos);
+        m_zlib->avail_in = static_cast<uInt>(m_inSize - m_inPos);
+        m_zlib->next_out = reinterpret_cast<Bytef *>(m_out);
+        m_zlib->avail_out = CHUNK;
+
+        const int result = inflate(m_zlib.get(), Z_NO_FLUSH);
+        if (result == Z_STREAM_END) m_done = true;
+        else if (result != Z_OK && result != Z_BUF_ERROR) m_failed = true;
+
+        m_inPos = m_inSize - m_zlib->avail_in;
+        produced = CHUNK - m_zlib->avail_out;
+      }
+#ifdef GID_HAVE_ZSTD
+      else if (m_zstd) {
+        ZSTD_inBuffer in{m_in, m_inSize, m_inPos};
+        ZSTD_outBuffer out{m_out, CHUNK, 0};
+
+        const size_t result = ZSTD_decompressStream(m_zstd, &out, &in);
+        if (ZSTD_isError(result)) m_failed = true;
+        else if (result == 0) m_done = true;
+
+        m_inPos = in.pos;
+        produced = out.pos;
+      }
+#endif
+      else {
+        m_failed = true;
+      }
+
+      if (produced > 0) {
+        setg(m_out, m_out, m_out + produced);
+        return traits_type::to_int_type(*gptr());
+      }
+    }
+
+    return traits_type::eof();
+  }
+
+private:
+  bool refill() {
+    m_source->read(m_in, CHUNK);
+    m_inSize = static_cast<size_t>(m_source->gcount());
+    m_inPos = 0;
+    return m_inSize > 0;
+  }
+
+  std::unique_ptr<std::istream> m_source;
+  Codec m_codec;
+  std::unique_ptr<z_stream> m_zlib;
+#ifdef GID_HAVE_ZSTD
+  ZSTD_DCtx *m_zstd = nullptr;
+#endif
+  char m_in[CHUNK];
+  char m_out[CHUNK];
+  size_t m_inPos = 0, m_inSize = 0;
+  bool m_done = false, m_failed = false;
+};
+
+/**
+ * An istream over a compressed object, owning its source and buffer.
+ */
+class DecompressStream : public std::istream {
+public:
+  DecompressStream(std::unique_ptr<std::istream> source, Codec codec)
+      : std::istream(nullptr), m_buffer(std::move(source), codec) {
+    rdbuf(&m_buffer);
+  }
+
+private:
+  DecompressStreambuf m_buffer;
+};
+
+/**
+ * Wraps a raw object stream: if the object carries a compression header the
+ * returned stream decompresses it, otherwise the raw stream is returned as is.
+ */
+inline std::unique_ptr<std::istream> openDecoded(std::unique_ptr<std::istream> raw) {
+  if (raw->fail() || raw->peek() != '\0') return raw;
+
+  char header[HEADER_SIZE];
+  if (!raw->read(header, HEADER_SIZE) || header[1] != 'G' || header[2] != 'Z') {
+    raw->setstate(std::ios::failbit);
+    return raw;
+  }
+
+  const Codec codec = static_cast<Codec>(header[3]);
+  if (!codecAvailable(codec)) {
+    std::cerr << "Object compressed with an unavailable codec (" << int(header[3]) << ")." << std::endl;
+    raw->setstate(std::ios::failbit);
+    return raw;
+  }
+  if (codec == Codec::None) return raw;
+
+  return std::make_unique<DecompressStream>(std::move(raw), codec);
+}
+
+// Whether stored bytes start with a compression header.
+inline bool isCompressed(std::string_view stored) {
+  return stored.size() >= HEADER_SIZE && stored[0] == '\0' && stored[1] == 'G' && stored[2] == 'Z';
+}
+
+/**
+ * Decompresses a whole object held in memory, in one pass into a buffer
+ * sized from its header.
+ *
+ * @param stored The object as stored, starting with its compression header.
+ * @param out The content of the object.
+ * @return false if the object is broken or its codec is unavailable.
+ */
+inline bool decompress(std::string_view stored, std::string &out) {
+  if (!isCompressed(stored)) return false;
+
+  const Codec codec = static_cast<Codec>(stored[3]);
+  uint64_t size;
+  std::memcpy(&size, stored.data() + 4, sizeof(size));
+  const std::string_view input = stored.substr(HEADER_SIZE);
+
+  if (!codecAvailable(codec)) {
+    std::cerr << "Object compressed with an unavailable codec (" << int(stored[3]) << ")." << std::endl;
+    return false;
+  }
+  if (codec == Codec::None) {
+    out.assign(input);
+    return true;
+  }
+
+  // The size is what the writer announced, the buffer grows if it was short.
+  out.resize(std::max<uint64_t>(size, 64));
+  size_t produced = 0;
+  bool done = false, failed = false;
+
+  if (codec == Codec::Zlib) {
+    z_stream zlib{};
+    if (inflateInit(&zlib) != Z_OK) return false;
+    zlib.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    zlib.avail_in = static_cast<uInt>(input.size());
+
+    while (!done && !failed) {
+      if (produced == out.size()) out.resize(2 * out.size());
+      zlib.next_out = reinterpret_cast<Bytef *>(out.data() + produced);
+      zlib.avail_out = static_cast<uInt>(out.size() - produced);
+
+      const int result = inflate(&zlib, Z_NO_FLUSH);
+      produced = out.size() - zlib.avail_out;
+      done = result == Z_STREAM_END;
+      failed = result != Z_OK && !done;
+    }
+    inflateEnd(&zlib);
+  }
+#ifdef GID_HAVE_ZSTD
+  else if (codec == Codec::Zstd) {
+    ZSTD_DCtx *zstd = ZSTD_createDCtx();
+    if (!zstd) return false;
+    ZSTD_inBuffer in{input.data(), input.size(), 0};
+
+    while (!done && !failed) {
+      if (produced == out.size()) out.resize(2 * out.size());
+      ZSTD_outBuffer buffer{out.data() + produced, out.size() - produced, 0};
+
+      const size_t result = ZSTD_decompressStream(zstd, &buffer, &in);
+      produced += buffer.pos;
+      done = result == 0;
+      failed = ZSTD_isError(result) || (!done && in.pos == in.size && produced < out.size());
+    }
+    ZSTD_freeDCtx(zstd);
+  }
+#endif
+
+  out.resize(produced);
+  return done;
+}
+
+} // namespace Compression
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+
+/*
+ * The repository settings in .gid/config, one `key = value` per line:
+ *   compression = zlib
+ *   chunking.avg = 262144
+ * The file is read once per run; unknown keys are ignored.
+ */
+
+namespace Settings {
+
+inline const std::map<std::string, std::string> &all() {
+  static const std::map<std::string, std::string> loaded = [] {
+    std::map<std::string, std::string> result;
+    std::ifstream file(".gid/config");
+    std::string line;
+
+    auto trim = [](std::string s) {
+      s.erase(0, s.find_first_not_of(" \t"));
+      s.erase(s.find_last_not_of(" \t\r") + 1);
+      return s;
+    };
+
+    while (std::getline(file, line)) {
+      const size_t eq = line.find('=');
+      if (eq == std::string::npos || line[0] == '#') continue;
+
+      result[trim(line.substr(0, eq))] = trim(line.substr(eq + 1));
+    }
+
+    return result;
+  }();
+
+  return loaded;
+}
+
+inline const std::string *get(const std::string &key) {
+  auto it = all().find(key);
+  return it == all().end() ? nullptr : &it->second;
+}
+
+// A numeric setting, `fallback` if it is missing or not a number.
+inline long getNumber(const std::string &key, long fallback) {
+  const std::string *value = get(key);
+  if (!value) return fallback;
+
+  char *end = nullptr;
+  const long number = std::strtol(value->c_str(), &end, 10);
+  return end != value->c_str() && *end == '\0' ? number : fallback;
+}
+
+} // namespace Settings
+
+#endif
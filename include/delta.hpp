@@ -0,0 +1,185 @@
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Binary deltas between two versions of an object. A delta is a stream of
+ * instructions that rebuild the target from the base:
+ *   0x00 <varint length> <bytes>           insert the bytes as they are
+ *   0x01 <varint offset> <varint length>   copy a range of the base
+ * Varints are LEB128, seven bits per byte, low bits first.
+ *
+ * Matching works like rsync/git: the base is indexed by a rolling hash of its
+ * BLOCK sized blocks, the target is scanned byte by byte and every hit is
+ * extended as far as it goes in both directions.
+ */
+
+namespace Delta {
+
+constexpr size_t BLOCK = 16;
+
+// Longest delta chain written, bounds how many objects a read has to rebuild.
+constexpr size_t MAX_DEPTH = 16;
+
+// Files smaller than this are always stored whole.
+constexpr size_t MIN_SIZE = 1 << 10;
+
+constexpr uint8_t INSERT = 0x00;
+constexpr uint8_t COPY = 0x01;
+
+inline void putVarint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+inline bool getVarint(std::string_view data, size_t &pos, uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; pos < data.size() && shift < 64; shift += 7) {
+    const uint8_t byte = static_cast<uint8_t>(data[pos++]);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+inline void appendInsert(std::string &out, std::string_view data) {
+  if (data.empty()) return;
+  out.push_back(static_cast<char>(INSERT));
+  putVarint(out, data.size());
+  out.append(data);
+}
+
+inline void appendCopy(std::string &out, uint64_t offset, uint64_t length) {
+  out.push_back(static_cast<char>(COPY));
+  putVarint(out, offset);
+  putVarint(out, length);
+}
+
+namespace detail {
+
+constexpr uint64_t PRIME = 0x100000001b3ULL;
+
+// PRIME^BLOCK, what the byte leaving the window was multiplied by.
+constexpr uint64_t outFactor() {
+  uint64_t factor = 1;
+  for (size_t i = 0; i < BLOCK; i++) factor *= PRIME;
+  return factor;
+}
+
+inline uint64_t blockHash(const char *data) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < BLOCK; i++) hash = hash * PRIME + static_cast<uint8_t>(data[i]);
+  return hash;
+}
+
+inline size_t slot(uint64_t hash, size_t mask) { return static_cast<size_t>((hash ^ (hash >> 29)) & mask); }
+
+} // namespace detail
+
+/**
+ * Appends the instructions that rebuild `target` from `base`.
+ *
+ * @param base The version the delta is taken against.
+ * @param target The new version.
+ * @param out The instructions are appended here.
+ */
+inline void create(std::string_view base, std::string_view target, std::string &out) {
+  if (base.size() < BLOCK || target.size() < BLOCK) {
+    appendInsert(out, target);
+    return;
+  }
+
+  // Open addressed table of block offsets + 1, a later block with the same
+  // slot simply replaces an earlier one.
+  size_t tableSize = 1;
+  while (tableSize < base.size() / BLOCK * 2) tableSize <<= 1;
+  const size_t mask = tableSize - 1;
+  std::vector<uint32_t> table(tableSize, 0);
+
+  for (size_t offset = 0; offset + BLOCK <= base.size(); offset += BLOCK) {
+    table[detail::slot(detail::blockHash(base.data() + offset), mask)] = static_cast<uint32_t>(offset + 1);
+  }
+
+  constexpr uint64_t OUT_FACTOR = detail::outFactor();
+  size_t insertStart = 0, pos = 0;
+  uint64_t hash = detail::blockHash(target.data());
+
+  while (pos + BLOCK <= target.size()) {
+    const uint32_t candidate = table[detail::slot(hash, mask)];
+
+    if (candidate && std::memcmp(base.data() + candidate - 1, target.data() + pos, BLOCK) == 0) {
+      size_t baseStart = candidate - 1, targetStart = pos, length = BLOCK;
+
+      while (baseStart + length < base.size() && targetStart + length < target.size() &&
+             base[baseStart + length] == target[targetStart + length]) {
+        length++;
+      }
+      while (baseStart > 0 && targetStart > insertStart && base[baseStart - 1] == target[targetStart - 1]) {
+        baseStart--;
+        targetStart--;
+        length++;
+      }
+
+      appendInsert(out, target.substr(insertStart, targetStart - insertStart));
+      appendCopy(out, baseStart, length);
+
+      pos = insertStart = targetStart + length;
+      if (pos + BLOCK <= target.size()) hash = detail::blockHash(target.data() + pos);
+      continue;
+    }
+
+    if (pos + BLOCK < target.size()) {
+      hash = hash * detail::PRIME + static_cast<uint8_t>(target[pos + BLOCK]) -
+             OUT_FACTOR * static_cast<uint8_t>(target[pos]);
+    }
+    pos++;
+  }
+
+  appendInsert(out, target.substr(insertStart));
+}
+
+/**
+ * Rebuilds the target of a delta into a buffer of exactly the target size.
+ *
+ * @param base The version the delta was taken against.
+ * @param delta The instructions.
+ * @param out The output buffer.
+ * @param size The size of the target, as recorded with the delta.
+ * @return false if the delta is malformed or does not produce `size` bytes.
+ */
+inline bool apply(std::string_view base, std::string_view delta, char *out, size_t size) {
+  size_t pos = 0, written = 0;
+
+  while (pos < delta.size()) {
+    const uint8_t op = static_cast<uint8_t>(delta[pos++]);
+    uint64_t offset = 0, length;
+
+    if (op == COPY && !getVarint(delta, pos, offset)) return false;
+    if ((op != COPY && op != INSERT) || !getVarint(delta, pos, length)) return false;
+    if (length > size - written) return false;
+
+    if (op == COPY) {
+      if (offset > base.size() || length > base.size() - offset) return false;
+      std::memcpy(out + written, base.data() + offset, length);
+    } else {
+      if (length > delta.size() - pos) return false;
+      std::memcpy(out + written, delta.data() + pos, length);
+      pos += length;
+    }
+    written += length;
+  }
+
+  return written == size;
+}
+
+} // namespace Delta
+
+#endif
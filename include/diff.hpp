@@ -0,0 +1,503 @@
+#ifndef DIFF_HPP
+#define DIFF_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Line diffs. Lines are interned into integer ids up front so both algorithms
+ * only ever compare integers:
+ *  - Myers, the O(ND) greedy algorithm in its linear space form (the middle
+ *    snake splits every region in two).
+ *  - Histogram, as in jgit/git: a region is split around the longest common
+ *    run of its rarest lines, which keeps moved blocks and repeated lines
+ *    (braces, blank lines) from pairing up badly. Regions without a rare
+ *    enough common line fall back to Myers.
+ * Both strip the common prefix and suffix of every region first, so a large
+ * file with a few changes diffs in close to linear time.
+ *
+ * The engine works on any sequence of ids, not just lines; see diff().
+ */
+
+namespace Diff {
+
+enum class Algorithm {
+  Myers,
+  Histogram,
+};
+
+/**
+ * A changed region: `oldCount` elements at `oldStart` were replaced by
+ * `newCount` elements at `newStart`. One of the counts may be zero.
+ */
+struct Change {
+  size_t oldStart, oldCount;
+  size_t newStart, newCount;
+};
+
+namespace detail {
+
+// A line that shows up more often than this in a region is not used to split it.
+constexpr uint32_t MAX_CHAIN = 64;
+
+struct Region {
+  size_t aLo, aHi, bLo, bHi;
+};
+
+class Engine {
+public:
+  Engine(std::span<const uint32_t> a, std::span<const uint32_t> b)
+      : m_a(a), m_b(b), m_removed(a.size(), false), m_added(b.size(), false) {}
+
+  void myers(Region region) {
+    m_stack.push_back(region);
+
+    while (!m_stack.empty()) {
+      Region r = m_stack.back();
+      m_stack.pop_back();
+      if (!trim(r)) continue;
+
+      const auto [x, y] = middleSnake(r);
+      m_stack.push_back({x, r.aHi, y, r.bHi});
+      m_stack.push_back({r.aLo, x, r.bLo, y});
+    }
+  }
+
+  void histogram(Region region) {
+    std::vector<Region> pending{region};
+
+    while (!pending.empty()) {
+      Region r = pending.back();
+      pending.pop_back();
+      if (!trim(r)) continue;
+
+      // Histogram splits can peel off one line at a time on inputs that share
+      // no structure; once they have cost a few passes over the input, the
+      // rest goes to Myers.
+      Region split;
+      if (m_histogramWork > HISTOGRAM_BUDGET * (m_a.size() + m_b.size()) || !findSplit(r, split)) {
+        myers(r);
+        continue;
+      }
+
+      pending.push_back({split.aHi, r.aHi, split.bHi, r.bHi});
+      pending.push_back({r.aLo, split.aLo, r.bLo, split.bLo});
+    }
+  }
+
+  std::vector<Change> changes() const {
+    std::vector<Change> result;
+    size_t i = 0, j = 0;
+
+    while (i < m_a.size() || j < m_b.size()) {
+      if (i < m_a.size() && j < m_b.size() && !m_removed[i] && !m_added[j]) {
+        i++, j++;
+        continue;
+      }
+
+      Change change{i, 0, j, 0};
+      while (i < m_a.size() && m_removed[i]) i++, change.oldCount++;
+      while (j < m_b.size() && m_added[j]) j++, change.newCount++;
+      result.push_back(change);
+    }
+
+    return result;
+  }
+
+private:
+  // Strips the common prefix and suffix. Marks the rest and returns false if
+  // one side is empty, there is nothing left to split then.
+  bool trim(Region &r) {
+    while (r.aLo < r.aHi && r.bLo < r.bHi && m_a[r.aLo] == m_b[r.bLo]) r.aLo++, r.bLo++;
+    while (r.aLo < r.aHi && r.bLo < r.bHi && m_a[r.aHi - 1] == m_b[r.bHi - 1]) r.aHi--, r.bHi--;
+
+    if (r.aLo == r.aHi || r.bLo == r.bHi) {
+      for (size_t i = r.aLo; i < r.aHi; i++) m_removed[i] = true;
+      for (size_t j = r.bLo; j < r.bHi; j++) m_added[j] = true;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Finds a point an optimal edit path of the region goes through, searching
+   * from both ends at once until the two searches overlap. The region has
+   * been trimmed, so the point is never one of its corners.
+   *
+   * Like xdiff, the search gives up after about sqrt(N) edits and splits at
+   * whichever end made the most progress instead, so very different inputs
+   * get a slightly longer diff rather than a quadratic run time.
+   */
+  std::pair<size_t, size_t> middleSnake(const Region &r) {
+    const int64_t n = static_cast<int64_t>(r.aHi - r.aLo), m = static_cast<int64_t>(r.bHi - r.bLo);
+    const int64_t delta = n - m, maxD = std::min((n + m + 1) / 2, maxCost(n + m));
+    const bool odd = delta & 1;
+    const uint32_t *a = m_a.data() + r.aLo, *b = m_b.data() + r.bLo;
+
+    // Furthest x reached on each diagonal k, stored at k + offset. The
+    // overlap checks look up diagonals up to |delta| + d away.
+    const int64_t offset = maxD + std::abs(delta) + 1;
+    m_forward.assign(2 * offset + 1, 0);
+    m_backward.assign(2 * offset + 1, 0);
+    int64_t *vf = m_forward.data() + offset, *vb = m_backward.data() + offset;
+
+    for (int64_t d = 0; d <= maxD; d++) {
+      for (int64_t k = -d; k <= d; k += 2) {
+        int64_t x = (k == -d || (k != d && vf[k - 1] < vf[k + 1])) ? vf[k + 1] : vf[k - 1] + 1;
+        int64_t y = x - k;
+        while (x < n && y < m && a[x] == b[y]) x++, y++;
+        vf[k] = x;
+
+        if (odd && k >= delta - (d - 1) && k <= delta + (d - 1) && x + vb[delta - k] >= n) {
+          return {r.aLo + x, r.bLo + y};
+        }
+      }
+
+      // Backwards, x and y count from the end of the region.
+      for (int64_t k = -d; k <= d; k += 2) {
+        int64_t x = (k == -d || (k != d && vb[k - 1] < vb[k + 1])) ? vb[k + 1] : vb[k - 1] + 1;
+        int64_t y = x - k;
+        while (x < n && y < m && a[n - x - 1] == b[m - y - 1]) x++, y++;
+        vb[k] = x;
+
+        if (!odd && delta - k >= -d && delta - k <= d && x + vf[delta - k] >= n) {
+          return {r.aHi - x, r.bHi - y};
+        }
+      }
+    }
+
+    // Too expensive, split where one of the searches got furthest.
+    int64_t bestProgress = 0, bestX = 0, bestY = 0;
+    bool forward = true;
+    for (int64_t k = -maxD; k <= maxD; k += 2) {
+      for (bool isForward : {true, false}) {
+        const int64_t x = std::min(isForward ? vf[k] : vb[k], n), y = x - k;
+        if (y < 0 || y > m || x + y <= bestProgress) continue;
+
+        bestProgress = x + y, bestX = x, bestY = y, forward = isForward;
+      }
+    }
+
+    if (bestProgress == n + m) return {r.aLo + n / 2, r.bLo + m / 2};
+    if (forward) return {r.aLo + bestX, r.bLo + bestY};
+    return {r.aHi - bestX, r.bHi - bestY};
+  }
+
+  // sqrt(size), at least 256.
+  static int64_t maxCost(int64_t size) {
+    return std::max<int64_t>(static_cast<int64_t>(std::sqrt(static_cast<double>(size))), 256);
+  }
+
+  /**
+   * Picks the common run to split a region around: the one whose rarest line
+   * is least frequent in the old side, the longest among those.
+   */
+  bool findSplit(const Region &r, Region &best) {
+    m_histogramWork += (r.aHi - r.aLo) + (r.bHi - r.bLo);
+
+    const size_t ids = idRange(r);
+    if (m_count.size() < ids) {
+      m_count.resize(ids, 0);
+      m_head.resize(ids, NONE);
+    }
+    m_next.resize(m_a.size());
+
+    for (size_t i = r.aHi; i-- > r.aLo;) {
+      const uint32_t id = m_a[i];
+      m_next[i] = m_head[id];
+      m_head[id] = i;
+      m_count[id]++;
+    }
+
+    uint32_t bestCount = MAX_CHAIN;
+    size_t bestLength = 0;
+
+    for (size_t j = r.bLo; j < r.bHi;) {
+      const uint32_t id = m_b[j];
+      size_t nextJ = j + 1;
+
+      if (m_count[id] == 0 || m_count[id] > bestCount) {
+        j = nextJ;
+        continue;
+      }
+
+      for (size_t i = m_head[id]; i != NONE; i = m_next[i]) {
+        size_t as = i, bs = j, ae = i + 1, be = j + 1;
+        uint32_t rarest = m_count[id];
+
+        while (as > r.aLo && bs > r.bLo && m_a[as - 1] == m_b[bs - 1]) {
+          as--, bs--;
+          rarest = std::min(rarest, m_count[m_a[as]]);
+        }
+        while (ae < r.aHi && be < r.bHi && m_a[ae] == m_b[be]) {
+          rarest = std::min(rarest, m_count[m_a[ae]]);
+          ae++, be++;
+        }
+
+        if (rarest < bestCount || (rarest == bestCount && ae - as > bestLength)) {
+          best = {as, ae, bs, be};
+          bestCount = rarest;
+          bestLength = ae - as;
+        }
+        nextJ = std::max(nextJ, be);
+      }
+
+      j = nextJ;
+    }
+
+    for (size_t i = r.aLo; i < r.aHi; i++) {
+      m_count[m_a[i]] = 0;
+      m_head[m_a[i]] = NONE;
+    }
+
+    return bestLength > 0;
+  }
+
+  size_t idRange(const Region &r) const {
+    uint32_t top = 0;
+    for (size_t i = r.aLo; i < r.aHi; i++) top = std::max(top, m_a[i]);
+    for (size_t j = r.bLo; j < r.bHi; j++) top = std::max(top, m_b[j]);
+    return static_cast<size_t>(top) + 1;
+  }
+
+  static constexpr size_t NONE = SIZE_MAX;
+  static constexpr size_t HISTOGRAM_BUDGET = 8;
+
+  std::span<const uint32_t> m_a, m_b;
+  std::vector<bool> m_removed, m_added;
+  std::vector<Region> m_stack;
+  std::vector<int64_t> m_forward, m_backward;
+  std::vector<uint32_t> m_count;
+  std::vector<size_t> m_head, m_next;
+  size_t m_histogramWork = 0;
+};
+
+} // namespace detail
+
+/**
+ * Diffs two sequences of ids.
+ *
+ * @param a The old sequence.
+ * @param b The new sequence.
+ * @param algorithm Myers or histogram.
+ * @return The changed regions, in order.
+ */
+inline std::vector<Change> diff(std::span<const uint32_t> a, std::span<const uint32_t> b,
+                                Algorithm algorithm = Algorithm::Histogram) {
+  detail::Engine engine(a, b);
+  const detail::Region all{0, a.size(), 0, b.size()};
+
+  if (algorithm == Algorithm::Myers) engine.myers(all);
+  else engine.histogram(all);
+
+  return engine.changes();
+}
+
+/**
+ * Splits a text into lines, each keeping its '\n' so a missing newline at the
+ * end of the file shows up as a change.
+ */
+inline std::vector<std::string_view> splitLines(std::string_view text) {
+  std::vector<std::string_view> lines;
+  size_t start = 0;
+
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    end = end == std::string_view::npos ? text.size() : end + 1;
+    lines.push_back(text.substr(start, end - start));
+    start = end;
+  }
+
+  return lines;
+}
+
+/**
+ * Gives every distinct line an id, equal lines get equal ids. An open
+ * addressed table of (hash, id) pairs keeps this to one probe per line in the
+ * common case and no allocation per line.
+ */
+class LineTable {
+public:
+  std::vector<uint32_t> intern(const std::vector<std::string_view> &lines) {
+    std::vector<uint32_t> ids;
+    ids.reserve(lines.size());
+
+    for (std::string_view line : lines) {
+      if (m_lines.size() * 2 >= m_slots.size()) grow();
+
+      const uint64_t hash = hashLine(line);
+      const uint32_t tag = static_cast<uint32_t>(hash >> 32);
+      size_t slot = hash & m_mask;
+
+      while (true) {
+        Slot &entry = m_slots[slot];
+        if (entry.id == 0) {
+          m_lines.push_back(line);
+          entry = {tag, static_cast<uint32_t>(m_lines.size())};
+          break;
+        }
+        if (entry.tag == tag && m_lines[entry.id - 1] == line) break;
+        slot = (slot + 1) & m_mask;
+      }
+
+      ids.push_back(m_slots[slot].id - 1);
+    }
+
+    return ids;
+  }
+
+private:
+  struct Slot {
+    uint32_t tag; // High half of the hash
+    uint32_t id;  // id + 1, 0 for an empty slot
+  };
+
+  // FNV-1a, eight bytes at a time.
+  static uint64_t hashLine(std::string_view line) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+
+    for (; i + 8 <= line.size(); i += 8) {
+      uint64_t word;
+      std::memcpy(&word, line.data() + i, 8);
+      hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < line.size(); i++) hash = (hash ^ static_cast<uint8_t>(line[i])) * 0x100000001b3ULL;
+
+    return hash ^ (hash >> 29);
+  }
+
+  // Doubles the table, it is kept at most half full.
+  void grow() {
+    const size_t size = m_slots.empty() ? 1024 : m_slots.size() * 2;
+    m_slots.assign(size, Slot{0, 0});
+    m_mask = size - 1;
+
+    for (size_t id = 0; id < m_lines.size(); id++) {
+      const uint64_t hash = hashLine(m_lines[id]);
+      size_t slot = hash & m_mask;
+      while (m_slots[slot].id != 0) slot = (slot + 1) & m_mask;
+      m_slots[slot] = {static_cast<uint32_t>(hash >> 32), static_cast<uint32_t>(id + 1)};
+    }
+  }
+
+  std::vector<Slot> m_slots;
+  std::vector<std::string_view> m_lines;
+  size_t m_mask = 0;
+};
+
+/**
+ * Diffs two texts line by line.
+ *
+ * @param oldLines The lines of the old text, see splitLines().
+ * @param newLines The lines of the new text.
+ * @return The changed regions, in lines.
+ */
+inline std::vector<Change> diffLines(const std::vector<std::string_view> &oldLines,
+                                     const std::vector<std::string_view> &newLines,
+                                     Algorithm algorithm = Algorithm::Histogram) {
+  LineTable table;
+  const std::vector<uint32_t> a = table.intern(oldLines), b = table.intern(newLines);
+  return diff(a, b, algorithm);
+}
+
+// A file is treated as binary if it has a zero byte near its start, like git.
+inline bool isBinary(std::string_view text) {
+  return text.substr(0, 8000).find('\0') != std::string_view::npos;
+}
+
+/**
+ * Writes changes in the unified diff format.
+ *
+ * @param out Where to write.
+ * @param oldLines The lines of the old text.
+ * @param newLines The lines of the new text.
+ * @param changes The changes between them, from diffLines().
+ * @param context How many unchanged lines surround each change.
+ */
+inline void writeUnified(std::ostream &out, const std::vector<std::string_view> &oldLines,
+                         const std::vector<std::string_view> &newLines, const std::vector<Change> &changes,
+                         size_t context = 3) {
+  auto writeLine = [&out](char marker, std::string_view line) {
+    out << marker << line;
+    if (line.empty() || line.back() != '\n') out << "\n\\ No newline at end of file\n";
+  };
+
+  for (size_t first = 0; first < changes.size();) {
+    // Changes closer than two contexts apart share a hunk.
+    size_t last = first;
+    while (last + 1 < changes.size() &&
+           changes[last + 1].oldStart - (changes[last].oldStart + changes[last].oldCount) <= 2 * context) {
+      last++;
+    }
+
+    const size_t oldBegin = changes[first].oldStart - std::min(context, changes[first].oldStart);
+    const size_t newBegin = changes[first].newStart - (changes[first].oldStart - oldBegin);
+    const size_t oldEnd = std::min(oldLines.size(), changes[last].oldStart + changes[last].oldCount + context);
+    const size_t newEnd = newBegin + (oldEnd - oldBegin) + [&] {
+      int64_t shift = 0;
+      for (size_t c = first; c <= last; c++) {
+        shift += static_cast<int64_t>(changes[c].newCount) - static_cast<int64_t>(changes[c].oldCount);
+      }
+      return shift;
+    }();
+
+    const size_t oldCount = oldEnd - oldBegin, newCount = newEnd - newBegin;
+    out << "@@ -" << (oldCount ? oldBegin + 1 : oldBegin) << "," << oldCount << " +"
+        << (newCount ? newBegin + 1 : newBegin) << "," << newCount << " @@\n";
+
+    size_t i = oldBegin;
+    for (size_t c = first; c <= last; c++) {
+      for (; i < changes[c].oldStart; i++) writeLine(' ', oldLines[i]);
+      for (size_t k = 0; k < changes[c].oldCount; k++) writeLine('-', oldLines[i++]);
+      for (size_t k = 0; k < changes[c].newCount; k++) writeLine('+', newLines[changes[c].newStart + k]);
+    }
+    for (; i < oldEnd; i++) writeLine(' ', oldLines[i]);
+
+    first = last + 1;
+  }
+}
+
+/**
+ * Writes the diff of one file with its git style header.
+ *
+ * @param out Where to write.
+ * @param name The path shown for the file.
+ * @param oldText The old content, empty if `hasOld` is false.
+ * @param newText The new content, empty if `hasNew` is false.
+ * @param hasOld false if the file was added.
+ * @param hasNew false if the file was deleted.
+ */
+inline void writeFileDiff(std::ostream &out, const std::string &name, std::string_view oldText,
+                          std::string_view newText, bool hasOld, bool hasNew,
+                          Algorithm algorithm = Algorithm::Histogram) {
+  if (hasOld && hasNew && oldText == newText) return;
+
+  out << "diff --gid a/" << name << " b/" << name << "\n";
+  if (!hasOld) out << "new file\n";
+  if (!hasNew) out << "deleted file\n";
+
+  if (isBinary(oldText) || isBinary(newText)) {
+    out << "Binary files " << (hasOld ? "a/" + name : "/dev/null") << " and "
+        << (hasNew ? "b/" + name : "/dev/null") << " differ\n";
+    return;
+  }
+
+  out << "--- " << (hasOld ? "a/" + name : "/dev/null") << "\n";
+  out << "+++ " << (hasNew ? "b/" + name : "/dev/null") << "\n";
+
+  const std::vector<std::string_view> oldLines = splitLines(oldText), newLines = splitLines(newText);
+  writeUnified(out, oldLines, newLines, diffLines(oldLines, newLines, algorithm));
+}
+
+} // namespace Diff
+
+#endif
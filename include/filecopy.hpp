@@ -0,0 +1,95 @@
+#ifndef FILECOPY_HPP
+#define FILECOPY_HPP
+
+#include <cstdint>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+/*
+ * Copies whole files between descriptors with as little I/O as the filesystem
+ * allows: a reflink shares the extents of the source (btrfs, XFS), then
+ * copy_file_range lets the kernel copy without going through user space (and
+ * may still share extents or copy on the server for NFS), then a plain
+ * read/write loop.
+ */
+
+namespace FileCopy {
+
+// How a file was written. Hardlink is only used by checkout.
+enum class Method {
+  Hardlink,
+  Reflink,
+  CopyRange,
+  Buffered,
+  Failed,
+};
+
+// Buffer of the read/write fallback.
+constexpr size_t BUFFER_SIZE = 1 << 20;
+
+/**
+ * Tries to share the extents of `in` with `out`.
+ *
+ * @return false if the filesystem can not do it.
+ */
+inline bool reflink(int in, int out) {
+#ifdef FICLONE
+  return ::ioctl(out, FICLONE, in) == 0;
+#else
+  (void)in;
+  (void)out;
+  return false;
+#endif
+}
+
+/**
+ * Copies the whole of `in` to the empty file `out`.
+ *
+ * @param in Source, read from offset 0.
+ * @param out Destination, written from offset 0.
+ * @param size The size of the source.
+ * @param allowReflink Whether the destination may share extents with the source.
+ * @return How the data was copied, Failed on error.
+ */
+inline Method copy(int in, int out, uint64_t size, bool allowReflink = true) {
+  if (size == 0) return Method::Buffered;
+  if (allowReflink && reflink(in, out)) return Method::Reflink;
+
+  // copy_file_range may copy less than asked, and fails up front on
+  // filesystems or kernels that do not support it.
+  loff_t inOffset = 0, outOffset = 0;
+  while (static_cast<uint64_t>(inOffset) < size) {
+    const ssize_t copied = ::copy_file_range(in, &inOffset, out, &outOffset, size - inOffset, 0);
+    if (copied <= 0) break;
+  }
+  if (static_cast<uint64_t>(inOffset) == size) return Method::CopyRange;
+
+  // Carries on where copy_file_range stopped.
+  std::unique_ptr<char[]> buffer(new char[BUFFER_SIZE]);
+  off_t offset = inOffset;
+
+  while (true) {
+    const ssize_t count = ::pread(in, buffer.get(), BUFFER_SIZE, offset);
+    if (count < 0) return Method::Failed;
+    if (count == 0) break;
+
+    for (ssize_t done = 0; done < count;) {
+      const ssize_t written = ::pwrite(out, buffer.get() + done, static_cast<size_t>(count - done), offset + done);
+      if (written <= 0) return Method::Failed;
+      done += written;
+    }
+    offset += count;
+  }
+  return Method::Buffered;
+}
+
+} // namespace FileCopy
+
+#endif
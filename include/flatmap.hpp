@@ -0,0 +1,447 @@
+#ifndef FLATMAP_HPP
+#define FLATMAP_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Open addressing hash tables for the hot lookups of a command: the paths
+ * add has seen, the entries of the index, the interned paths. Laid out like
+ * SwissTable: the slots are one flat array and each has a control byte,
+ * either empty, deleted, or 7 bits of the hash of its key. A lookup loads a
+ * group of 16 control bytes (8 without SSE2) and compares them all with the
+ * 7 bits at once, so keys are only compared for the few slots that can
+ * hold them and a miss usually ends at the first group.
+ *
+ * The hash of the key is mixed before use, hashes that only differ in a few
+ * bits (pointers, like PathId) still spread over the table. At most 7/8 of
+ * the slots are used. Inserting or erasing invalidates iterators, and
+ * growing moves the values, pointers to them do not survive an insert.
+ *
+ * The control bytes and the slots come from the allocator, which may be a
+ * std::pmr one to keep a table in an arena:
+ *
+ *   FlatSet<PathId, PathId::Hash> seen;
+ *   FlatMap<PathId, size_t, PathId::Hash> positions;
+ *   FlatSet<std::string_view, std::hash<std::string_view>, std::equal_to<>,
+ *           std::pmr::polymorphic_allocator<std::string_view>> paths(&arena);
+ */
+
+namespace Flat {
+
+namespace detail {
+
+using Control = int8_t;
+
+constexpr Control EMPTY = -128;  // 0b10000000
+constexpr Control DELETED = -2;  // 0b11111110, full slots are 0b0xxxxxxx
+
+// Spreads every bit of the hash over the whole word.
+inline uint64_t mix(uint64_t hash) {
+  const unsigned __int128 product = static_cast<unsigned __int128>(hash) * 0x9e3779b97f4a7c15ull;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+// The slots of a group whose control byte matched, lowest first.
+class BitMask {
+public:
+  BitMask(uint64_t bits, int shift) : m_bits(bits), m_shift(shift) {}
+
+  explicit operator bool() const { return m_bits != 0; }
+  size_t lowest() const { return static_cast<size_t>(std::countr_zero(m_bits)) >> m_shift; }
+  void next() { m_bits &= m_bits - 1; }
+
+private:
+  uint64_t m_bits;
+  int m_shift;
+};
+
+#if defined(__SSE2__)
+
+struct Group {
+  static constexpr size_t WIDTH = 16;
+
+  explicit Group(const Control *control) : m_control(_mm_loadu_si128(reinterpret_cast<const __m128i *>(control))) {}
+
+  BitMask match(Control h2) const { return mask(_mm_cmpeq_epi8(_mm_set1_epi8(h2), m_control)); }
+  BitMask matchEmpty() const { return match(EMPTY); }
+  // Control bytes below -1 are empty or deleted.
+  BitMask matchFree() const { return mask(_mm_cmpgt_epi8(_mm_set1_epi8(-1), m_control)); }
+
+private:
+  static BitMask mask(__m128i bytes) { return BitMask(static_cast<uint32_t>(_mm_movemask_epi8(bytes)), 0); }
+
+  __m128i m_control;
+};
+
+#else
+
+// The same 8 bytes at a time in a word, one result bit at the top of each
+// byte. match() may report a false positive next to a real match, which the
+// key comparison drops.
+struct Group {
+  static constexpr size_t WIDTH = 8;
+  static constexpr uint64_t LSBS = 0x0101010101010101ull;
+  static constexpr uint64_t MSBS = 0x8080808080808080ull;
+
+  explicit Group(const Control *control) {
+    std::memcpy(&m_control, control, sizeof(m_control));
+    if constexpr (std::endian::native == std::endian::big) m_control = __builtin_bswap64(m_control);
+  }
+
+  BitMask match(Control h2) const {
+    const uint64_t x = m_control ^ (LSBS * static_cast<uint8_t>(h2));
+    return BitMask((x - LSBS) & ~x & MSBS, 3);
+  }
+  BitMask matchEmpty() const { return BitMask(m_control & ~(m_control << 6) & MSBS, 3); }
+  BitMask matchFree() const { return BitMask(m_control & ~(m_control << 7) & MSBS, 3); }
+
+private:
+  uint64_t m_control;
+};
+
+#endif
+
+// The key of a set slot is the slot, the key of a map slot its first.
+struct SetKey {
+  template <typename Slot> static const auto &get(const Slot &slot) { return slot; }
+};
+struct MapKey {
+  template <typename Slot> static const auto &get(const Slot &slot) { return slot.first; }
+};
+
+/**
+ * The table behind FlatSet and FlatMap.
+ *
+ * The capacity is a power of two, at least one group. The control bytes of
+ * the first group are repeated after the last slot, so a group can be
+ * loaded from any slot without wrapping around.
+ *
+ * Memory only changes hands between tables with equal allocators: swap()
+ * requires them, a move assignment copies the values otherwise.
+ */
+template <typename Key, typename Slot, typename GetKey, typename Hash, typename Equal, typename Allocator>
+class Table {
+  using Traits = std::allocator_traits<Allocator>;
+  using ControlAllocator = typename Traits::template rebind_alloc<Control>;
+  using SlotAllocator = typename Traits::template rebind_alloc<Slot>;
+
+public:
+  using value_type = Slot;
+  using allocator_type = Allocator;
+
+  template <bool Const> class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Slot;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<Const, const Slot *, Slot *>;
+    using reference = std::conditional_t<Const, const Slot &, Slot &>;
+
+    Iterator() = default;
+    Iterator(const Control *control, pointer slot, const Control *end) : m_control(control), m_slot(slot), m_end(end) {
+      skip();
+    }
+    // An iterator converts to a const_iterator.
+    template <bool Other, typename = std::enable_if_t<Const && !Other>>
+    Iterator(const Iterator<Other> &other) : m_control(other.m_control), m_slot(other.m_slot), m_end(other.m_end) {}
+
+    reference operator*() const { return *m_slot; }
+    pointer operator->() const { return m_slot; }
+
+    Iterator &operator++() {
+      ++m_control;
+      ++m_slot;
+      skip();
+      return *this;
+    }
+
+    bool operator==(const Iterator &other) const { return m_slot == other.m_slot; }
+    bool operator!=(const Iterator &other) const { return m_slot != other.m_slot; }
+
+  private:
+    template <bool> friend class Iterator;
+
+    void skip() {
+      while (m_control != m_end && *m_control < 0) {
+        ++m_control;
+        ++m_slot;
+      }
+    }
+
+    const Control *m_control = nullptr;
+    pointer m_slot = nullptr;
+    const Control *m_end = nullptr;
+  };
+
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  Table() = default;
+  explicit Table(const Allocator &allocator) : m_allocator(allocator) {}
+  ~Table() { destroy(); }
+
+  Table(const Table &other) : m_allocator(Traits::select_on_container_copy_construction(other.m_allocator)) {
+    if (other.empty()) return;
+    reserve(other.size());
+    for (const Slot &slot : other) insertNew(slot);
+  }
+
+  Table(Table &&other) noexcept : m_allocator(other.m_allocator) { swap(other); }
+
+  Table &operator=(const Table &other) {
+    if (this == &other) return *this;
+    clear();
+    reserve(other.size());
+    for (const Slot &slot : other) insertNew(slot);
+    return *this;
+  }
+
+  Table &operator=(Table &&other) noexcept(Traits::is_always_equal::value) {
+    if (!(m_allocator == other.m_allocator)) return *this = other;
+    destroy();
+    swap(other);
+    return *this;
+  }
+
+  allocator_type get_allocator() const { return m_allocator; }
+
+  void swap(Table &other) noexcept {
+    std::swap(m_control, other.m_control);
+    std::swap(m_slots, other.m_slots);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_size, other.m_size);
+    std::swap(m_free, other.m_free);
+  }
+
+  iterator begin() { return iterator(m_control, m_slots, m_control + m_capacity); }
+  iterator end() { return iterator(m_control + m_capacity, m_slots + m_capacity, m_control + m_capacity); }
+  const_iterator begin() const { return const_iterator(m_control, m_slots, m_control + m_capacity); }
+  const_iterator end() const {
+    return const_iterator(m_control + m_capacity, m_slots + m_capacity, m_control + m_capacity);
+  }
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  size_t capacity() const { return m_capacity; }
+
+  // Makes room for `count` values without growing again.
+  void reserve(size_t count) {
+    size_t capacity = Group::WIDTH;
+    while (maxSize(capacity) < count) capacity *= 2;
+    if (capacity > m_capacity) rehash(capacity);
+  }
+
+  // Drops every value, keeps the memory.
+  void clear() {
+    if (m_size > 0) {
+      for (size_t i = 0; i < m_capacity; i++) {
+        if (m_control[i] >= 0) m_slots[i].~Slot();
+      }
+    }
+    if (m_control) std::memset(m_control, EMPTY, m_capacity + Group::WIDTH);
+    m_size = 0;
+    m_free = maxSize(m_capacity);
+  }
+
+  template <typename K> iterator find(const K &key) {
+    const size_t i = findIndex(key, mix(Hash()(key)));
+    return i == NOT_FOUND ? end() : iterator(m_control + i, m_slots + i, m_control + m_capacity);
+  }
+
+  template <typename K> const_iterator find(const K &key) const {
+    const size_t i = findIndex(key, mix(Hash()(key)));
+    return i == NOT_FOUND ? end() : const_iterator(m_control + i, m_slots + i, m_control + m_capacity);
+  }
+
+  template <typename K> bool contains(const K &key) const { return findIndex(key, mix(Hash()(key))) != NOT_FOUND; }
+  template <typename K> size_t count(const K &key) const { return contains(key) ? 1 : 0; }
+
+  // @return The number of values erased, 0 or 1.
+  template <typename K> size_t erase(const K &key) {
+    const size_t i = findIndex(key, mix(Hash()(key)));
+    if (i == NOT_FOUND) return 0;
+
+    m_slots[i].~Slot();
+    setControl(i, DELETED);
+    m_size--;
+    return 1;
+  }
+
+protected:
+  static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+  /**
+   * The slot of a key, a new one where `make` constructs the value if the
+   * key is not there yet.
+   *
+   * @return The slot, and whether it was created.
+   */
+  template <typename K, typename Make> std::pair<iterator, bool> findOrInsert(const K &key, Make &&make) {
+    const uint64_t hash = mix(Hash()(key));
+    size_t i = findIndex(key, hash);
+    if (i != NOT_FOUND) return {iterator(m_control + i, m_slots + i, m_control + m_capacity), false};
+
+    if (m_free == 0) grow();
+    i = freeIndex(hash);
+    make(m_slots + i);
+    if (m_control[i] == EMPTY) m_free--;
+    setControl(i, h2(hash));
+    m_size++;
+    return {iterator(m_control + i, m_slots + i, m_control + m_capacity), true};
+  }
+
+private:
+  static size_t maxSize(size_t capacity) { return capacity - capacity / 8; }
+  static size_t h1(uint64_t hash) { return static_cast<size_t>(hash >> 7); }
+  static Control h2(uint64_t hash) { return static_cast<Control>(hash & 0x7f); }
+
+  template <typename K> size_t findIndex(const K &key, uint64_t hash) const {
+    if (m_size == 0) return NOT_FOUND;
+
+    const size_t mask = m_capacity - 1;
+    for (size_t position = h1(hash) & mask, step = Group::WIDTH;; position = (position + step) & mask,
+                step += Group::WIDTH) {
+      const Group group(m_control + position);
+      for (BitMask match = group.match(h2(hash)); match; match.next()) {
+        const size_t i = (position + match.lowest()) & mask;
+        if (Equal()(GetKey::get(m_slots[i]), key)) return i;
+      }
+      if (group.matchEmpty()) return NOT_FOUND;
+    }
+  }
+
+  // The first empty or deleted slot on the probe sequence of a hash.
+  size_t freeIndex(uint64_t hash) const {
+    const size_t mask = m_capacity - 1;
+    for (size_t position = h1(hash) & mask, step = Group::WIDTH;; position = (position + step) & mask,
+                step += Group::WIDTH) {
+      const BitMask free = Group(m_control + position).matchFree();
+      if (free) return (position + free.lowest()) & mask;
+    }
+  }
+
+  void setControl(size_t i, Control value) {
+    m_control[i] = value;
+    if (i < Group::WIDTH) m_control[m_capacity + i] = value;
+  }
+
+  // Only used on a table with room, the key is known not to be there.
+  void insertNew(const Slot &slot) {
+    const uint64_t hash = mix(Hash()(GetKey::get(slot)));
+    const size_t i = freeIndex(hash);
+    new (m_slots + i) Slot(slot);
+    setControl(i, h2(hash));
+    m_size++;
+    m_free--;
+  }
+
+  // Twice the capacity, or the same if deleted slots take most of it.
+  void grow() {
+    if (m_capacity == 0) rehash(Group::WIDTH);
+    else rehash(m_size + 1 > maxSize(m_capacity) / 2 ? m_capacity * 2 : m_capacity);
+  }
+
+  void rehash(size_t capacity) {
+    Control *oldControl = m_control;
+    Slot *oldSlots = m_slots;
+    const size_t oldCapacity = m_capacity;
+
+    m_control = ControlAllocator(m_allocator).allocate(capacity + Group::WIDTH);
+    m_slots = SlotAllocator(m_allocator).allocate(capacity);
+    m_capacity = capacity;
+    std::memset(m_control, EMPTY, capacity + Group::WIDTH);
+    m_free = maxSize(capacity) - m_size;
+
+    for (size_t i = 0; i < oldCapacity; i++) {
+      if (oldControl[i] < 0) continue;
+
+      const uint64_t hash = mix(Hash()(GetKey::get(oldSlots[i])));
+      const size_t j = freeIndex(hash);
+      new (m_slots + j) Slot(std::move(oldSlots[i]));
+      oldSlots[i].~Slot();
+      setControl(j, h2(hash));
+    }
+
+    if (oldControl) {
+      ControlAllocator(m_allocator).deallocate(oldControl, oldCapacity + Group::WIDTH);
+      SlotAllocator(m_allocator).deallocate(oldSlots, oldCapacity);
+    }
+  }
+
+  void destroy() {
+    if (!m_control) return;
+    clear();
+    ControlAllocator(m_allocator).deallocate(m_control, m_capacity + Group::WIDTH);
+    SlotAllocator(m_allocator).deallocate(m_slots, m_capacity);
+    m_control = nullptr;
+    m_slots = nullptr;
+    m_capacity = m_size = m_free = 0;
+  }
+
+  [[no_unique_address]] Allocator m_allocator;
+  Control *m_control = nullptr;
+  Slot *m_slots = nullptr;
+  size_t m_capacity = 0;
+  size_t m_size = 0;
+  size_t m_free = 0; // Empty slots that may still be used before growing
+};
+
+} // namespace detail
+
+} // namespace Flat
+
+template <typename Key, typename Hash = std::hash<Key>, typename Equal = std::equal_to<>,
+          typename Allocator = std::allocator<Key>>
+class FlatSet : public Flat::detail::Table<Key, Key, Flat::detail::SetKey, Hash, Equal, Allocator> {
+  using Base = Flat::detail::Table<Key, Key, Flat::detail::SetKey, Hash, Equal, Allocator>;
+
+public:
+  using typename Base::iterator;
+  using Base::Base;
+
+  std::pair<iterator, bool> insert(const Key &key) {
+    return this->findOrInsert(key, [&](Key *slot) { new (slot) Key(key); });
+  }
+};
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<>,
+          typename Allocator = std::allocator<std::pair<Key, Value>>>
+class FlatMap
+    : public Flat::detail::Table<Key, std::pair<Key, Value>, Flat::detail::MapKey, Hash, Equal, Allocator> {
+  using Slot = std::pair<Key, Value>;
+  using Base = Flat::detail::Table<Key, Slot, Flat::detail::MapKey, Hash, Equal, Allocator>;
+
+public:
+  using typename Base::iterator;
+  using Base::Base;
+
+  // Constructs the value from `args` if the key is not there yet.
+  template <typename... Args> std::pair<iterator, bool> try_emplace(const Key &key, Args &&...args) {
+    return this->findOrInsert(key, [&](Slot *slot) {
+      new (slot) Slot(std::piecewise_construct, std::forward_as_tuple(key),
+                      std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+  }
+
+  template <typename V> std::pair<iterator, bool> emplace(const Key &key, V &&value) {
+    return try_emplace(key, std::forward<V>(value));
+  }
+
+  Value &operator[](const Key &key) { return try_emplace(key).first->second; }
+};
+
+#endif
@@ -2,27 +2,42 @@
 #define GLOBAL_HPP
 
 #include "SHA256.hpp"
+#include "SHA256Batch.hpp"
+#include "chunker.hpp"
+#include "commitgraph.hpp"
+#include "filecopy.hpp"
+#include "ignore.hpp"
+#include "mappedfile.hpp"
 #include "objects.hpp"
+#include "index.hpp"
+#include "objectstore.hpp"
+#include "pathtable.hpp"
+#include "scheduler.hpp"
+#include "trace.hpp"
+#include "treeformat.hpp"
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
 template <typename T>
-inline void storeObject(const T &object, const std::string &hashed);
-
-enum Operation {
-  DELETED,
-  CREATED,
-  CHANGED,
-};
+inline void storeObject(const T &object, const ObjectId &hashed = ObjectId());
 
 namespace General {
 /**
@@ -31,114 +46,215 @@ namespace General {
  * @param message The message to be hashed.
  * @return The hash of the message.
  */
-inline std::string calculateSHA256(const std::string &message) {
+inline ObjectId calculateSHA256(const std::string &message) {
+  Trace::Scope scope("calculateSHA256");
+  Trace::count("sha256.bytes", message.size());
+
   SHA256 sha;
+  ObjectId result;
 
   sha.update(message);
-  uint8_t *digest = sha.digest();
-  std::string result = SHA256::toString(digest);
-  delete[] digest;
-
+  sha.digest(result.bytes.data());
   return result;
 }
 
-inline std::tuple<fs::path, std::string, std::string>
-parseLine(const std::string &str, const char &indic) {
-  int left = 0, length = static_cast<int>(str.length());
-  std::tuple<fs::path, std::string, std::string> result{"", "", ""};
-
-  int substring_index = 0;
-  for (int right = 0; right <= length && substring_index < 3; right++) {
-    if (right == length || str[right] == indic || str[right] == '\t') {
-      if (!(right - left == 0)) {
-        switch (substring_index) {
-        case 0:
-          std::get<0>(result) = str.substr(left, right - left);
-          break;
-        case 1:
-          std::get<1>(result) = str.substr(left, right - left);
-          break;
-        case 2:
-          std::get<2>(result) = str.substr(left, right - left);
-          break;
-          // Handle additional cases if needed
-        }
-        substring_index++;
-      }
-      left = right + 1; // Move left to the next character
-    }
+/**
+ * Hashes many independent messages at once with the multi-buffer engine.
+ *
+ * @param messages The messages to be hashed.
+ * @return The hash of each message, in the same order.
+ */
+inline std::vector<ObjectId>
+calculateSHA256Batch(const std::vector<std::string_view> &messages) {
+  Trace::Scope scope("calculateSHA256Batch");
+  if (Trace::enabled) {
+    for (std::string_view message : messages) Trace::count("sha256.bytes", message.size());
   }
 
-  return result; // Return the filled tuple
+  std::vector<ObjectId> result;
+  result.reserve(messages.size());
+
+  for (const SHA256Batch::Digest &digest : SHA256Batch::hash(messages)) {
+    result.push_back(ObjectId::fromDigest(digest.data()));
+  }
+
+  return result;
 }
 
-inline fs::path getMasterTreePath() {
-  // Get the hash of the general tree object, Go to commits file, from there to
-  // the general tree object.
-  std::ifstream file("./.gid/commits", std::ios::binary);
-  std::string line, masterCommitHash, masterTreeHash;
+// How many blobs are read before they are hashed together, bounds the memory
+// held by one batch.
+constexpr size_t BATCH_MAX_FILES = 64;
+constexpr size_t BATCH_MAX_BYTES = 8 << 20;
 
-  if (file.fail())
-    std::cerr << "Error opening commits folder. \nYou probably need to initilize repository." << std::endl;
+// Buffer size used when a file is too big to be mapped and gets streamed.
+constexpr size_t STREAM_CHUNK = 1 << 20;
 
-  while (std::getline(file, line)) {
-    masterCommitHash = line;
-  }
-  file.close();
+// Guards the index while trees are built on several threads.
+inline std::mutex indexMutex;
+
+/**
+ * Hashes the content of a file. Mapped files are hashed in place, bigger ones
+ * are streamed through a fixed size buffer.
+ *
+ * @param file The opened file.
+ * @return The hash of the file content.
+ */
+inline ObjectId calculateSHA256(const MappedFile &file) {
+  Trace::Scope scope("calculateSHA256");
+  Trace::count("sha256.bytes", file.size());
 
-  // Go to the masterCommitHash to reach the masterTreeHash
-  const fs::path objectsPath = "./.gid/objects";
-  const fs::path masterCommitPath =
-      objectsPath / masterCommitHash.substr(0, 2) / masterCommitHash.substr(2);
+  SHA256 sha;
 
-  std::ifstream masterCommitFile(masterCommitPath, std::ios::binary);
-  if (masterCommitFile.fail()) {
-    std::cerr << "Error opening MasterCommitFile!" << std::endl;
+  if (file.mapped()) {
+    std::string_view data = file.view();
+    sha.update(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+  } else {
+    std::vector<uint8_t> buffer(STREAM_CHUNK);
+    off_t offset = 0;
+    ssize_t n;
+
+    while ((n = ::pread(file.fd(), buffer.data(), buffer.size(), offset)) > 0) {
+      sha.update(buffer.data(), static_cast<size_t>(n));
+      offset += n;
+    }
   }
 
-  while (std::getline(masterCommitFile, line)) { 
-    masterTreeHash = line;
+  ObjectId result;
+  sha.digest(result.bytes.data());
+  return result;
+}
+
+/**
+ * Reads the tree hash a commit points to.
+ *
+ * @param commitHash The commit.
+ * @return The hash of its root tree, null if the commit can not be read.
+ */
+inline ObjectId getCommitTreeHash(const ObjectId &commitHash) {
+  const ObjectStore::Object commit = ObjectStore::read(commitHash);
+  const ObjectStore::CommitView view(commit);
+
+  if (!view.valid()) {
+    std::cerr << "Error opening commit " << commitHash << std::endl;
   }
-  masterCommitFile.close();
+  return view.treeHash();
+}
+
+// HEAD is the last commit of the commit graph, no object is opened for it.
+inline ObjectId getLastCommitHash() { return CommitGraph().head().commitHash; }
+
+inline ObjectId getMasterTreeHash() { return CommitGraph().head().treeHash; }
 
-  // Go inside the masterTreeFile and loop over the hashes inside it;
-  masterTreeHash = masterTreeHash.substr(9);
-  const fs::path masterTreePath =
-      objectsPath / masterTreeHash.substr(0, 2) / masterTreeHash.substr(2);
+/**
+ * Reads a tree object, its entries are then read in place with
+ * ObjectStore::TreeView.
+ *
+ * @return The tree, invalid if there is no such tree.
+ */
+inline ObjectStore::Object readTree(const ObjectId &treeHash) {
+  if (treeHash.isNull()) return ObjectStore::Object();
 
-  return masterTreePath;
+  ObjectStore::Object tree = ObjectStore::read(treeHash);
+  if (!ObjectStore::TreeView(tree).valid()) std::cerr << "Error reading tree " << treeHash << std::endl;
+  return tree;
 }
 
-inline std::unordered_set<TreeEntry, TreeEntry::Hash> getStoredEntries(const fs::path& treePath) {
-  static std::unordered_set<TreeEntry, TreeEntry::Hash> storedEntries;
+// The path of an entry of the tree of `directory`.
+inline std::string childPath(std::string_view directory, std::string_view name) {
+  std::string path;
+  path.reserve(directory.size() + 1 + name.size());
+  path.append(directory);
+  path += '/';
+  path.append(name);
+  return path;
+}
 
-  // Get all the paths from the repo. 
-  std::ifstream masterTreeFile(treePath);
-  bool isFirstLine = true; std::string line, path, hash, type;
-  const fs::path objectsPath = fs::current_path() / ".gid/objects";
+// Like childPath(), interned, without building a string each time.
+inline PathId internChildPath(std::string_view directory, std::string_view name) {
+  thread_local std::string path;
+  path.assign(directory);
+  path += '/';
+  path.append(name);
+  return Paths::intern(path);
+}
 
-  while (std::getline(masterTreeFile, line)) {
-    if (isFirstLine) {
-      isFirstLine = false;
-      continue;
+/**
+ * Collects every blob reachable from a tree.
+ *
+ * @param treeHash The root tree.
+ * @param directory The absolute path the tree stands for.
+ * @param blobs Filled with (path, blob hash), sorted by path.
+ */
+inline void collectTreeBlobs(const ObjectId &treeHash, const std::string &directory,
+                             std::map<std::string, ObjectId> &blobs) {
+  const ObjectStore::Object tree = readTree(treeHash);
+
+  for (const TreeFormat::Entry &entry : ObjectStore::TreeView(tree)) {
+    if (entry.isTree()) collectTreeBlobs(entry.id, childPath(directory, entry.name), blobs);
+    else blobs[childPath(directory, entry.name)] = entry.id;
+  }
+}
+
+/**
+ * Looks paths up in a tree, reading each tree object once. Used when only a
+ * few paths of the worktree are compared with the last commit.
+ */
+class TreeLookup {
+public:
+  /**
+   * @param rootHash The root tree.
+   * @param root The absolute path it stands for.
+   */
+  TreeLookup(const ObjectId &rootHash, std::string root) : m_rootHash(rootHash), m_root(std::move(root)) {}
+
+  /**
+   * @param path The absolute path of a file or directory.
+   * @param hash Its blob or tree hash.
+   * @param type Whether it is a blob or a tree.
+   * @return false if the tree does not have the path.
+   */
+  bool find(std::string_view path, ObjectId &hash, TreeFormat::Type &type) {
+    if (path.size() <= m_root.size() + 1 || path.compare(0, m_root.size(), m_root) != 0 ||
+        path[m_root.size()] != '/') {
+      return false;
     }
 
-    std::istringstream iss(line); 
-    iss >> path >> hash >> type;
+    // One component at a time, from the root.
+    std::string_view rest = path.substr(m_root.size() + 1);
+    ObjectId current = m_rootHash;
+
+    while (true) {
+      const size_t slash = rest.find('/');
+      const std::string_view name = rest.substr(0, slash);
+      const ObjectStore::TreeView entries(read(current));
 
-    if (fs::is_directory(path)) {
-      fs::path treePath =
-        objectsPath / hash.substr(0, 2) / hash.substr(2);
+      auto it = std::find_if(entries.begin(), entries.end(),
+                             [name](const TreeFormat::Entry &entry) { return entry.name == name; });
+      if (it == entries.end()) return false;
 
-      getStoredEntries(treePath);
-    } 
+      if (slash == std::string_view::npos) {
+        hash = it->id;
+        type = it->type;
+        return true;
+      }
+      if (!it->isTree()) return false;
 
-    TreeEntry treeEntry (path, hash, type);
-    storedEntries.insert(treeEntry);  
+      current = it->id;
+      rest.remove_prefix(slash + 1);
+    }
   }
 
-  return storedEntries;
-}
+private:
+  const ObjectStore::Object &read(const ObjectId &treeHash) {
+    auto [it, inserted] = m_trees.try_emplace(treeHash);
+    if (inserted) it->second = readTree(treeHash);
+    return it->second;
+  }
+
+  ObjectId m_rootHash;
+  std::string m_root;
+  std::unordered_map<ObjectId, ObjectStore::Object> m_trees;
+};
 
 } // namespace General
 
@@ -151,16 +267,15 @@ inline std::unordered_set<TreeEntry, TreeEntry::Hash> getStoredEntries(const fs:
  *
  * @tparam T The type of object to serialize.
  * @param object The object to serialize.
- * @return A string representation of the serialized object.
+ * @return The hash of the serialized object.
  */
-template <typename T> inline std::string serializeObject(const T &object) {
+template <typename T> inline ObjectId serializeObject(const T &object) {
   std::ostringstream ss;
 
   // Serialize object data into the stringstream
   if constexpr (std::is_same<T, Tree>::value) {
-    for (const TreeEntry &entry : object.entries) {
-      ss << entry.relativePath.string() << entry.sha << entry.type;
-    }
+    // A tree is named after its content, entries are sorted by buildTree.
+    ss << object.getContent();
 
   } else if constexpr (std::is_same<T, Commit>::value) {
     // Serialize commit object data
@@ -182,17 +297,16 @@ template <typename T> inline std::string serializeObject(const T &object) {
  * @return The blob object of the file.
  */
 inline Blob createBlob(const fs::path &filePath) {
-  std::ifstream file(filePath);
+  std::ifstream file(filePath, std::ios::binary);
 
   if (!file.is_open()) {
     throw std::runtime_error("Failed to open file.");
   }
 
-  std::string content, line;
-
-  while (std::getline(file, line)) {
-    content += line + "\n"; // Read the file line by line
-  }
+  // Read the file as is, in one go.
+  std::string content(fs::file_size(filePath), '\0');
+  file.read(content.data(), static_cast<std::streamsize>(content.size()));
+  content.resize(static_cast<size_t>(file.gcount()));
 
   file.close();
 
@@ -200,80 +314,587 @@ inline Blob createBlob(const fs::path &filePath) {
 }
 
 /**
- * Recursively generates a tree object to represent the directory structure
- * and its contents starting from the specified directory.
+ * Stores a blob as a delta against an earlier version of the file, when that
+ * is worth it: the base has to be in the store, the chain below it short
+ * enough, and the delta at most half the size of the blob.
  *
- * @param directoryPath The path to the root directory to create a tree from.
+ * @param blobPath Where the object goes in the store.
+ * @param header The blob header line.
+ * @param file The opened file, mapped.
+ * @param baseHash The earlier version.
+ * @return true if the delta was written.
+ */
+inline bool writeBlobDelta(const fs::path &blobPath, const std::string &header,
+                           const MappedFile &file, const ObjectId &baseHash) {
+  if (baseHash.isNull() || !file.mapped() || file.size() < Delta::MIN_SIZE) return false;
+
+  // Raw blobs have no header to match, they are never bases.
+  const ObjectStore::Object base = ObjectStore::read(baseHash);
+  if (!base || base.header().empty()) return false;
+
+  const size_t depth = base.deltaDepth();
+  if (depth >= Delta::MAX_DEPTH) return false;
+
+  const size_t size = header.size() + file.size();
+  std::string instructions;
+  Delta::appendInsert(instructions, header);
+  Delta::create(base.data(), file.view(), instructions);
+  if (instructions.size() > size / 2) return false;
+
+  const std::string deltaHeader =
+      "delta: " + baseHash.hex() + " " + std::to_string(depth + 1) + " " + std::to_string(size) + "\n";
+  Compression::ObjectWriter out(blobPath, deltaHeader.size() + instructions.size());
+
+  out.write(deltaHeader);
+  out.write(instructions);
+  return out.commit();
+}
+
+/**
+ * Stores a big file as a chunked blob: every chunk becomes an object of its
+ * own and the blob object lists them. Chunks already in the store, from
+ * another file or an earlier version of this one, are not written again.
  *
- * @returns A 'Tree' object representing the directory structure and its
- * contents. The 'Tree' contains entries for both files and subdirectories, with
- *          each entry including its name, SHA-2 hash, and type (blob or tree).
+ * @param blobPath Where the blob object goes in the store.
+ * @param filePath The file, also the path recorded in the blob.
  */
-inline Tree createTree(const fs::path &directoryPath,
-    const std::unordered_set<TreeEntry, TreeEntry::Hash>& storedEntries = {}) {
+inline void writeChunkedBlob(const fs::path &blobPath, const fs::path &filePath) {
+  // Mapped whatever its size, chunks are read straight from the mapping.
+  MappedFile file(filePath, SIZE_MAX);
+  if (!file.mapped()) {
+    std::cerr << "Error reading file: " << filePath << std::endl;
+    return;
+  }
 
-  // TODO: Add an Option to exclude some type of files.
-  // Iterate over the files and subdirectories in the specified director
+  const std::string_view data = file.view();
+  const std::string_view header = ObjectStore::CHUNK_HEADER;
+  std::string manifest = "manifest: " + filePath.string() + "\n";
+
+  for (size_t offset = 0; offset < data.size();) {
+    const std::string_view chunk = data.substr(offset, Chunker::cut(data.substr(offset)));
+    offset += chunk.size();
+
+    SHA256 sha;
+    ObjectId chunkHash;
+    sha.update(reinterpret_cast<const uint8_t *>(header.data()), header.size());
+    sha.update(reinterpret_cast<const uint8_t *>(chunk.data()), chunk.size());
+    sha.digest(chunkHash.bytes.data());
+
+    if (!ObjectStore::exists(chunkHash)) {
+      Compression::ObjectWriter out(ObjectStore::loosePath(chunkHash), header.size() + chunk.size());
+      out.write(header);
+      out.write(chunk);
+      if (!out.commit()) std::cerr << "Error writing chunk: " << chunkHash << std::endl;
+    }
 
-  Tree tree;
-  const fs::path objectsPath = fs::current_path() / ".gid/objects";
+    manifest += chunkHash.hex() + " " + std::to_string(chunk.size()) + "\n";
+  }
 
-  for (auto const &dir_entry : fs::directory_iterator(directoryPath)) {
-    // Exclude the .git files (duh).
-    if (dir_entry.path().string().find(".git") != std::string::npos ||
-        dir_entry.path().string().find(".gid") != std::string::npos)
-      continue;
+  Compression::ObjectWriter out(blobPath, manifest.size());
+  out.write(manifest);
+  if (!out.commit()) {
+    std::cerr << "Error writing Blob file: " << blobPath << std::endl;
+  }
+}
 
-    TreeEntry currentEntry {dir_entry.path(), "", ""}; // Create a temporary TreeEntry for comparison
-    auto it = storedEntries.find(currentEntry);
-    if (it != storedEntries.end() && fs::is_directory(dir_entry)) {
-      const TreeEntry& storedEntry = *it;
-      tree.addEntry(storedEntry.relativePath, storedEntry.sha, storedEntry.type);
+/**
+ * Writes a blob object for a file straight from the file, without building the
+ * content in memory. It is compressed on the fly with the configured codec and
+ * written to a temporary file first that is renamed into place, so a half
+ * written object never shows up in the store. Big files are chunked instead.
+ *
+ * @param blobPath Where the object goes in the store.
+ * @param filePath The path recorded in the blob header.
+ * @param file The opened file.
+ * @param baseHash An earlier version of the file to store a delta against, if any.
+ */
+inline void writeBlobObject(const fs::path &blobPath, const fs::path &filePath,
+                            const MappedFile &file, const ObjectId &baseHash = ObjectId()) {
+  if (file.size() >= Chunker::config().threshold) {
+    writeChunkedBlob(blobPath, filePath);
+    return;
+  }
+
+  const std::string header = "blob: " + filePath.string() + "\n";
+  if (writeBlobDelta(blobPath, header, file, baseHash)) return;
+
+  Compression::ObjectWriter out(blobPath, header.size() + file.size());
+
+  if (out.fail()) {
+    std::cerr << "Error creating Blob file: " << blobPath << std::endl;
+    return;
+  }
+
+  out.write(header);
+
+  if (file.mapped()) {
+    out.write(file.view());
+  } else {
+    std::vector<char> buffer(General::STREAM_CHUNK);
+    off_t offset = 0;
+    ssize_t n;
+
+    while ((n = ::pread(file.fd(), buffer.data(), buffer.size(), offset)) > 0) {
+      out.write(buffer.data(), static_cast<size_t>(n));
+      offset += n;
+    }
+  }
+
+  if (!out.commit()) {
+    std::cerr << "Error writing Blob file: " << blobPath << std::endl;
+  }
+}
+
+/**
+ * Stores a file as a raw blob: the bytes as they are, read-only, shared with
+ * the file through a reflink where the filesystem can.
+ *
+ * @param hash The hash of the blob.
+ * @param file The opened file.
+ */
+inline void writeRawBlob(const ObjectId &hash, const MappedFile &file) {
+  const fs::path blobPath = ObjectStore::rawPath(hash);
+  const fs::path tmpPath = Compression::ObjectWriter::tmpPath(blobPath);
+  std::error_code ec;
+  fs::create_directories(blobPath.parent_path(), ec);
+
+  const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+  if (fd < 0) {
+    std::cerr << "Error creating Blob file: " << blobPath << std::endl;
+    return;
+  }
+
+  const bool copied = FileCopy::copy(file.fd(), fd, file.size()) != FileCopy::Method::Failed;
+  if (::close(fd) != 0 || !copied) {
+    std::cerr << "Error writing Blob file: " << blobPath << std::endl;
+    fs::remove(tmpPath, ec);
+    return;
+  }
+  fs::rename(tmpPath, blobPath, ec);
+}
+
+/**
+ * Stores a blob in the configured form, see writeBlobObject and writeRawBlob.
+ *
+ * @param hash The hash of the blob.
+ * @param filePath The file.
+ * @param file The opened file.
+ * @param baseHash An earlier version of the file to store a delta against, if any.
+ */
+inline void writeBlob(const ObjectId &hash, const fs::path &filePath, const MappedFile &file,
+                      const ObjectId &baseHash = ObjectId()) {
+  Trace::Scope scope("writeBlob");
+  if (ObjectStore::rawBlobs()) writeRawBlob(hash, file);
+  else writeBlobObject(ObjectStore::loosePath(hash), filePath, file, baseHash);
+}
+
+/**
+ * The version of a file its new content is stored as a delta against: the one
+ * in the last commit when a change is staged for it, otherwise the one it had
+ * when it was last hashed.
+ *
+ * @param index The index, may be null.
+ * @param filePath The file.
+ * @return The hash of the base, null if there is none.
+ */
+inline ObjectId deltaBase(Index *index, PathId filePath) {
+  const IndexEntry *entry = index ? index->find(filePath) : nullptr;
+  if (!entry) return ObjectId();
+
+  return entry->baseHash.isNull() ? entry->hash : entry->baseHash;
+}
+
+/**
+ * Hashes a file and stores it as a blob object if it is not in the store yet.
+ *
+ * @param filePath The file to store.
+ * @return The hash of the blob.
+ */
+inline ObjectId storeBlobFile(const fs::path &filePath) {
+  MappedFile file(filePath);
+  if (!file.is_open()) {
+    throw std::runtime_error("Failed to open file.");
+  }
+
+  const ObjectId hashedNameBlob = General::calculateSHA256(file);
+
+  if (!ObjectStore::exists(hashedNameBlob)) {
+    writeBlob(hashedNameBlob, filePath, file);
+  }
+
+  return hashedNameBlob;
+}
+
+// A file of a directory that has to be hashed: its entry position in the
+// tree, and the stat data read when the directory was listed.
+struct PendingFile {
+  size_t position;
+  PathId path;
+  StatData stat;
+  bool hasStat;
+};
+
+/**
+ * Hashes a batch of mapped files together, writes the ones not yet in the store
+ * and fills in the hash of their entries in the tree.
+ *
+ * @param tree The tree the files belong to.
+ * @param pending Pairs of (pending file, mapped file), cleared afterwards.
+ * @param index If given, records the stat data of the hashed files, the one
+ *              read before they were hashed: a file written after its stat
+ *              then looks changed to the next lookup, instead of its new
+ *              stat data vouching for its old hash.
+ */
+inline void storeBlobBatch(Tree &tree, std::vector<std::pair<const PendingFile *, MappedFile>> &pending,
+                           Index *index = nullptr) {
+  if (pending.empty()) return;
+
+  std::vector<std::string_view> contents;
+  contents.reserve(pending.size());
+
+  for (const auto &[pendingFile, file] : pending) {
+    contents.push_back(file.view());
+  }
+
+  const std::vector<ObjectId> hashes = General::calculateSHA256Batch(contents);
+
+  for (size_t i = 0; i < pending.size(); i++) {
+    const auto &[pendingFile, file] = pending[i];
+    TreeEntry &entry = tree.entries[pendingFile->position];
+    const ObjectId &hashedNameBlob = hashes[i];
+
+    // Store Blob objects right here.
+    if (!ObjectStore::exists(hashedNameBlob)) {
+      ObjectId base;
+      {
+        std::lock_guard<std::mutex> lock(General::indexMutex);
+        base = deltaBase(index, entry.path);
+      }
+      writeBlob(hashedNameBlob, fs::path(entry.path.view()), file, base);
+    }
+
+    entry.sha = hashedNameBlob;
+
+    if (index && pendingFile->hasStat) {
+      std::lock_guard<std::mutex> lock(General::indexMutex);
+      index->update(entry.path, hashedNameBlob, pendingFile->stat);
+    }
+  }
+
+  pending.clear();
+}
+
+/**
+ * Hashes and stores a batch of files of a tree. Files small enough to be
+ * mapped are hashed together, bigger ones are streamed on their own.
+ *
+ * @param tree The tree the files belong to, its entries get their hashes.
+ * @param files The files.
+ * @param index If given, records the stat data of the hashed files.
+ */
+inline void storeFileBatch(Tree &tree, const std::vector<PendingFile> &files, Index *index) {
+  std::vector<std::pair<const PendingFile *, MappedFile>> pending;
+
+  for (const PendingFile &pendingFile : files) {
+    MappedFile file(pendingFile.path.c_str());
+    if (!file.is_open()) {
+      throw std::runtime_error("Failed to open file.");
+    }
+
+    if (file.mapped()) {
+      pending.emplace_back(&pendingFile, std::move(file));
       continue;
     }
 
-    if (fs::is_regular_file(dir_entry)) {
-      // It's a file, create a blob object
-      // Read the content of the file (you'll need to implement this)
+    const ObjectId hashedNameBlob = storeBlobFile(fs::path(pendingFile.path.view()));
+    if (index && pendingFile.hasStat) {
+      std::lock_guard<std::mutex> lock(General::indexMutex);
+      index->update(pendingFile.path, hashedNameBlob, pendingFile.stat);
+    }
+    tree.entries[pendingFile.position].sha = hashedNameBlob;
+  }
+
+  storeBlobBatch(tree, pending, index);
+}
+
+/**
+ * Builds the tree of one directory. Every batch of files and every
+ * subdirectory becomes a task of the scheduler; the entries are laid out in
+ * directory order before any task starts and each task only fills in the
+ * hashes of its own entries, then sorted by name, so the tree is the same
+ * whatever the number of threads or the directory order.
+ *
+ * This is the whole worktree as it is, what init records. A commit records
+ * the staged changes only, see buildStagedTree().
+ */
+inline Tree buildTree(const fs::path &directoryPath, Index *index) {
+  Trace::Scope scope("buildTree");
+
+  Tree tree;
+  std::vector<std::vector<PendingFile>> batches(1);
+  std::vector<std::pair<size_t, PathId>> subdirectories;
+  size_t batchBytes = 0;
+
+  for (auto const &dir_entry : fs::directory_iterator(directoryPath)) {
+    // .gid, .git and what .gidignore lists; directories are never entered.
+    if (Ignore::ignored(dir_entry.path(), dir_entry.is_directory())) continue;
 
-      Blob blob{createBlob(dir_entry)};
-      std::string blobContent = blob.getContent();
+    const PathId path = Paths::intern(dir_entry.path().native());
 
-      // Compute the SHA-1 hash for the content
-      std::string hashedNameBlob = serializeObject<Blob>(blob);
-      fs::path blobPath =
-          objectsPath / hashedNameBlob.substr(0, 2) / hashedNameBlob.substr(2);
+    if (fs::is_regular_file(dir_entry)) {
+      // Unchanged since it was last hashed and already in the store.
+      StatData stat;
+      const bool hasStat = StatData::read(path, stat);
+      if (index && hasStat) {
+        ObjectId cached;
+        {
+          std::lock_guard<std::mutex> lock(General::indexMutex);
+          if (const ObjectId *hash = index->lookup(path, stat)) cached = *hash;
+        }
+
+        if (ObjectStore::exists(cached)) {
+          tree.addEntry(path, cached, TreeFormat::Type::Blob);
+          continue;
+        }
+      }
 
-      // Store Blob objects right here.
-      fs::create_directories(blobPath.parent_path());
+      // It's a file, it gets its hash when its batch is stored.
+      batchBytes += stat.size;
+      batches.back().push_back({tree.entries.size(), path, stat, hasStat});
+      tree.addEntry(path, ObjectId(), TreeFormat::Type::Blob);
 
-      if (!fs::exists(blobPath)) {
-        // BUG See what the binary mode is.
-        std::ofstream file(blobPath, std::ios::binary);
-        file.write(blobContent.c_str(), blobContent.size());
-        file.close();
+      if (batches.back().size() >= General::BATCH_MAX_FILES ||
+          batchBytes >= General::BATCH_MAX_BYTES) {
+        batches.emplace_back();
+        batchBytes = 0;
       }
-      // Add an entry for the file to the tree
-      tree.addEntry(dir_entry.path(), hashedNameBlob, "blob");
 
     } else {
-      // It's a directory, call the function recursively
-      // Compute the SHA-1 hash for the directory's name (for simplicity)
-      std::string hashedNameTree =
-          General::calculateSHA256(dir_entry.path().filename().string());
+      // It's a directory, it gets its hash when its subtree is built.
+      subdirectories.emplace_back(tree.entries.size(), path);
+      tree.addEntry(path, ObjectId(), TreeFormat::Type::Tree);
+    }
+  }
 
-      // Create a subtree by calling the function recursively
-      Tree subTree = createTree(dir_entry.path().string(), storedEntries);
+  // The entries are all in place, the tasks only write to their own ones.
+  TaskGroup group;
+
+  for (const auto &[position, path] : subdirectories) {
+    group.run([&tree, index, position, path] {
+      // Create a subtree by calling the function recursively, it is named
+      // after its content.
+      Tree subTree = buildTree(fs::path(path.view()), index);
+      const ObjectId hashedNameTree = serializeObject<Tree>(subTree);
       storeObject<Tree>(subTree, hashedNameTree);
 
-      // Add an entry for the subdirectory to the tree
-      tree.addEntry(dir_entry.path(), hashedNameTree, "tree");
+      tree.entries[position].sha = hashedNameTree;
+    });
+  }
+
+  for (const std::vector<PendingFile> &batch : batches) {
+    if (batch.empty()) continue;
+    group.run([&tree, &batch, index] { storeFileBatch(tree, batch, index); });
+  }
+
+  group.wait();
+
+  std::sort(tree.entries.begin(), tree.entries.end(),
+            [](const TreeEntry &a, const TreeEntry &b) { return a.name() < b.name(); });
+  return tree;
+}
+
+// For every directory on the way from a staged path up to the root, the
+// entries of it that lead to staged paths: the staged files themselves and
+// the directories above them.
+using StagedChildren = FlatMap<PathId, std::vector<PathId>, PathId::Hash>;
+
+/**
+ * Collects the directories a commit has to rebuild.
+ *
+ * @param index The index.
+ * @param root The absolute path of the repository.
+ */
+inline StagedChildren stagedChildren(Index &index, std::string_view root) {
+  StagedChildren children;
+
+  // Sorted by path, so the children of a directory come one after the other.
+  for (const IndexEntry *entry : index.changes()) {
+    PathId child = entry->path;
+
+    while (true) {
+      const std::string_view path = child.view();
+      const size_t slash = path.rfind('/');
+      if (slash == std::string_view::npos || slash < root.size()) break;
+
+      const PathId parent = Paths::intern(path.substr(0, slash));
+      auto [it, added] = children.try_emplace(parent);
+      if (it->second.empty() || it->second.back() != child) it->second.push_back(child);
+
+      // Its parents were recorded along with it.
+      if (!added || slash == root.size()) break;
+      child = parent;
     }
   }
 
+  return children;
+}
+
+/**
+ * Builds the tree of one directory for a commit: its tree in the last commit
+ * with the changes staged below it applied. Staged files are read as they
+ * are now and dropped if they are gone, the other entries keep the hash
+ * they had, whatever happened to them in the worktree since. Directories
+ * with nothing staged below them are not read at all, so the cost follows
+ * the number of staged paths and not the size of the worktree.
+ *
+ * Like buildTree(), the subdirectories and batches of files are tasks of the
+ * scheduler, which only fill in their own entries.
+ *
+ * @param baseHash The tree of the directory in the last commit, null if it
+ *                 is new.
+ * @param directory The directory.
+ * @param staged The directories to rebuild, see stagedChildren().
+ * @param index The index, records the stat data of the hashed files.
+ */
+inline Tree buildStagedTree(const ObjectId &baseHash, PathId directory, const StagedChildren &staged, Index &index) {
+  Trace::Scope scope("buildStagedTree");
+
+  Tree tree;
+  const ObjectStore::Object base = General::readTree(baseHash);
+  for (const TreeFormat::Entry &entry : ObjectStore::TreeView(base)) {
+    tree.addEntry(General::internChildPath(directory.view(), entry.name), entry.id, entry.type);
+  }
+
+  FlatMap<PathId, size_t, PathId::Hash> positions;
+  for (size_t i = 0; i < tree.entries.size(); i++) positions.try_emplace(tree.entries[i].path, i);
+
+  auto position = [&tree, &positions](PathId path, TreeFormat::Type type) {
+    auto [it, added] = positions.try_emplace(path, tree.entries.size());
+    if (added) tree.addEntry(path, ObjectId(), type);
+    return it->second;
+  };
+
+  std::vector<std::vector<PendingFile>> batches(1);
+  std::vector<std::tuple<size_t, PathId, ObjectId>> subdirectories;
+  std::vector<size_t> deleted;
+  size_t batchBytes = 0;
+
+  auto found = staged.find(directory);
+  if (found != staged.end()) {
+    for (const PathId child : found->second) {
+      Operation op;
+      {
+        std::lock_guard<std::mutex> lock(General::indexMutex);
+        const IndexEntry *entry = index.find(child);
+        op = entry ? entry->op : Operation::UNCHANGED;
+      }
+
+      // A staged file replaces a directory of the same name, whose files
+      // are staged as deleted.
+      const bool file = (op == Operation::CREATED || op == Operation::CHANGED) && fs::is_regular_file(child.c_str());
+      if (!file && staged.contains(child)) {
+        const size_t i = position(child, TreeFormat::Type::Tree);
+        const TreeEntry &entry = tree.entries[i];
+        subdirectories.emplace_back(i, child, entry.type == TreeFormat::Type::Tree ? entry.sha : ObjectId());
+        continue;
+      }
+
+      // Deleted, or gone since it was staged.
+      StatData stat;
+      const bool hasStat = StatData::read(child, stat);
+      if (!file) {
+        if (auto it = positions.find(child); it != positions.end()) deleted.push_back(it->second);
+        continue;
+      }
+
+      const size_t i = position(child, TreeFormat::Type::Blob);
+      tree.entries[i].type = TreeFormat::Type::Blob;
+      batchBytes += stat.size;
+      batches.back().push_back({i, child, stat, hasStat});
+
+      if (batches.back().size() >= General::BATCH_MAX_FILES || batchBytes >= General::BATCH_MAX_BYTES) {
+        batches.emplace_back();
+        batchBytes = 0;
+      }
+    }
+  }
+
+  // Written by the tasks, one element each, so not a vector<bool>.
+  std::vector<char> removed(tree.entries.size(), false);
+  for (const size_t i : deleted) removed[i] = true;
+
+  TaskGroup group;
+
+  for (const auto &[i, path, subBase] : subdirectories) {
+    group.run([&tree, &staged, &index, &removed, i, path, subBase] {
+      Tree subTree = buildStagedTree(subBase, path, staged, index);
+      tree.entries[i].type = TreeFormat::Type::Tree;
+
+      // Everything below it was deleted.
+      if (subTree.entries.empty()) {
+        removed[i] = true;
+        return;
+      }
+
+      const ObjectId hashedNameTree = serializeObject<Tree>(subTree);
+      storeObject<Tree>(subTree, hashedNameTree);
+      tree.entries[i].sha = hashedNameTree;
+    });
+  }
+
+  for (const std::vector<PendingFile> &batch : batches) {
+    if (batch.empty()) continue;
+    group.run([&tree, &batch, &index] { storeFileBatch(tree, batch, &index); });
+  }
+
+  group.wait();
+
+  for (size_t i = tree.entries.size(); i-- > 0;) {
+    if (removed[i]) tree.entries.erase(tree.entries.begin() + i);
+  }
+  std::sort(tree.entries.begin(), tree.entries.end(),
+            [](const TreeEntry &a, const TreeEntry &b) { return a.name() < b.name(); });
   return tree;
 }
 
+/**
+ * Recursively generates a tree object to represent the directory structure
+ * and its contents starting from the specified directory. Directories and
+ * batches of files are processed in parallel on the shared scheduler, see
+ * Scheduler for how many threads are used.
+ *
+ * @param directoryPath The path to the root directory to create a tree from.
+ * @param index If given, files whose stat data did not change since they
+ *                  were last hashed are not read again.
+ *
+ * @returns A 'Tree' object representing the directory structure and its
+ * contents. The 'Tree' contains entries for both files and subdirectories, with
+ *          each entry including its name, SHA-2 hash, and type (blob or tree).
+ */
+inline Tree createTree(const fs::path &directoryPath, Index *index = nullptr) {
+  Trace::Scope scope("createTree");
+  // Loaded up front, the tasks only read them.
+  ObjectStore::packs();
+
+  return buildTree(directoryPath, index);
+}
+
+/**
+ * Generates the tree of a commit: the tree of the last commit with the
+ * changes staged in the index applied, see buildStagedTree().
+ *
+ * @param directoryPath The root of the repository.
+ * @param baseHash The tree of the last commit.
+ * @param index The index with the staged changes.
+ */
+inline Tree createStagedTree(const fs::path &directoryPath, const ObjectId &baseHash, Index &index) {
+  Trace::Scope scope("createStagedTree");
+  ObjectStore::packs();
+
+  const std::string_view root = directoryPath.native();
+  return buildStagedTree(baseHash, Paths::intern(root), stagedChildren(index, root), index);
+}
+
 /**
  * Store an object of a specific type in the .gid objects folder.
  *
@@ -286,12 +907,11 @@ inline Tree createTree(const fs::path &directoryPath,
  * @param object The object to be stored.
  */
 template <typename T>
-inline void storeObject(const T &object, const std::string &hashed) {
+inline void storeObject(const T &object, const ObjectId &hashed) {
+  Trace::Scope scope("storeObject");
   // OPTIONAL: Implement an Unlimited object parameter ?
 
-  const fs::path objectsPath = ".gid/objects";
-
-  if (!fs::exists(objectsPath)) {
+  if (!fs::exists(ObjectStore::OBJECTS_PATH)) {
     std::cerr << "The .gid Files are Corrupted. Objects folder can not be "
                  "found. Stop."
               << std::endl;
@@ -305,48 +925,44 @@ inline void storeObject(const T &object, const std::string &hashed) {
   if constexpr (std::is_same<T, Tree>::value) {
     // Store the Tree object
 
-    std::string hashedNameTree =
-        (hashed.empty()) ? serializeObject<Tree>(object) : hashed;
-    fs::path treePath =
-        objectsPath / hashedNameTree.substr(0, 2) / hashedNameTree.substr(2);
+    const ObjectId hashedNameTree = hashed.isNull() ? serializeObject<Tree>(object) : hashed;
+    fs::path treePath = ObjectStore::loosePath(hashedNameTree);
 
-    // Create the directory if does not exist.
-    fs::create_directories(treePath.parent_path());
+    // The directory is created by the writer, which copes with other threads
+    // creating it at the same time.
 
-    if (!fs::exists(treePath)) {
-      // BUG See what the binary mode is.
-      std::ofstream file(treePath, std::ios::binary);
+    if (!ObjectStore::exists(hashedNameTree)) {
+      Compression::ObjectWriter file(treePath, content.size());
 
-      if (file.fail())
+      file.write(content);
+      if (!file.commit())
         std::cerr << "Error creating Tree file: " << treePath << std::endl;
-
-      file.write(content.c_str(), content.size());
-      file.close();
     }
 
   } else if constexpr (std::is_same<T, Commit>::value) {
     // Store the Commit Object
-    std::string hashedNameCommit =
-        (hashed.empty()) ? serializeObject<Commit>(object) : hashed;
-    fs::path commitPath = objectsPath / hashedNameCommit.substr(0, 2) /
-                          hashedNameCommit.substr(2);
+    const ObjectId hashedNameCommit = hashed.isNull() ? serializeObject<Commit>(object) : hashed;
+    fs::path commitPath = ObjectStore::loosePath(hashedNameCommit);
 
     // Create the directory if does not exist.
     fs::create_directories(commitPath.parent_path());
 
-    if (!fs::exists(commitPath)) {
-      // BUG See what the binary mode is.
-      std::ofstream file(commitPath, std::ios::binary);
+    if (!ObjectStore::exists(hashedNameCommit)) {
+      Compression::ObjectWriter file(commitPath, content.size());
 
-      if (file.fail())
+      file.write(content);
+      if (!file.commit())
         std::cerr << "Error creating Commit file: " << commitPath << std::endl;
 
-      file.write(content.c_str(), content.size());
-      file.close();
+      // The graph is loaded before the commits file gets the new line, an
+      // old repository rebuilds it from the commits made so far.
+      CommitGraph graph;
+      if (!graph.append(hashedNameCommit, object.treeHash, object.seconds))
+        std::cerr << "Error updating the commit graph." << std::endl;
 
       std::ofstream commit_file(".gid/commits", std::ios::app);
 
-      if (file.fail())
+      if (commit_file.fail())
         std::cerr << "Error opening Commits Folder! \nYou probably need to initilize repository." << std::endl;
 
       commit_file << hashedNameCommit << "\n";
@@ -357,238 +973,219 @@ inline void storeObject(const T &object, const std::string &hashed) {
 
 namespace Add {
 
-// Tell the compiler the function exists.
-inline void
-identify_changes_and_update_index_recursive(const std::string&, std::unordered_set<std::string>&);
-
-// TODO: Add operation parameter to keep track of what type of change it is.
-inline bool isPathStored(const std::string &path) {
-  std::ifstream indexFile("./.gid/index");
-  std::string line, storedPath, trash;
+// Function to stage a change in the index if none is staged for the path yet
+inline void storeIndex(Index &index,
+                      const ObjectId &changed_hash,
+                      std::string_view file_path,
+                      const Operation& op = Operation::CHANGED) {
+  Trace::Scope scope("storeIndex");
 
-  while (std::getline(indexFile, line)) {
-    std::istringstream iss(line);
 
-    // Extract path and hash from the line
-    iss >> trash >> storedPath;
-
-    if (storedPath == path) {
-      indexFile.close();
-      return true;
-    }
+  if (op == Operation::UNCHANGED) {
+    std::cerr << "Unknown Operation!" << std::endl; 
+    return;
   }
 
-  indexFile.close();
-  return false;
-}
-
-// Function to store a hash in the index file if it hasn't been stored yet
-inline void storeIndex(const std::string &changed_hash,
-                      const fs::path &file_path, 
-                      const Operation& op = Operation::CHANGED,
-                      const std::string &newHash = " | ") {
-
-  if (!isPathStored(file_path.string())) {
-    std::ofstream index_file("./.gid/index", std::ios::app);
-        
-    switch (op) {
-      case Operation::CREATED:
-        index_file << "CREATED ";
-        break;
-
-      case Operation::CHANGED:
-        index_file << "CHANGED ";
-        break;
-
-      case Operation::DELETED:
-        index_file << "DELETED ";
-        break;
-
-      default:
-        std::cerr << "Unknown Operation!" << std::endl; 
-        break;
-    }
-    
-    index_file << file_path.string() << " " << changed_hash << " " << newHash << "\n";
-    index_file.close();
-    std::cout << "A Change is Made in: " << file_path.string() << " \n";
+  if (index.stage(file_path, op, changed_hash)) {
+    std::cout << "A Change is Made in: " << file_path << " \n";
   } 
 }
 
-inline void store_added_content(const std::unordered_set<std::string>& seenPaths) { 
-  for (auto const& dir_entry : fs::recursive_directory_iterator(fs::current_path())){
-    if (dir_entry.path().string().find(".git") != std::string::npos ||
-      dir_entry.path().string().find(".gid") != std::string::npos)
-      continue; 
+inline void store_added_content(Index &index, const PathSet &seenPaths) {
+  for (auto it = fs::recursive_directory_iterator(fs::current_path()); it != fs::recursive_directory_iterator(); ++it) {
+    const fs::directory_entry &dir_entry = *it;
+    if (Ignore::ignored(dir_entry.path(), dir_entry.is_directory())) {
+      it.disable_recursion_pending();
+      continue;
+    }
 
-    if (fs::is_regular_file(dir_entry)) {
-      if (seenPaths.count(dir_entry.path().string()) <= 0) {
-        Add::storeIndex("|", dir_entry, Operation::CREATED); 
+    if (dir_entry.is_regular_file()) {
+      // Paths never interned were not seen either.
+      if (!seenPaths.contains(Paths::find(dir_entry.path().native()))) {
+        Add::storeIndex(index, ObjectId(), dir_entry.path().native(), Operation::CREATED);
       }
     }
   }
 }
 
-inline std::unordered_set<std::string> identify_changes_and_update_index() {
-  fs::path masterTreePath = General::getMasterTreePath(); 
-  std::unordered_set<std::string> seenPaths = {};
-  std::string line;
+/**
+ * Rehashes the tracked files in batches and records the ones whose content no
+ * longer matches the hash stored in the tree. Files whose stat data matches
+ * the index are not read, the cached hash is used instead.
+ *
+ * @param tracked Pairs of (file path, stored hash), cleared afterwards.
+ * @param index The index, updated with every file that was hashed.
+ */
+inline void compare_tracked_blobs(std::vector<std::pair<PathId, ObjectId>> &tracked,
+                                  Index &index) {
+  Trace::Scope scope("compare_tracked_blobs");
+  std::vector<ObjectId> current(tracked.size());
+  std::vector<StatData> stats(tracked.size());
+  std::vector<size_t> stale;
+
+  for (size_t i = 0; i < tracked.size(); i++) {
+    const PathId path = tracked[i].first;
+    const ObjectId *cached = StatData::read(path, stats[i])
+                                    ? index.lookup(path, stats[i])
+                                    : nullptr;
+
+    if (cached) current[i] = *cached;
+    else stale.push_back(i);
+  }
 
-  std::ifstream masterTreeFile(masterTreePath, std::ios::binary);
-  bool isFirstLine = true;
+  for (size_t begin = 0; begin < stale.size();) {
+    std::vector<MappedFile> files;
+    std::vector<std::string_view> contents;
+    size_t end = begin, bytes = 0;
 
-  while (std::getline(masterTreeFile, line)) {
-    if (isFirstLine) {
-      isFirstLine = false;
-      continue; 
+    while (end < stale.size() && end - begin < General::BATCH_MAX_FILES &&
+           bytes < General::BATCH_MAX_BYTES) {
+      files.emplace_back(tracked[stale[end]].first.c_str());
+      bytes += files.back().size();
+      end++;
     }
 
-    auto [file_path, hash, type] = General::parseLine(line, ' ');
+    // Mapped files are hashed together, the others are streamed one by one.
+    for (const MappedFile &file : files) {
+      if (file.mapped()) contents.push_back(file.view());
+    }
+    const std::vector<ObjectId> batchHashes = General::calculateSHA256Batch(contents);
 
-    // If it's a file, simply calc another hash and compare with the previous
-    if (type == "blob") {
-      std::string hashToCompare;
+    for (size_t i = 0, batched = 0; i < files.size(); i++) {
+      const size_t position = stale[begin + i];
+      current[position] = files[i].mapped() ? batchHashes[batched++]
+                                            : General::calculateSHA256(files[i]);
+      index.update(tracked[position].first, current[position], stats[position]);
+    }
 
-      if (fs::exists(file_path)) {
-        hashToCompare = serializeObject<Blob>(createBlob(file_path));
-        seenPaths.insert(file_path.string());
+    begin = end;
+  }
 
-      } else {
-        std::cout << "file does not exists" << std::endl;
-        Add::storeIndex(hash, file_path, Operation::DELETED);
-        continue;
-      }
+  for (size_t i = 0; i < tracked.size(); i++) {
+    const auto &[file_path, hash] = tracked[i];
+    const ObjectId &hashToCompare = current[i];
 
-      // if not equal, store it inside the index file.
-      if (hashToCompare != hash) {
-        Add::storeIndex(hash, file_path, Operation::CHANGED, hashToCompare);
-      }
-    } else {
-      // it's a tree object, go to the hash of the tree object and call the
-      // Function
-      Add::identify_changes_and_update_index_recursive(hash, seenPaths);
+    // if not equal, stage it in the index.
+    if (hashToCompare != hash) {
+      Add::storeIndex(index, hash, file_path.view(), Operation::CHANGED);
     }
   }
 
-  return seenPaths;
+  tracked.clear();
 }
 
-inline void
-identify_changes_and_update_index_recursive(const std::string &hash, std::unordered_set<std::string>& seenPaths) {
-  // Get inside the file_path and get the hashes.
-  fs::path objectsPath = "./.gid/objects";
-  fs::path tree_path = objectsPath / hash.substr(0, 2) / hash.substr(2);
-
-  std::ifstream treeFile(tree_path, std::ios::binary);
-  bool isFirstLine = true;
-  std::string line;
-
-  while (std::getline(treeFile, line)) {
-    if (isFirstLine) {
-      isFirstLine = false;
+// Reads the entries of a tree object, collecting the blobs that still exist
+// and recording the ones that were deleted. `directory` is the absolute path
+// the tree stands for.
+inline void collect_tracked_blobs(const ObjectId &tree_hash, std::string_view directory,
+                                  PathSet &seenPaths,
+                                  std::vector<std::pair<PathId, ObjectId>> &tracked,
+                                  Index &index) {
+  Trace::Scope scope("collect_tracked_blobs");
+  const ObjectStore::Object tree = General::readTree(tree_hash);
+
+  for (const TreeFormat::Entry &entry : ObjectStore::TreeView(tree)) {
+    const PathId file_path = General::internChildPath(directory, entry.name);
+    const ObjectId &hash = entry.id;
+
+    // Ignored since it was committed, it leaves the next commit.
+    if (Ignore::ignored(file_path.view(), entry.isTree())) {
+      std::map<std::string, ObjectId> blobs;
+      if (entry.isTree()) General::collectTreeBlobs(hash, std::string(file_path.view()), blobs);
+      else blobs.emplace(file_path.view(), hash);
+
+      for (const auto &[blob_path, blob_hash] : blobs) {
+        Add::storeIndex(index, blob_hash, blob_path, Operation::DELETED);
+      }
       continue;
     }
 
-    auto [file_path, hash, type] = General::parseLine(line, ' ');
-
-    // If it's a file, simply calc another hash and compare with the previous
-    if (type == "blob") {
-      std::string hashToCompare;
-
-      if (fs::exists(file_path)) {
-        hashToCompare = serializeObject<Blob>(createBlob(file_path));
-        seenPaths.insert(file_path.string());
+    // If it's a file, queue it to be rehashed and compared with the previous
+    if (!entry.isTree()) {
+      if (::access(file_path.c_str(), F_OK) == 0) {
+        seenPaths.insert(file_path);
+        tracked.emplace_back(file_path, hash);
 
       } else {
         std::cout << "file does not exists" << std::endl;
-        Add::storeIndex(hash, file_path, Operation::DELETED);
-        continue;
-      }
-
-      // if not equal, store it inside the index file.
-      if (hashToCompare != hash) {
-        Add::storeIndex(hash, file_path, Operation::CHANGED , hashToCompare);
+        Add::storeIndex(index, hash, file_path.view(), Operation::DELETED);
       }
     } else {
-
-      Add::identify_changes_and_update_index_recursive(hash, seenPaths);
+      // it's a tree object, go to the hash of the tree object and collect
+      // its entries as well.
+      collect_tracked_blobs(hash, file_path.view(), seenPaths, tracked, index);
     }
   }
 }
-} // namespace Add
-
-inline void retrieveBlobObject(const fs::path& blobPath) { 
-  std::ifstream blobFile(blobPath);
-  if (!blobFile.is_open()) {
-      std::cerr << "Failed to open blob file." << std::endl;
-      return;
-  }
-
-  fs::path outputDir = "../repo", outputPath;
 
-  if (!fs::exists(outputDir)) {
-    fs::create_directories(outputDir);
-  }
-
-  std::string line, path, content;
-  bool isFirstLine = true;
-
-  while (std::getline(blobFile, line)) {
-    if (isFirstLine) {
-      std::istringstream iss(line);
-      iss >> line >> path; 
-
-      outputPath = outputPath = outputDir / fs::relative(path, fs::current_path());
-      
-      isFirstLine = false;
-      continue;
-    }
-    content += line + "\n";
-  }
-
-  fs::create_directories(outputPath.parent_path());
+inline PathSet identify_changes_and_update_index(Index &index) {
+  PathSet seenPaths;
+  std::vector<std::pair<PathId, ObjectId>> tracked;
 
-  std::ofstream outputFile(outputPath);
-  if (!outputFile.is_open()) {
-    std::cout << outputPath << "\n";
-    std::cerr << "Failed to create output file." << std::endl;
-    return;
-  }
+  collect_tracked_blobs(General::getMasterTreeHash(), fs::current_path().native(), seenPaths, tracked, index);
+  compare_tracked_blobs(tracked, index);
 
-  outputFile << content;
-
-  // std::cout << "Blob contents written to: " << outputPath << std::endl;
+  return seenPaths;
 }
-
-inline void createRetrievedFile(const fs::path& treePath) {
-  std::ifstream treeFile(treePath);
-  if (!treeFile.is_open()) {
-    std::cerr << "Failed to open tree file." << std::endl;
-    return;
-  }
-
-  std::string path, hash, type, line; 
-  fs::path objectsPath = "./.gid/objects";
-  bool isFirstLine = true;
-  
-  while (std::getline(treeFile, line)) {
-    if (isFirstLine) {
-      isFirstLine = false;
-      continue;
+/**
+ * Stages the changes below the paths the monitor saw change, instead of
+ * walking the whole worktree. A path may be a file or a directory, and may
+ * not exist anymore.
+ *
+ * @param index The index.
+ * @param paths Absolute paths that changed since the last add.
+ */
+inline void identify_monitored_changes(Index &index, const std::vector<std::string> &paths) {
+  Trace::Scope scope("identify_monitored_changes");
+  General::TreeLookup lookup(General::getMasterTreeHash(), fs::current_path().string());
+  const std::string root = fs::current_path().string() + "/";
+  std::vector<std::pair<PathId, ObjectId>> tracked;
+  PathSet seenPaths;
+
+  auto checkFile = [&](std::string_view path) {
+    const PathId file_path = Paths::intern(path);
+    if (!seenPaths.insert(file_path).second) return;
+
+    ObjectId hash;
+    TreeFormat::Type type;
+    if (lookup.find(path, hash, type) && type == TreeFormat::Type::Blob) tracked.emplace_back(file_path, hash);
+    else Add::storeIndex(index, ObjectId(), path, Operation::CREATED);
+  };
+
+  for (const std::string &path : paths) {
+    std::error_code ec;
+    const fs::file_status status = fs::status(path, ec);
+    if (path.compare(0, root.size(), root) != 0 || Ignore::ignored(std::string_view(path), fs::is_directory(status), true)) continue;
+
+    // Whatever the last commit had there and is gone now was deleted.
+    ObjectId hash;
+    TreeFormat::Type type;
+    if (lookup.find(path, hash, type)) {
+      std::map<std::string, ObjectId> blobs;
+      if (type == TreeFormat::Type::Blob) blobs[path] = hash;
+      else General::collectTreeBlobs(hash, path, blobs);
+
+      for (const auto &[blob_path, blob_hash] : blobs) {
+        if (!fs::is_regular_file(blob_path)) Add::storeIndex(index, blob_hash, blob_path, Operation::DELETED);
+      }
     }
 
-    std::istringstream iss(line);
-    iss >> path >> hash >> type;
-
-    if (type == "blob") {
-      fs::path blobPath = objectsPath / hash.substr(0, 2) / hash.substr(2);
-      retrieveBlobObject(blobPath); 
+    if (fs::is_regular_file(status)) {
+      checkFile(path);
+    } else if (fs::is_directory(status)) {
+      for (auto it = fs::recursive_directory_iterator(path, ec); !ec && it != fs::recursive_directory_iterator();
+           it.increment(ec)) {
+        if (Ignore::ignored(it->path(), it->is_directory())) {
+          it.disable_recursion_pending();
+          continue;
+        }
+        if (it->is_regular_file()) checkFile(it->path().native());
+      }
+    }
+  }
 
-    } else {
-      fs::path subTreePath = objectsPath / hash.substr(0, 2) / hash.substr(2); 
-      createRetrievedFile(subTreePath);
-    } 
-  } 
+  compare_tracked_blobs(tracked, index);
 }
+} // namespace Add
 
 #endif
@@ -0,0 +1,262 @@
+#ifndef IGNORE_HPP
+#define IGNORE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * .gidignore, the paths that are never committed. Its lines are gitignore
+ * patterns:
+ *
+ *   # comment
+ *   build/          a directory named build anywhere, and all below it
+ *   *.o             a name anywhere
+ *   /TODO           only at the top of the repository
+ *   src/gen_*.cc    a slash anchors the pattern to the top
+ *   !keep.o         negation: the last pattern that matches wins
+ *
+ * '*' and '?' do not match '/', "**" matches any number of directories.
+ * The patterns are sorted into tables once: whole names, whole paths,
+ * "*<suffix>" and "<prefix>*" are hash lookups, only the other globs are
+ * matched one by one. Walks test a directory before going into it, so the
+ * content of an ignored directory is never read nor stat'd, and like in git
+ * a file can not be brought back with ! if its directory is ignored.
+ *
+ * .gid and .git are always ignored.
+ */
+
+namespace Ignore {
+
+const std::filesystem::path FILE_NAME = ".gidignore";
+
+/**
+ * Matches a glob against text. '*' and '?' stop at '/', "**" does not, and
+ * "[a-z]", "[!0-9]" are sets of characters.
+ */
+inline bool glob(std::string_view pattern, std::string_view text) {
+  size_t p = 0, t = 0;
+
+  while (p < pattern.size()) {
+    const char c = pattern[p];
+
+    if (c == '*') {
+      if (p + 1 < pattern.size() && pattern[p + 1] == '*') {
+        // "**/" also matches no directory at all.
+        const bool slash = p + 2 < pattern.size() && pattern[p + 2] == '/';
+        const std::string_view rest = pattern.substr(p + (slash ? 3 : 2));
+
+        for (size_t i = t; i <= text.size(); i++) {
+          if ((!slash || i == t || text[i - 1] == '/') && glob(rest, text.substr(i))) return true;
+        }
+        return false;
+      }
+
+      const std::string_view rest = pattern.substr(p + 1);
+      for (size_t i = t; i <= text.size(); i++) {
+        if (glob(rest, text.substr(i))) return true;
+        if (i < text.size() && text[i] == '/') break;
+      }
+      return false;
+    }
+
+    if (t >= text.size()) return false;
+
+    if (c == '?') {
+      if (text[t] == '/') return false;
+    } else if (c == '[' && pattern.find(']', p + 2) != std::string_view::npos) {
+      const size_t end = pattern.find(']', p + 2);
+      const bool negated = pattern[p + 1] == '!' || pattern[p + 1] == '^';
+      bool matched = false;
+
+      for (size_t i = p + (negated ? 2 : 1); i < end; i++) {
+        if (i + 2 < end && pattern[i + 1] == '-') {
+          matched |= pattern[i] <= text[t] && text[t] <= pattern[i + 2];
+          i += 2;
+        } else {
+          matched |= pattern[i] == text[t];
+        }
+      }
+      if (matched == negated || text[t] == '/') return false;
+      p = end;
+    } else {
+      const char literal = c == '\\' && p + 1 < pattern.size() ? pattern[++p] : c;
+      if (literal != text[t]) return false;
+    }
+
+    p++;
+    t++;
+  }
+
+  return t == text.size();
+}
+
+class Matcher {
+public:
+  Matcher() = default;
+
+  // Reads the rules of a .gidignore file, none if there is no such file.
+  static Matcher load(const std::filesystem::path &path) {
+    Matcher matcher;
+    std::ifstream file(path);
+    std::string line;
+
+    while (std::getline(file, line)) matcher.add(line);
+    return matcher;
+  }
+
+  // Adds one line of a .gidignore file.
+  void add(std::string line) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    while (!line.empty() && line.back() == ' ' && !(line.size() > 1 && line[line.size() - 2] == '\\')) line.pop_back();
+    if (line.empty() || line[0] == '#') return;
+
+    Rule rule;
+    rule.negated = line[0] == '!';
+    if (rule.negated) line.erase(0, 1);
+    else if (line[0] == '\\' && line.size() > 1 && (line[1] == '!' || line[1] == '#')) line.erase(0, 1);
+
+    rule.directoryOnly = !line.empty() && line.back() == '/';
+    if (rule.directoryOnly) line.pop_back();
+
+    // A slash anywhere but at the end anchors the pattern to the top.
+    const bool anchored = line.find('/') != std::string::npos;
+    if (!line.empty() && line[0] == '/') line.erase(0, 1);
+    if (line.empty()) return;
+
+    rule.priority = m_negated.size();
+    m_negated.push_back(rule.negated);
+
+    auto literal = [](std::string_view text) { return text.find_first_of("*?[\\") == std::string_view::npos; };
+
+    if (literal(line)) {
+      (anchored ? m_paths : m_names)[line].push_back(rule);
+    } else if (!anchored && line[0] == '*' && literal(std::string_view(line).substr(1))) {
+      m_suffixes[line.substr(1)].push_back(rule);
+      m_suffixLengths.insert(line.size() - 1);
+    } else if (!anchored && line.back() == '*' && literal(std::string_view(line).substr(0, line.size() - 1))) {
+      m_prefixes[line.substr(0, line.size() - 1)].push_back(rule);
+      m_prefixLengths.insert(line.size() - 1);
+    } else {
+      rule.pattern = line;
+      rule.anchored = anchored;
+      m_globs.push_back(rule);
+    }
+  }
+
+  /**
+   * Whether a path is ignored by its own name, its parents are not looked
+   * at: walks never get below an ignored directory.
+   *
+   * @param path Relative to the top of the repository, with '/' separators.
+   * @param isDirectory Whether the path is a directory.
+   */
+  bool ignored(std::string_view path, bool isDirectory) const {
+    const size_t slash = path.rfind('/');
+    const std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    if (name == ".gid" || name == ".git") return true;
+    if (m_negated.empty()) return false;
+
+    // The last rule that matches wins.
+    ptrdiff_t best = -1;
+    auto consider = [&](const auto &table, std::string_view key) {
+      auto it = table.find(key);
+      if (it == table.end()) return;
+      for (const Rule &rule : it->second) {
+        if (!rule.directoryOnly || isDirectory) best = std::max(best, static_cast<ptrdiff_t>(rule.priority));
+      }
+    };
+
+    consider(m_names, name);
+    consider(m_paths, path);
+    for (size_t length : m_suffixLengths) {
+      if (length <= name.size()) consider(m_suffixes, name.substr(name.size() - length));
+    }
+    for (size_t length : m_prefixLengths) {
+      if (length <= name.size()) consider(m_prefixes, name.substr(0, length));
+    }
+
+    for (auto it = m_globs.rbegin(); it != m_globs.rend() && static_cast<ptrdiff_t>(it->priority) > best; ++it) {
+      if ((!it->directoryOnly || isDirectory) && glob(it->pattern, it->anchored ? path : name)) {
+        best = static_cast<ptrdiff_t>(it->priority);
+        break;
+      }
+    }
+
+    return best >= 0 && !m_negated[static_cast<size_t>(best)];
+  }
+
+  // Like ignored(), for a path whose parents were not walked.
+  bool ignoredWithParents(std::string_view path, bool isDirectory) const {
+    for (size_t slash = path.find('/'); slash != std::string_view::npos; slash = path.find('/', slash + 1)) {
+      if (ignored(path.substr(0, slash), true)) return true;
+    }
+    return ignored(path, isDirectory);
+  }
+
+private:
+  struct Rule {
+    std::string pattern; // Only for globs
+    size_t priority = 0; // Line order
+    bool negated = false;
+    bool directoryOnly = false;
+    bool anchored = false;
+  };
+
+  // Looked up with string_views of the path, without copying them.
+  struct Hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view text) const { return std::hash<std::string_view>()(text); }
+  };
+  using Table = std::unordered_map<std::string, std::vector<Rule>, Hash, std::equal_to<>>;
+
+  Table m_names, m_paths, m_suffixes, m_prefixes;
+  std::set<size_t> m_suffixLengths, m_prefixLengths;
+  std::vector<Rule> m_globs;
+  std::vector<bool> m_negated; // By priority
+};
+
+// The rules of the repository in the current directory, read once.
+inline Matcher &matcher() {
+  static Matcher rules = Matcher::load(FILE_NAME);
+  return rules;
+}
+
+// Reads .gidignore again, for the monitor which outlives its changes.
+inline void reload() { matcher() = Matcher::load(FILE_NAME); }
+
+/**
+ * Whether a path of the worktree is ignored.
+ *
+ * @param path Absolute, or relative to the top of the repository.
+ * @param isDirectory Whether the path is a directory.
+ * @param withParents Whether its parents are tested too, for paths that
+ *                    do not come from a walk.
+ */
+inline bool ignored(std::string_view path, bool isDirectory, bool withParents = false) {
+  static const std::string root = std::filesystem::current_path().string() + "/";
+  std::string_view relative = path;
+
+  if (!path.empty() && path[0] == '/') {
+    if (relative.compare(0, root.size(), root) != 0) return false;
+    relative.remove_prefix(root.size());
+  }
+
+  return withParents ? matcher().ignoredWithParents(relative, isDirectory) : matcher().ignored(relative, isDirectory);
+}
+
+inline bool ignored(const std::filesystem::path &path, bool isDirectory, bool withParents = false) {
+  return ignored(std::string_view(path.native()), isDirectory, withParents);
+}
+
+} // namespace Ignore
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef INDEX_HPP
+#define INDEX_HPP
+
+#include "SHA256.hpp"
+#include "flatmap.hpp"
+#include "mappedfile.hpp"
+#include "objectid.hpp"
+#include "pathtable.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+enum Operation {
+  DELETED,
+  CREATED,
+  CHANGED,
+  UNCHANGED, // Tracked, nothing staged for it.
+};
+
+/**
+ * The stat data of a file at the time it was hashed.
+ */
+struct StatData {
+  uint64_t size = 0;
+  int64_t mtime = 0; // Nanoseconds
+  int64_t ctime = 0; // Nanoseconds
+  uint64_t inode = 0;
+  uint64_t device = 0;
+
+  bool operator==(const StatData &other) const = default;
+
+  /**
+   * Reads the stat data of a file.
+   *
+   * @param path The file to stat.
+   * @param out Filled with the stat data.
+   * @return false if the file can not be stat'd.
+   */
+  static bool read(const char *path, StatData &out) {
+    struct stat st;
+    if (::lstat(path, &st) != 0) return false;
+
+    out.size = static_cast<uint64_t>(st.st_size);
+    out.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    out.ctime = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+    out.inode = static_cast<uint64_t>(st.st_ino);
+    out.device = static_cast<uint64_t>(st.st_dev);
+    return true;
+  }
+
+  static bool read(const std::filesystem::path &path, StatData &out) { return read(path.c_str(), out); }
+  static bool read(PathId path, StatData &out) { return read(path.c_str(), out); }
+};
+
+/**
+ * An entry of the index: a tracked path, the hash and stat data it had when
+ * it was last hashed, and the change staged for it if there is one.
+ */
+struct IndexEntry {
+  PathId path; // Interned, see PathTable
+  Operation op = Operation::UNCHANGED;
+  ObjectId hash;     // Hash of the content when `stat` was taken, null if unknown
+  ObjectId baseHash; // Hash in the last commit, for staged changes
+  StatData stat;
+  bool removed = false;
+};
+
+/**
+ * The index (.gid/index), loaded once per command and written back once.
+ *
+ * Binary layout, all integers in host byte order:
+ *   header   "GIDX", u32 version, u64 entry count
+ *   entries  sorted by path, each a fixed 112 byte record (op, flags, path
+ *            length, stat data, raw hash, raw base hash) followed by the path
+ *   trailer  SHA256 of everything before it
+ *
+ * Version 2 had the hashes of the unchanged directories after the entries.
+ * A commit takes them from the tree of the last commit instead, see
+ * createStagedTree(), they are not read anymore.
+ *
+ * Racy timestamps: a file changed in the same timestamp tick the index was
+ * written in can keep identical stat data. Entries whose mtime is not strictly
+ * older than the index file itself are therefore never trusted and rehashed,
+ * and when the index is written such entries are smudged (their mtime is
+ * dropped) so a later rewrite can not make them look clean.
+ *
+ * Paths are interned when the index is loaded or an entry is added, and
+ * entries are found through a flat hash map of their ids. Lookups take an
+ * id, or any string_view which copies nothing.
+ */
+class Index {
+public:
+  static constexpr uint32_t VERSION = 3;
+
+  explicit Index(const std::filesystem::path &path = ".gid/index") : m_path(path) { load(); }
+
+  IndexEntry *find(PathId path) {
+    auto it = m_positions.find(path);
+    if (it == m_positions.end() || m_entries[it->second].removed) return nullptr;
+    return &m_entries[it->second];
+  }
+
+  // A path that was never interned is not in the index.
+  IndexEntry *find(std::string_view path) {
+    const PathId id = Paths::find(path);
+    return id ? find(id) : nullptr;
+  }
+
+  /**
+   * Looks up the cached hash of a file.
+   *
+   * @param path The file.
+   * @param stat The current stat data of the file.
+   * @return The cached hash, or nullptr if the file has to be rehashed.
+   */
+  template <typename Path> const ObjectId *lookup(const Path &path, const StatData &stat) {
+    const IndexEntry *entry = find(path);
+    if (!entry || entry->hash.isNull() || !(entry->stat == stat)) return nullptr;
+    if (stat.mtime >= m_indexTime) return nullptr; // Racily clean
+
+    return &entry->hash;
+  }
+
+  // Records the hash a file had with the given stat data.
+  template <typename Path> void update(const Path &path, const ObjectId &hash, const StatData &stat) {
+    IndexEntry &entry = insert(path);
+    if (entry.hash != hash || !(entry.stat == stat)) {
+      entry.hash = hash;
+      entry.stat = stat;
+      m_dirty = true;
+    }
+  }
+
+  /**
+   * Stages a change for a path, unless one is staged for it already.
+   *
+   * @return true if the change was recorded.
+   */
+  bool stage(std::string_view path, Operation op, const ObjectId &baseHash) {
+    IndexEntry &entry = insert(path);
+    if (entry.op != Operation::UNCHANGED) return false;
+
+    entry.op = op;
+    entry.baseHash = baseHash;
+    m_dirty = true;
+    return true;
+  }
+
+  void erase(std::string_view path) {
+    if (IndexEntry *entry = find(path)) {
+      entry->removed = true;
+      m_dirty = true;
+    }
+  }
+
+  bool hasChanges() const {
+    return std::any_of(m_entries.begin(), m_entries.end(), [](const IndexEntry &entry) {
+      return !entry.removed && entry.op != Operation::UNCHANGED;
+    });
+  }
+
+  // The staged changes, sorted by path.
+  std::vector<const IndexEntry *> changes() {
+    normalize();
+    std::vector<const IndexEntry *> result;
+    for (const IndexEntry &entry : m_entries) {
+      if (!entry.removed && entry.op != Operation::UNCHANGED) result.push_back(&entry);
+    }
+    return result;
+  }
+
+  // Called once the changes are committed: deleted paths are dropped, the rest
+  // become plain tracked entries.
+  void clearChanges() {
+    for (IndexEntry &entry : m_entries) {
+      if (entry.op == Operation::DELETED) entry.removed = true;
+      entry.op = Operation::UNCHANGED;
+      entry.baseHash = ObjectId();
+    }
+    m_dirty = true;
+  }
+
+  /**
+   * Writes the index back if it changed, to a temporary file that is renamed
+   * over the old one only once it is completely written.
+   */
+  void save() {
+    Trace::Scope scope("Index::save");
+    if (!m_dirty) return;
+    normalize();
+
+    const std::filesystem::path tmpPath = m_path.string() + ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (file.fail()) {
+      std::cerr << "Error writing the index: " << m_path << std::endl;
+      return;
+    }
+
+    StatData indexStat;
+    StatData::read(tmpPath, indexStat);
+
+    std::string buffer;
+    Header header{{'G', 'I', 'D', 'X'}, VERSION, m_entries.size()};
+    append(buffer, &header, sizeof(header));
+
+    for (const IndexEntry &entry : m_entries) {
+      DiskEntry disk{};
+      disk.op = static_cast<uint8_t>(entry.op);
+      disk.pathLength = static_cast<uint16_t>(entry.path.view().size());
+      disk.size = entry.stat.size;
+      disk.mtime = entry.stat.mtime >= indexStat.mtime ? 0 : entry.stat.mtime;
+      disk.ctime = entry.stat.ctime;
+      disk.inode = entry.stat.inode;
+      disk.device = entry.stat.device;
+      std::memcpy(disk.hash, entry.hash.data(), sizeof(disk.hash));
+      std::memcpy(disk.baseHash, entry.baseHash.data(), sizeof(disk.baseHash));
+      if (!entry.hash.isNull()) disk.flags |= HAS_HASH;
+      if (!entry.baseHash.isNull()) disk.flags |= HAS_BASE_HASH;
+
+      append(buffer, &disk, sizeof(disk));
+      buffer += entry.path.view();
+    }
+
+    SHA256 sha;
+    sha.update(buffer);
+    uint8_t *digest = sha.digest();
+    append(buffer, digest, 32);
+    delete[] digest;
+
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    file.flush();
+    file.close();
+
+    // A short write must not replace the index, the staged changes are kept.
+    std::error_code ec;
+    if (file.fail()) {
+      std::cerr << "Error writing the index: " << tmpPath << ". The index is kept as it was." << std::endl;
+      std::filesystem::remove(tmpPath, ec);
+      return;
+    }
+
+    std::filesystem::rename(tmpPath, m_path, ec);
+    if (ec) {
+      std::cerr << "Error replacing the index: " << m_path << ": " << ec.message() << std::endl;
+      std::filesystem::remove(tmpPath, ec);
+      return;
+    }
+    m_dirty = false;
+  }
+
+private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+  };
+
+  struct DiskEntry {
+    uint8_t op;
+    uint8_t flags;
+    uint16_t pathLength;
+    uint32_t reserved;
+    uint64_t size;
+    int64_t mtime;
+    int64_t ctime;
+    uint64_t inode;
+    uint64_t device;
+    uint8_t hash[32];
+    uint8_t baseHash[32];
+  };
+  static_assert(sizeof(Header) == 16 && sizeof(DiskEntry) == 112);
+
+  static constexpr uint8_t HAS_HASH = 1;
+  static constexpr uint8_t HAS_BASE_HASH = 2;
+
+  static void append(std::string &buffer, const void *data, size_t size) {
+    buffer.append(static_cast<const char *>(data), size);
+  }
+
+  IndexEntry &insert(std::string_view path) { return insert(Paths::intern(path)); }
+
+  IndexEntry &insert(PathId path) {
+    const auto [it, added] = m_positions.try_emplace(path, m_entries.size());
+    if (added) {
+      m_entries.emplace_back().path = path;
+      m_sorted = false;
+      m_dirty = true;
+    } else if (m_entries[it->second].removed) { // Erased earlier, bring it back empty.
+      m_entries[it->second] = IndexEntry();
+      m_entries[it->second].path = path;
+    }
+    return m_entries[it->second];
+  }
+
+  // Drops erased entries and sorts the others by path.
+  void normalize() {
+    const size_t count = m_entries.size();
+    std::erase_if(m_entries, [](const IndexEntry &entry) { return entry.removed; });
+    if (m_sorted && m_entries.size() == count) return;
+
+    std::sort(m_entries.begin(), m_entries.end(),
+              [](const IndexEntry &a, const IndexEntry &b) { return a.path.view() < b.path.view(); });
+    m_positions.clear();
+    for (size_t i = 0; i < m_entries.size(); i++) m_positions.try_emplace(m_entries[i].path, i);
+    m_sorted = true;
+  }
+
+  void load() {
+    Trace::Scope scope("Index::load");
+    MappedFile file(m_path);
+    if (!file.is_open() || file.size() == 0) return;
+
+    StatData indexStat;
+    StatData::read(m_path, indexStat);
+    m_indexTime = indexStat.mtime;
+
+    const std::string_view data = file.view();
+    Header header;
+
+    if (data.size() < sizeof(header) + 32) return corrupted();
+    std::memcpy(&header, data.data(), sizeof(header));
+    // Versions 1 and 2 only differ after the entries.
+    if (std::memcmp(header.magic, "GIDX", 4) != 0 || header.version < 1 || header.version > VERSION) {
+      return corrupted();
+    }
+
+    SHA256 sha;
+    sha.update(reinterpret_cast<const uint8_t *>(data.data()), data.size() - 32);
+    uint8_t *digest = sha.digest();
+    const bool valid = std::memcmp(digest, data.data() + data.size() - 32, 32) == 0;
+    delete[] digest;
+    if (!valid) return corrupted();
+
+    size_t offset = sizeof(header);
+    m_entries.reserve(header.count);
+    m_positions.reserve(header.count);
+
+    for (uint64_t i = 0; i < header.count; i++) {
+      DiskEntry disk;
+      if (offset + sizeof(disk) > data.size() - 32) return corrupted();
+      std::memcpy(&disk, data.data() + offset, sizeof(disk));
+      offset += sizeof(disk);
+
+      if (offset + disk.pathLength > data.size() - 32) return corrupted();
+
+      IndexEntry entry;
+      entry.path = Paths::intern(std::string_view(data.data() + offset, disk.pathLength));
+      entry.op = static_cast<Operation>(disk.op);
+      entry.stat = {disk.size, disk.mtime, disk.ctime, disk.inode, disk.device};
+      if (disk.flags & HAS_HASH) entry.hash = ObjectId::fromDigest(disk.hash);
+      if (disk.flags & HAS_BASE_HASH) entry.baseHash = ObjectId::fromDigest(disk.baseHash);
+
+      offset += disk.pathLength;
+      m_positions.try_emplace(entry.path, m_entries.size());
+      m_entries.push_back(std::move(entry));
+    }
+  }
+
+  void corrupted() {
+    std::cerr << "The index file is corrupted or in an old format, starting with an empty index."
+              << std::endl;
+    m_entries.clear();
+    m_positions.clear();
+    m_sorted = true;
+    m_dirty = true;
+  }
+
+  std::filesystem::path m_path;
+  std::vector<IndexEntry> m_entries;                    // Sorted by path when m_sorted
+  FlatMap<PathId, size_t, PathId::Hash> m_positions; // Path -> position in m_entries
+  bool m_sorted = true;
+  int64_t m_indexTime = 0;
+  bool m_dirty = false;
+};
+
+#endif
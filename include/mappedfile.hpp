@@ -0,0 +1,100 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Read-only view of a file on disk.
+ *
+ * Files up to `maxMapped` bytes are memory mapped and exposed through `view()`.
+ * Bigger files stay unmapped (`mapped()` is false) so callers can stream them
+ * through a fixed size buffer instead, keeping the memory use flat.
+ */
+class MappedFile {
+public:
+  static constexpr size_t MAX_MAPPED = 64 << 20;
+
+  // Nothing open.
+  MappedFile() = default;
+
+  explicit MappedFile(const std::filesystem::path &path, size_t maxMapped = MAX_MAPPED)
+      : MappedFile(path.c_str(), maxMapped) {}
+
+  explicit MappedFile(const char *path, size_t maxMapped = MAX_MAPPED) {
+    m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) return;
+
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0) {
+      ::close(m_fd);
+      m_fd = -1;
+      return;
+    }
+    m_size = static_cast<size_t>(st.st_size);
+
+    if (m_size <= maxMapped) map();
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept
+      : m_fd(std::exchange(other.m_fd, -1)), m_data(std::exchange(other.m_data, nullptr)),
+        m_size(std::exchange(other.m_size, 0)) {}
+
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      release();
+      m_fd = std::exchange(other.m_fd, -1);
+      m_data = std::exchange(other.m_data, nullptr);
+      m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+  }
+
+  ~MappedFile() { release(); }
+
+  bool is_open() const { return m_fd >= 0; }
+
+  // Empty files count as mapped, there is nothing to stream.
+  bool mapped() const { return is_open() && (m_data != nullptr || m_size == 0); }
+
+  size_t size() const { return m_size; }
+  int fd() const { return m_fd; }
+
+  std::string_view view() const { return m_data ? std::string_view(m_data, m_size) : std::string_view(); }
+
+  // Maps a file that was opened without being mapped, whatever its size.
+  bool map() {
+    if (m_data || m_size == 0 || m_fd < 0) return mapped();
+
+    void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (data != MAP_FAILED) {
+      ::madvise(data, m_size, MADV_SEQUENTIAL);
+      m_data = static_cast<const char *>(data);
+    }
+    return mapped();
+  }
+
+private:
+  void release() {
+    if (m_data) ::munmap(const_cast<char *>(m_data), m_size);
+    if (m_fd >= 0) ::close(m_fd);
+    m_data = nullptr;
+    m_fd = -1;
+  }
+
+  int m_fd = -1;
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+};
+
+#endif
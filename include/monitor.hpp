@@ -0,0 +1,438 @@
+#ifndef MONITOR_HPP
+#define MONITOR_HPP
+
+#include "ignore.hpp"
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * `gid monitor` watches the worktree with inotify and keeps the set of paths
+ * that changed, so `add` can look at those instead of walking the whole tree.
+ * It serves the set over a Unix socket, .gid/monitor.sock, one request per
+ * connection:
+ *   "dirty\n"          -> "ok <token>\n" then one changed path per line, or
+ *                         "overflow <token>\n" when the set can not be trusted
+ *   "clear <token>\n"  -> "ok\n", forgets the changes up to the token
+ *   "stop\n"           -> "ok\n", the monitor exits
+ *
+ * Every change gets the next sequence number and the token is the last one
+ * handed out, so changes made while `add` runs are kept for the next one.
+ * The set can not be trusted right after the monitor starts (changes made
+ * before are unknown) or after the inotify queue overflowed, until `add`
+ * clears a token taken after that with a full scan.
+ */
+
+namespace Monitor {
+
+namespace fs = std::filesystem;
+
+const fs::path SOCKET_PATH = ".gid/monitor.sock";
+
+// What the monitor reported.
+struct Changes {
+  uint64_t token = 0;
+  bool overflowed = true;
+  std::vector<std::string> paths;
+};
+
+inline bool socketAddress(sockaddr_un &address) {
+  address = {};
+  address.sun_family = AF_UNIX;
+  const std::string path = SOCKET_PATH.string();
+  if (path.size() >= sizeof(address.sun_path)) return false;
+
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+inline bool writeAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+    const ssize_t written = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (written <= 0) return false;
+    data.remove_prefix(static_cast<size_t>(written));
+  }
+  return true;
+}
+
+/**
+ * Sends one request to the monitor.
+ *
+ * @param command The request line, with its newline.
+ * @param reply The whole reply.
+ * @return false if no monitor is running.
+ */
+inline bool request(const std::string &command, std::string &reply) {
+  sockaddr_un address;
+  if (!socketAddress(address)) return false;
+
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+
+  if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || !writeAll(fd, command)) {
+    ::close(fd);
+    return false;
+  }
+  ::shutdown(fd, SHUT_WR);
+
+  char buffer[64 << 10];
+  ssize_t count;
+  reply.clear();
+  while ((count = ::recv(fd, buffer, sizeof(buffer), 0)) > 0) reply.append(buffer, static_cast<size_t>(count));
+
+  ::close(fd);
+  return count == 0 && !reply.empty();
+}
+
+/**
+ * Asks the monitor what changed.
+ *
+ * @param changes Filled with the reply.
+ * @return false if no monitor is running.
+ */
+inline bool query(Changes &changes) {
+  std::string reply;
+  if (!request("dirty\n", reply)) return false;
+
+  std::istringstream lines(reply);
+  std::string status, line;
+  if (!(lines >> status >> changes.token) || (status != "ok" && status != "overflow")) return false;
+  std::getline(lines, line);
+
+  changes.overflowed = status == "overflow";
+  changes.paths.clear();
+  while (std::getline(lines, line)) {
+    if (!line.empty()) changes.paths.push_back(line);
+  }
+  return true;
+}
+
+// Tells the monitor the changes up to the token were taken care of.
+inline void clear(uint64_t token) {
+  std::string reply;
+  request("clear " + std::to_string(token) + "\n", reply);
+}
+
+/**
+ * The monitor itself: one thread polling the inotify descriptor and the
+ * socket. inotify events are read before every request is answered, so a
+ * change made before `add` asks is always in the reply.
+ */
+class Daemon {
+public:
+  explicit Daemon(const fs::path &root) : m_root(root) {}
+
+  Daemon(const Daemon &) = delete;
+  Daemon &operator=(const Daemon &) = delete;
+
+  ~Daemon() {
+    if (m_inotify >= 0) ::close(m_inotify);
+    if (m_listen >= 0) {
+      ::close(m_listen);
+      ::unlink(SOCKET_PATH.c_str());
+    }
+  }
+
+  /**
+   * Sets up the watches and the socket.
+   *
+   * @return false if a monitor is running already or something failed.
+   */
+  bool start() {
+    std::string reply;
+    if (request("dirty\n", reply)) {
+      std::cerr << "A monitor is running already." << std::endl;
+      return false;
+    }
+
+    m_inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify < 0) {
+      std::cerr << "inotify is not available: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    watchTree(m_root, false);
+
+    sockaddr_un address;
+    m_listen = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::unlink(SOCKET_PATH.c_str()); // Left behind by a monitor that died.
+
+    if (m_listen < 0 || !socketAddress(address) ||
+        ::bind(m_listen, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(m_listen, 16) != 0) {
+      std::cerr << "Could not listen on " << SOCKET_PATH << ": " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Serves requests until asked to stop.
+  void run() {
+    while (!m_stop) {
+      pollfd fds[2] = {{m_inotify, POLLIN, 0}, {m_listen, POLLIN, 0}};
+      if (::poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) continue;
+        return;
+      }
+
+      if (fds[0].revents & POLLIN) drain();
+      if (fds[1].revents & POLLIN) {
+        const int client = ::accept4(m_listen, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client >= 0) {
+          drain();
+          serve(client);
+          ::close(client);
+        }
+      }
+    }
+  }
+
+private:
+  void markDirty(const fs::path &path, bool isDirectory) {
+    if (!Ignore::ignored(path, isDirectory)) m_dirty[path.string()] = ++m_sequence;
+  }
+
+  void overflow() { m_overflow = ++m_sequence; }
+
+  /**
+   * Watches a directory and everything below it.
+   *
+   * @param directory The directory.
+   * @param markFiles Whether the files found are marked as changed, for
+   *                  directories that appeared after the monitor started.
+   */
+  void watchTree(const fs::path &directory, bool markFiles) {
+    constexpr uint32_t EVENTS = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+    auto watch = [this](const fs::path &path) {
+      const int wd = ::inotify_add_watch(m_inotify, path.c_str(), EVENTS);
+      if (wd >= 0) {
+        m_watches[wd] = path;
+      } else if (errno == ENOSPC) {
+        // Out of watches, the set can never be trusted.
+        std::cerr << "Out of inotify watches, see /proc/sys/fs/inotify/max_user_watches." << std::endl;
+        m_exhausted = true;
+      }
+    };
+
+    if (Ignore::ignored(directory, true)) return;
+    watch(directory);
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(directory, fs::directory_options::skip_permission_denied, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+      const fs::path &path = it->path();
+      const bool isDirectory = it->is_directory();
+      if (Ignore::ignored(path, isDirectory)) {
+        if (isDirectory) it.disable_recursion_pending();
+        continue;
+      }
+
+      if (isDirectory && !it->is_symlink()) watch(path);
+      else if (markFiles) markDirty(path, false);
+    }
+  }
+
+  // Forgets the watches of a directory that went away, and those below it.
+  void unwatchTree(const fs::path &directory) {
+    const std::string prefix = directory.string() + "/";
+
+    for (auto it = m_watches.begin(); it != m_watches.end();) {
+      if (it->second == directory || it->second.string().rfind(prefix, 0) == 0) {
+        ::inotify_rm_watch(m_inotify, it->first);
+        it = m_watches.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Reads every queued inotify event.
+  void drain() {
+    alignas(inotify_event) char buffer[64 << 10];
+
+    while (true) {
+      const ssize_t length = ::read(m_inotify, buffer, sizeof(buffer));
+      if (length <= 0) return;
+
+      for (ssize_t offset = 0; offset < length;) {
+        const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+        offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        handle(*event);
+      }
+    }
+  }
+
+  void handle(const inotify_event &event) {
+    if (event.mask & IN_Q_OVERFLOW) {
+      overflow();
+      return;
+    }
+
+    auto watched = m_watches.find(event.wd);
+    if (watched == m_watches.end()) return;
+
+    if (event.mask & IN_IGNORED) {
+      m_watches.erase(watched);
+      return;
+    }
+
+    const fs::path path = event.len > 0 ? watched->second / event.name : watched->second;
+    if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) return; // Seen as an event of the parent too.
+
+    markDirty(path, event.mask & IN_ISDIR);
+
+    // Other paths may be ignored now, the next add scans everything and
+    // directories no longer ignored get watched.
+    if (path == m_root / Ignore::FILE_NAME) {
+      Ignore::reload();
+      overflow();
+      watchTree(m_root, false);
+    }
+
+    if (event.mask & IN_ISDIR) {
+      if (event.mask & (IN_CREATE | IN_MOVED_TO)) watchTree(path, true);
+      else if (event.mask & IN_MOVED_FROM) unwatchTree(path);
+    }
+  }
+
+  void serve(int client) {
+    std::string command;
+    char buffer[256];
+    ssize_t count;
+    while (command.find('\n') == std::string::npos &&
+           (count = ::recv(client, buffer, sizeof(buffer), 0)) > 0) {
+      command.append(buffer, static_cast<size_t>(count));
+    }
+
+    std::istringstream fields(command);
+    std::string name;
+    fields >> name;
+
+    if (name == "dirty") {
+      if (m_exhausted || m_overflow != 0) {
+        writeAll(client, "overflow " + std::to_string(m_sequence) + "\n");
+        return;
+      }
+
+      std::string reply = "ok " + std::to_string(m_sequence) + "\n";
+      for (const auto &[path, sequence] : m_dirty) reply += path + "\n";
+      writeAll(client, reply);
+
+    } else if (uint64_t token; name == "clear" && fields >> token) {
+      std::erase_if(m_dirty, [token](const auto &entry) { return entry.second <= token; });
+      if (m_overflow <= token) m_overflow = 0;
+      writeAll(client, "ok\n");
+
+    } else if (name == "stop") {
+      m_stop = true;
+      writeAll(client, "ok\n");
+    }
+  }
+
+  fs::path m_root;
+  int m_inotify = -1, m_listen = -1;
+  std::unordered_map<int, fs::path> m_watches;
+  std::unordered_map<std::string, uint64_t> m_dirty; // Path -> sequence of its last change
+  uint64_t m_sequence = 1;
+  uint64_t m_overflow = 1; // Sequence of the last overflow, 0 if none; nothing is known at start
+  bool m_exhausted = false;
+  bool m_stop = false;
+};
+
+/**
+ * Starts the monitor for the repository in the current directory.
+ *
+ * @param foreground Whether to stay attached to the terminal instead of
+ *                   running in the background.
+ */
+inline void start(bool foreground) {
+  Daemon daemon(fs::current_path());
+  std::signal(SIGPIPE, SIG_IGN);
+  if (foreground) {
+    if (daemon.start()) daemon.run();
+    return;
+  }
+
+  // The child writes a byte once its socket is listening, the pipe closes
+  // without one if it fails. Until then the child keeps the terminal, so its
+  // errors still show up.
+  int ready[2];
+  if (::pipe2(ready, O_CLOEXEC) != 0) {
+    std::cerr << "Could not start the monitor: " << std::strerror(errno) << std::endl;
+    return;
+  }
+
+  const pid_t pid = ::fork();
+  if (pid < 0) {
+    std::cerr << "Could not start the monitor: " << std::strerror(errno) << std::endl;
+    ::close(ready[0]);
+    ::close(ready[1]);
+    return;
+  }
+
+  if (pid > 0) {
+    ::close(ready[1]);
+    char byte;
+    ssize_t n;
+    while ((n = ::read(ready[0], &byte, 1)) < 0 && errno == EINTR) {
+    }
+    ::close(ready[0]);
+
+    if (n == 1) {
+      std::cout << "Monitor started (pid " << pid << ")." << std::endl;
+    } else {
+      ::waitpid(pid, nullptr, 0);
+      std::cerr << "The monitor did not start." << std::endl;
+    }
+    return;
+  }
+
+  ::close(ready[0]);
+  ::setsid();
+  if (!daemon.start()) {
+    ::close(ready[1]);
+    return;
+  }
+
+  const char byte = 1;
+  while (::write(ready[1], &byte, 1) < 0 && errno == EINTR) {
+  }
+  ::close(ready[1]);
+
+  const int null = ::open("/dev/null", O_RDWR);
+  if (null >= 0) {
+    ::dup2(null, STDIN_FILENO);
+    ::dup2(null, STDOUT_FILENO);
+    ::dup2(null, STDERR_FILENO);
+    if (null > STDERR_FILENO) ::close(null);
+  }
+  daemon.run();
+}
+
+// Stops a running monitor.
+inline void stop() {
+  std::string reply;
+  if (request("stop\n", reply)) std::cout << "Monitor stopped." << std::endl;
+  else std::cout << "No monitor is running." << std::endl;
+}
+
+} // namespace Monitor
+
+#endif
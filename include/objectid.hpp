@@ -0,0 +1,124 @@
+#ifndef OBJECTID_HPP
+#define OBJECTID_HPP
+
+#include <array>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/*
+ * The name of an object: the 32 bytes of its SHA256, held by value. Hashes
+ * are only written as 64 hex characters where people or text formats see
+ * them (tree and commit objects, log, the command line); everywhere else an
+ * ObjectId is compared, hashed and turned into a store path without touching
+ * the heap. The all-zero id stands for "no object".
+ */
+struct ObjectId {
+  static constexpr size_t SIZE = 32;
+  static constexpr size_t HEX_SIZE = 2 * SIZE;
+
+  std::array<uint8_t, SIZE> bytes{};
+
+  constexpr ObjectId() = default;
+
+  // From the raw digest of a hash.
+  static ObjectId fromDigest(const uint8_t *digest) {
+    ObjectId id;
+    std::memcpy(id.bytes.data(), digest, SIZE);
+    return id;
+  }
+
+  /**
+   * Reads 64 hex characters, in either case.
+   *
+   * @return false, leaving `out` alone, if `hex` is not a hash.
+   */
+  static constexpr bool fromHex(std::string_view hex, ObjectId &out) {
+    if (hex.size() != HEX_SIZE) return false;
+
+    ObjectId id;
+    for (size_t i = 0; i < SIZE; i++) {
+      const int high = nibble(hex[2 * i]), low = nibble(hex[2 * i + 1]);
+      if (high < 0 || low < 0) return false;
+      id.bytes[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    out = id;
+    return true;
+  }
+
+  // Like fromHex(), the null id if `hex` is not a hash.
+  static constexpr ObjectId parse(std::string_view hex) {
+    ObjectId id;
+    fromHex(hex, id);
+    return id;
+  }
+
+  constexpr bool isNull() const {
+    for (uint8_t byte : bytes) {
+      if (byte != 0) return false;
+    }
+    return true;
+  }
+
+  constexpr explicit operator bool() const { return !isNull(); }
+
+  // Writes the 64 lowercase hex characters to `out`, no terminator.
+  constexpr void toHex(char *out) const {
+    constexpr char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < SIZE; i++) {
+      out[2 * i] = digits[bytes[i] >> 4];
+      out[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+  }
+
+  // The hex form on the stack, for formatting.
+  constexpr std::array<char, HEX_SIZE> hexChars() const {
+    std::array<char, HEX_SIZE> out{};
+    toHex(out.data());
+    return out;
+  }
+
+  // The hex form as a string, where one is needed anyway.
+  std::string hex() const {
+    std::string out(HEX_SIZE, '\0');
+    toHex(out.data());
+    return out;
+  }
+
+  const uint8_t *data() const { return bytes.data(); }
+
+  constexpr auto operator<=>(const ObjectId &) const = default;
+
+  // The bytes are already uniformly spread, the first ones are the hash.
+  struct Hash {
+    size_t operator()(const ObjectId &id) const {
+      size_t value;
+      std::memcpy(&value, id.bytes.data(), sizeof(value));
+      return value;
+    }
+  };
+
+private:
+  static constexpr int nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+};
+
+static_assert(sizeof(ObjectId) == ObjectId::SIZE);
+
+inline std::ostream &operator<<(std::ostream &out, const ObjectId &id) {
+  const std::array<char, ObjectId::HEX_SIZE> hex = id.hexChars();
+  return out.write(hex.data(), static_cast<std::streamsize>(hex.size()));
+}
+
+template <> struct std::hash<ObjectId> : ObjectId::Hash {};
+
+#endif
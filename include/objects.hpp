@@ -1,8 +1,13 @@
 #ifndef OBJECTS_HPP
 #define OBJECTS_HPP
 
+#include "objectid.hpp"
+#include "pathtable.hpp"
+#include "treeformat.hpp"
+#include <ctime>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 
@@ -24,14 +29,23 @@ struct Commit {
   std::string authorName; // Committer's name
   std::string timestamp;  // Date and time of the commit
   std::string message;    // Commit message
-  std::string treeHash;   // SHA-2 hash of the top-level tree object
+  ObjectId treeHash;      // SHA-2 hash of the top-level tree object
+  time_t seconds;         // The timestamp as seconds since the epoch
 
   // Constructor
   Commit(const std::string &authorName, const std::string &message,
-         const std::string &treeHash)
+         const ObjectId &treeHash)
       : authorName(authorName), message(message), treeHash(treeHash) {
     // Set the timestamp to the current time
-    timestamp = getCurrentTime();
+    seconds = time(nullptr);
+    timestamp = formatTime(seconds);
+  }
+
+  // Formats a time the way commit timestamps are written.
+  static std::string formatTime(time_t t) {
+    char buffer[80];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    return buffer;
   }
 
   /**
@@ -45,16 +59,7 @@ struct Commit {
    */
   std::string getContent() const {
     return "commit:\nname:" + authorName + "\ntimestamp:" + timestamp +
-           "\nmessage:" + message + "\ntreehash:" + treeHash + "\n";
-  }
-
-private:
-  // Function to get the current time as a string
-  std::string getCurrentTime() {
-    time_t t = time(nullptr);
-    char buffer[80];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&t));
-    return buffer;
+           "\nmessage:" + message + "\ntreehash:" + treeHash.hex() + "\n";
   }
 };
 
@@ -62,34 +67,18 @@ private:
  * Represents an entry in a tree object.
  *
  * A `TreeEntry` encapsulates information about a file or directory in a tree
- * object, including its name, SHA-2 hash, and type (blob or tree).
+ * object, including its path, SHA-2 hash, and type (blob or tree). The path
+ * is interned, see PathTable.
  */
 struct TreeEntry {
-  std::filesystem::path relativePath;
-  std::string sha, type;
+  PathId path;
+  ObjectId sha;
+  TreeFormat::Type type;
 
-  TreeEntry(const std::filesystem::path &relativePath, const std::string &sha,
-            const std::string &type)
-      : relativePath(relativePath), sha(sha), type(type) {}
+  TreeEntry(PathId path, const ObjectId &sha, TreeFormat::Type type) : path(path), sha(sha), type(type) {}
 
-  bool operator==(const TreeEntry& other) const {
-    return relativePath == other.relativePath;
-  }
-
-  // For unordered_set 
-  struct Hash
-  {
-    size_t operator()(const TreeEntry& treeEntry) const
-    {
-      // Combine hash values of relevant fields using bitwise operations:
-      std::size_t path_hash = std::hash<std::string>()(treeEntry.relativePath.extension().string());
-      std::size_t sha_hash = std::hash<std::string>()(treeEntry.sha);
-      std::size_t type_hash = std::hash<std::string>()(treeEntry.type);
-
-      // Combine hashes using a mix function to improve uniformity:
-      return ((path_hash << 5) + sha_hash) ^ type_hash;
-    }
-  }; 
+  // The last component of the path, what the tree object records.
+  std::string_view name() const { return path.name(); }
 };
 
 /**
@@ -105,21 +94,27 @@ struct Tree {
   /**
    * Add an entry to the tree.
    *
-   * @param name The name of the file or directory.
-   * @param sha The SHA-1 hash of the object.
+   * @param path The interned path of the file or directory.
+   * @param sha The hash of the object.
    * @param type The type of the object (blob or tree).
    */
-  void addEntry(const std::filesystem::path &relativePath, const std::string &sha,
-                const std::string &type) {
-    entries.push_back(TreeEntry(relativePath, sha, type));
-  }
+  void addEntry(PathId path, const ObjectId &sha, TreeFormat::Type type) { entries.emplace_back(path, sha, type); }
 
+  /**
+   * The tree object, see TreeFormat. Only the names of the entries are
+   * written, their order is the one of `entries`.
+   */
   std::string getContent() const {
+    size_t size = TreeFormat::HEADER.size();
+    for (const TreeEntry &entry : entries) size += TreeFormat::entrySize(entry.name().size());
+
     std::string content;
+    content.reserve(size);
+    content += TreeFormat::HEADER;
     for (const TreeEntry &entry : entries) {
-      content += entry.relativePath.string() + " " + entry.sha + " " + entry.type + "\n";
+      TreeFormat::append(content, entry.name(), entry.type, entry.sha);
     }
-    return "tree:\n" + content;
+    return content;
   }
 };
 
@@ -0,0 +1,829 @@
+#ifndef OBJECTSTORE_HPP
+#define OBJECTSTORE_HPP
+
+#include "SHA256.hpp"
+#include "compression.hpp"
+#include "delta.hpp"
+#include "mappedfile.hpp"
+#include "objectid.hpp"
+#include "trace.hpp"
+#include "treeformat.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+/*
+ * Objects live either loose (.gid/objects/xx/yyyy...) or in a pack
+ * (.gid/objects/pack/pack-<name>.pack) together with many others. Readers go
+ * through ObjectStore, which looks in the packs first and then for a loose file.
+ * Either way the stored bytes may be compressed (see compression.hpp); packs
+ * keep each object exactly as it was stored loose.
+ *
+ * A blob may also be stored as a delta against another object (delta.hpp):
+ *   "delta: <base hash> <chain depth> <size>\n" followed by the instructions
+ * read() rebuilds such objects, callers never see the delta.
+ *
+ * Big files are stored chunked (chunker.hpp): every chunk is an object of its
+ * own, "chunk\n" followed by the bytes and named after the hash of both, and
+ * the blob is a manifest listing them:
+ *   "manifest: <path>\n" then "<chunk hash> <size>\n" per chunk
+ * read() puts such a blob together, open() streams it back as a plain one a
+ * chunk at a time.
+ *
+ * With `blobs = raw` in .gid/config, blobs are instead stored as the bare file
+ * (.gid/objects/raw/xx/yyyy...): no header, never compressed, chunked or
+ * deltified, read-only. Checkout can then reflink or hardlink them instead of
+ * copying (see checkout.hpp); open() gives them the usual header line. They
+ * are never packed.
+ *
+ * read() gives a whole object as a view over the mapped pack or loose file;
+ * small loose files, and objects that are compressed, deltified or chunked,
+ * go to a buffer reused across reads. BlobView, TreeView and CommitView read the
+ * object types in place. open() streams an object instead, for chunked blobs
+ * too big to hold, on top of read().
+ *
+ * .pack layout:
+ *   header   "GPCK", u32 version, u64 object count
+ *   objects  the bytes of each object as it was stored loose, back to back
+ *   trailer  SHA256 of everything before it
+ *
+ * .idx layout:
+ *   header   "GIDI", u32 version, u64 object count
+ *   fanout   256 u32, fanout[b] = number of objects whose first byte is <= b
+ *   hashes   the raw 32 byte hashes, sorted
+ *   offsets  u64 per object, where it starts in the .pack
+ *   sizes    u64 per object
+ *   trailer  the .pack checksum, then SHA256 of everything before it
+ */
+
+namespace ObjectStore {
+
+namespace fs = std::filesystem;
+
+constexpr std::string_view OBJECTS_DIRECTORY = ".gid/objects";
+constexpr std::string_view RAW_DIRECTORY = ".gid/objects/raw";
+const fs::path OBJECTS_PATH = OBJECTS_DIRECTORY;
+const fs::path PACK_PATH = OBJECTS_PATH / "pack";
+const fs::path RAW_PATH = RAW_DIRECTORY;
+constexpr std::string_view CHUNK_HEADER = "chunk\n";
+
+/**
+ * Where an object is stored, "<directory>/xx/yyyy...", formatted on the
+ * stack: looking an object up does not allocate.
+ */
+class ObjectPath {
+public:
+  ObjectPath(std::string_view directory, const ObjectId &id) {
+    const std::array<char, ObjectId::HEX_SIZE> hex = id.hexChars();
+    char *out = m_path;
+
+    out = std::copy(directory.begin(), directory.end(), out);
+    *out++ = '/';
+    out = std::copy(hex.begin(), hex.begin() + 2, out);
+    *out++ = '/';
+    out = std::copy(hex.begin() + 2, hex.end(), out);
+    *out = '\0';
+    m_size = static_cast<size_t>(out - m_path);
+  }
+
+  const char *c_str() const { return m_path; }
+  std::string_view view() const { return {m_path, m_size}; }
+
+  // For the callers that need a path object, which allocates.
+  operator fs::path() const { return fs::path(view()); }
+
+private:
+  static constexpr size_t MAX_DIRECTORY = 32;
+
+  char m_path[MAX_DIRECTORY + ObjectId::HEX_SIZE + 3];
+  size_t m_size;
+};
+
+static_assert(RAW_DIRECTORY.size() <= 32 && OBJECTS_DIRECTORY.size() <= 32);
+
+inline ObjectPath loosePath(const ObjectId &id) { return ObjectPath(OBJECTS_DIRECTORY, id); }
+
+inline ObjectPath rawPath(const ObjectId &id) { return ObjectPath(RAW_DIRECTORY, id); }
+
+inline bool fileExists(const ObjectPath &path) { return ::access(path.c_str(), F_OK) == 0; }
+
+// Whether new blobs are stored raw, from `blobs = raw` in .gid/config.
+inline bool rawBlobs() {
+  static const bool raw = [] {
+    const std::string *value = Settings::get("blobs");
+    return value && *value == "raw";
+  }();
+  return raw;
+}
+
+/**
+ * A pack and its index, both memory mapped.
+ */
+class Pack {
+public:
+  static constexpr uint32_t VERSION = 1;
+  static constexpr size_t HEADER_SIZE = 16;
+  static constexpr size_t FANOUT_SIZE = 256 * sizeof(uint32_t);
+
+  explicit Pack(const fs::path &idxPath)
+      : m_idx(idxPath, SIZE_MAX), m_pack(fs::path(idxPath).replace_extension(".pack"), SIZE_MAX) {
+    const std::string_view idx = m_idx.view();
+    if (!m_idx.mapped() || !m_pack.mapped() || idx.size() < HEADER_SIZE + FANOUT_SIZE + 64) return;
+    if (std::memcmp(idx.data(), "GIDI", 4) != 0 || readAt<uint32_t>(idx, 4) != VERSION) return;
+
+    m_count = readAt<uint64_t>(idx, 8);
+    if (idx.size() != HEADER_SIZE + FANOUT_SIZE + m_count * (32 + 8 + 8) + 64) return;
+
+    m_fanout = idx.data() + HEADER_SIZE;
+    m_hashes = reinterpret_cast<const uint8_t *>(m_fanout + FANOUT_SIZE);
+    m_offsets = reinterpret_cast<const char *>(m_hashes + 32 * m_count);
+    m_sizes = m_offsets + 8 * m_count;
+    m_valid = true;
+  }
+
+  bool valid() const { return m_valid; }
+  size_t count() const { return m_count; }
+
+  /**
+   * Looks an object up: the fanout table narrows the search to the hashes
+   * sharing the first byte, then a binary search finds the hash.
+   *
+   * @param id The object.
+   * @return The bytes of the object, or nothing if it is not in this pack.
+   */
+  std::optional<std::string_view> find(const ObjectId &id) const {
+    if (!m_valid) return std::nullopt;
+
+    const uint8_t *hash = id.data();
+    size_t low = hash[0] == 0 ? 0 : fanout(hash[0] - 1);
+    size_t high = fanout(hash[0]);
+
+    while (low < high) {
+      const size_t mid = low + (high - low) / 2;
+      const int cmp = std::memcmp(m_hashes + 32 * mid, hash, 32);
+
+      if (cmp == 0) {
+        uint64_t offset, size;
+        std::memcpy(&offset, m_offsets + 8 * mid, 8);
+        std::memcpy(&size, m_sizes + 8 * mid, 8);
+
+        if (offset + size > m_pack.size()) return std::nullopt;
+        return m_pack.view().substr(offset, size);
+      }
+
+      if (cmp < 0) low = mid + 1;
+      else high = mid;
+    }
+
+    return std::nullopt;
+  }
+
+private:
+  template <typename T> static T readAt(std::string_view data, size_t offset) {
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+  }
+
+  size_t fanout(uint8_t byte) const {
+    uint32_t value;
+    std::memcpy(&value, m_fanout + byte * sizeof(uint32_t), sizeof(value));
+    return value;
+  }
+
+  MappedFile m_idx, m_pack;
+  bool m_valid = false;
+  uint64_t m_count = 0;
+  const char *m_fanout = nullptr;
+  const uint8_t *m_hashes = nullptr;
+  const char *m_offsets = nullptr;
+  const char *m_sizes = nullptr;
+};
+
+// The packs of the repository, loaded the first time they are needed. Safe to
+// call from several threads; a reload must not race with readers.
+inline std::vector<std::unique_ptr<Pack>> &packs(bool reload = false) {
+  static std::vector<std::unique_ptr<Pack>> loaded;
+  static std::atomic<bool> isLoaded{false};
+  static std::mutex loadMutex;
+
+  if (isLoaded.load(std::memory_order_acquire) && !reload) return loaded;
+
+  std::lock_guard<std::mutex> lock(loadMutex);
+  if (isLoaded.load(std::memory_order_relaxed) && !reload) return loaded;
+
+  loaded.clear();
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(PACK_PATH, ec)) {
+    if (entry.path().extension() != ".idx") continue;
+
+    auto pack = std::make_unique<Pack>(entry.path());
+    if (pack->valid()) loaded.push_back(std::move(pack));
+    else std::cerr << "Ignoring broken pack: " << entry.path() << std::endl;
+  }
+  isLoaded.store(true, std::memory_order_release);
+
+  return loaded;
+}
+
+inline std::optional<std::string_view> findPacked(const ObjectId &id) {
+  for (const auto &pack : packs()) {
+    if (auto data = pack->find(id)) return data;
+  }
+  return std::nullopt;
+}
+
+inline bool exists(const ObjectId &id) {
+  return !id.isNull() && (findPacked(id).has_value() || fileExists(loosePath(id)) || fileExists(rawPath(id)));
+}
+
+// The first line of a delta object.
+struct DeltaHeader {
+  ObjectId base;
+  size_t depth = 0;
+  size_t size = 0;
+};
+
+// Parses "delta: <base hash> <chain depth> <size>", without the newline.
+inline bool parseDeltaHeader(std::string_view line, DeltaHeader &header) {
+  constexpr std::string_view tag = "delta: ";
+  if (line.substr(0, tag.size()) != tag || line.size() < tag.size() + ObjectId::HEX_SIZE + 4) return false;
+  if (!ObjectId::fromHex(line.substr(tag.size(), ObjectId::HEX_SIZE), header.base)) return false;
+
+  const char *end = line.data() + line.size();
+  auto [depthEnd, depthError] = std::from_chars(line.data() + tag.size() + ObjectId::HEX_SIZE + 1, end, header.depth);
+  if (depthError != std::errc() || depthEnd == end || *depthEnd != ' ') return false;
+  auto [sizeEnd, sizeError] = std::from_chars(depthEnd + 1, end, header.size);
+  return sizeError == std::errc() && sizeEnd == end;
+}
+
+enum class ObjectType : uint8_t { Invalid, Blob, Tree, Commit, Chunk, Manifest };
+
+namespace detail {
+
+// Buffers of rebuilt objects, kept per thread for the next read.
+struct BufferPool {
+  static constexpr size_t MAX_BUFFERS = 8;
+  static constexpr size_t MAX_CAPACITY = 4 << 20;
+
+  std::vector<std::string> free;
+
+  static BufferPool &local() {
+    thread_local BufferPool pool;
+    return pool;
+  }
+
+  std::string acquire() {
+    if (free.empty()) return std::string();
+
+    std::string buffer = std::move(free.back());
+    free.pop_back();
+    buffer.clear();
+    return buffer;
+  }
+
+  void release(std::string &buffer) {
+    if (buffer.capacity() > 64 && buffer.capacity() <= MAX_CAPACITY && free.size() < MAX_BUFFERS) {
+      free.push_back(std::move(buffer));
+    }
+    buffer = std::string();
+  }
+};
+
+} // namespace detail
+
+/**
+ * An object read whole by read(). It owns what its bytes live in: the mapped
+ * loose file, a buffer for a small or rebuilt object, or nothing for a packed
+ * object, which stays in the mapped pack. Move-only, the views over it must
+ * not outlive it.
+ */
+class Object {
+public:
+  Object() = default;
+  Object(Object &&) = default;
+  Object &operator=(Object &&other) {
+    detail::BufferPool::local().release(m_buffer);
+    m_file = std::move(other.m_file);
+    m_buffer = std::move(other.m_buffer);
+    m_packed = other.m_packed;
+    m_source = other.m_source;
+    m_type = other.m_type;
+    m_headerSize = other.m_headerSize;
+    m_deltaDepth = other.m_deltaDepth;
+    return *this;
+  }
+  ~Object() { detail::BufferPool::local().release(m_buffer); }
+
+  // Loose objects at least this big are mapped, smaller ones are read.
+  static constexpr size_t MAP_THRESHOLD = 64 << 10;
+
+  bool valid() const { return m_type != ObjectType::Invalid; }
+  explicit operator bool() const { return valid(); }
+
+  ObjectType type() const { return m_type; }
+
+  // The whole object, header line included. Raw blobs have no header.
+  std::string_view data() const {
+    switch (m_source) {
+    case Source::Packed: return m_packed;
+    case Source::File:   return m_file.view();
+    case Source::Buffer: return m_buffer;
+    default:             return {};
+    }
+  }
+
+  // What follows the header line: the file of a blob, the fields of a commit.
+  std::span<const char> payload() const {
+    const std::string_view bytes = data().substr(m_headerSize);
+    return {bytes.data(), bytes.size()};
+  }
+
+  size_t size() const { return data().size() - m_headerSize; }
+
+  // The header line, without its newline.
+  std::string_view header() const { return data().substr(0, m_headerSize - (m_headerSize > 0)); }
+
+  // How many deltas were applied to rebuild it, 0 if it is stored whole.
+  size_t deltaDepth() const { return m_deltaDepth; }
+
+private:
+  friend Object read(const ObjectId &id, bool assembleChunks, size_t depth);
+
+  enum class Source : uint8_t { None, Packed, File, Buffer };
+
+  // Takes the bytes from `buffer`, the file or pack is not needed anymore.
+  void adopt(std::string &&buffer) {
+    detail::BufferPool::local().release(m_buffer);
+    m_buffer = std::move(buffer);
+    m_file = MappedFile();
+    m_source = Source::Buffer;
+  }
+
+  MappedFile m_file;
+  std::string m_buffer;
+  std::string_view m_packed;
+  Source m_source = Source::None;
+  ObjectType m_type = ObjectType::Invalid;
+  size_t m_headerSize = 0;
+  size_t m_deltaDepth = 0;
+};
+
+/**
+ * Reads a whole object: one lookup in the packs, or one open of its loose file
+ * which is then mapped, or read into a reused buffer if it is small. Nothing
+ * else is copied unless the object has to be decompressed, rebuilt from its
+ * delta or put together from its chunks.
+ *
+ * @param id The object.
+ * @param assembleChunks Whether a chunked blob is put together in memory; if
+ *                       not, its manifest is returned, for callers that
+ *                       stream big blobs with open().
+ * @param depth How deep in a delta chain this object is, guards against loops.
+ * @return The object, invalid if it is missing or broken.
+ */
+inline Object read(const ObjectId &id, bool assembleChunks = true, size_t depth = 0) {
+  Trace::Scope scope("ObjectStore::read");
+  Trace::count("objects.read");
+
+  Object object;
+  bool raw = false;
+  if (id.isNull()) return object;
+
+  if (auto packed = findPacked(id)) {
+    object.m_packed = *packed;
+    object.m_source = Object::Source::Packed;
+  } else {
+    object.m_file = MappedFile(loosePath(id).c_str(), 0);
+    if (!object.m_file.is_open()) {
+      object.m_file = MappedFile(rawPath(id).c_str(), 0);
+      raw = true;
+    }
+    if (!object.m_file.is_open()) return Object();
+
+    // Small objects are copied, mapping them costs more than reading them.
+    if (object.m_file.size() < Object::MAP_THRESHOLD) {
+      std::string buffer = detail::BufferPool::local().acquire();
+      bool read = true;
+      buffer.resize_and_overwrite(object.m_file.size(), [&](char *data, size_t) {
+        read = ::pread(object.m_file.fd(), data, object.m_file.size(), 0) ==
+               static_cast<ssize_t>(object.m_file.size());
+        return object.m_file.size();
+      });
+      object.adopt(std::move(buffer));
+      if (!read) return Object();
+    } else if (object.m_file.map()) {
+      object.m_source = Object::Source::File;
+    } else {
+      return Object();
+    }
+  }
+
+  // A raw blob is the bare file.
+  if (raw) {
+    object.m_type = ObjectType::Blob;
+    return object;
+  }
+
+  detail::BufferPool &pool = detail::BufferPool::local();
+  if (Compression::isCompressed(object.data())) {
+    std::string decoded = pool.acquire();
+    if (!Compression::decompress(object.data(), decoded)) {
+      std::cerr << "Broken object: " << id << std::endl;
+      pool.release(decoded);
+      return Object();
+    }
+    object.adopt(std::move(decoded));
+  }
+
+  std::string_view data = object.data();
+  const size_t newline = data.find('\n');
+  if (newline == std::string_view::npos) return Object();
+
+  if (data[0] == 'd') {
+    DeltaHeader header;
+    Object base;
+    if (!parseDeltaHeader(data.substr(0, newline), header) || depth > Delta::MAX_DEPTH ||
+        !(base = read(header.base, true, depth + 1))) {
+      std::cerr << "Broken delta object: " << id << std::endl;
+      return Object();
+    }
+
+    // Raw blobs were bases with the header streams give them.
+    std::string rawBase;
+    std::string_view baseData = base.data();
+    if (base.m_headerSize == 0) baseData = rawBase = "blob:\n" + std::string(baseData);
+
+    std::string rebuilt = pool.acquire();
+    bool valid = false;
+    rebuilt.resize_and_overwrite(header.size, [&](char *buffer, size_t) {
+      valid = Delta::apply(baseData, data.substr(newline + 1), buffer, header.size);
+      return header.size;
+    });
+    if (!valid) {
+      std::cerr << "Broken delta object: " << id << std::endl;
+      pool.release(rebuilt);
+      return Object();
+    }
+    object.adopt(std::move(rebuilt));
+    object.m_deltaDepth = header.depth;
+  } else if (data[0] == 'm' && assembleChunks) {
+    // "manifest: <path>" then "<chunk hash> <size>" per chunk.
+    const std::string_view path = data.substr(0, newline).substr(std::min(newline, data.find(' ') + 1));
+    std::string assembled = pool.acquire();
+    assembled.append("blob: ").append(path) += '\n';
+
+    for (size_t line = newline + 1; line < data.size();) {
+      const size_t end = std::min(data.find('\n', line), data.size());
+      const ObjectId chunkId = ObjectId::parse(data.substr(line, std::min(end, data.find(' ', line)) - line));
+      line = end + 1;
+
+      const Object chunk = read(chunkId, true, depth);
+      if (chunk.type() != ObjectType::Chunk) {
+        std::cerr << "Missing chunk: " << chunkId << std::endl;
+        pool.release(assembled);
+        return Object();
+      }
+      assembled.append(chunk.payload().data(), chunk.size());
+    }
+    object.adopt(std::move(assembled));
+  }
+
+  data = object.data();
+  object.m_headerSize = data.find('\n') + 1;
+  const std::string_view header = data.substr(0, object.m_headerSize);
+
+  if (header.starts_with("blob:")) object.m_type = ObjectType::Blob;
+  else if (header.starts_with("tree:")) object.m_type = ObjectType::Tree;
+  else if (header.starts_with("commit:")) object.m_type = ObjectType::Commit;
+  else if (header == CHUNK_HEADER) object.m_type = ObjectType::Chunk;
+  else if (header.starts_with("manifest:")) object.m_type = ObjectType::Manifest;
+  return object;
+}
+
+/**
+ * Streams an object read by read() as a plain one. A chunked blob becomes
+ * its "blob: <path>" header line followed by its chunks, each read only once
+ * the one before is used up; a raw blob gets the "blob:" header line it does
+ * not store. The bytes are not copied, the stream points into the objects.
+ */
+class ObjectStreambuf : public std::streambuf {
+public:
+  explicit ObjectStreambuf(Object object) : m_object(std::move(object)) {
+    if (m_object.type() == ObjectType::Manifest) {
+      // "manifest: <path>" then "<chunk hash> <size>" per chunk.
+      const std::string_view line = m_object.header();
+      m_header = "blob: " + std::string(line.substr(std::min(line.size(), line.find(' ') + 1))) + "\n";
+      const std::span<const char> payload = m_object.payload();
+      m_manifest = std::string_view(payload.data(), payload.size());
+    } else {
+      if (m_object.type() == ObjectType::Blob && m_object.header().empty()) m_header = "blob:\n";
+      m_next = m_object.data();
+    }
+    setg(m_header.data(), m_header.data(), m_header.data() + m_header.size());
+  }
+
+protected:
+  int_type underflow() override {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+    while (m_next.empty()) {
+      if (m_manifest.empty()) return traits_type::eof();
+
+      const size_t end = std::min(m_manifest.find('\n'), m_manifest.size());
+      const ObjectId id = ObjectId::parse(m_manifest.substr(0, std::min(end, m_manifest.find(' '))));
+      m_manifest.remove_prefix(std::min(end + 1, m_manifest.size()));
+
+      m_chunk = read(id);
+      if (m_chunk.type() != ObjectType::Chunk) {
+        std::cerr << "Missing chunk: " << id << std::endl;
+        m_manifest = {};
+        return traits_type::eof();
+      }
+      const std::span<const char> payload = m_chunk.payload();
+      m_next = std::string_view(payload.data(), payload.size());
+    }
+
+    // Only read from, the get area never writes.
+    char *begin = const_cast<char *>(m_next.data());
+    setg(begin, begin, begin + m_next.size());
+    m_next = {};
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+  Object m_object, m_chunk;
+  std::string m_header;
+  std::string_view m_manifest; // The chunks left, into m_object
+  std::string_view m_next;     // Bytes to stream once the get area is used up
+};
+
+class ObjectStream : public std::istream {
+public:
+  explicit ObjectStream(Object object) : std::istream(nullptr), m_buffer(std::move(object)) {
+    rdbuf(&m_buffer);
+  }
+
+private:
+  ObjectStreambuf m_buffer;
+};
+
+/**
+ * Opens an object as a stream, for blobs too big to hold: chunked blobs are
+ * streamed a chunk at a time. Everything else, deltas included, is read whole
+ * by read().
+ *
+ * @param id The object.
+ * @return A stream over the object, in a failed state if there is no such object.
+ */
+inline std::unique_ptr<std::istream> open(const ObjectId &id) {
+  Trace::Scope scope("ObjectStore::open");
+  Object object = read(id, false);
+  const bool missing = !object;
+
+  auto stream = std::make_unique<ObjectStream>(std::move(object));
+  if (missing) stream->setstate(std::ios::failbit);
+  return stream;
+}
+
+/**
+ * A blob read in place: the file it was made from.
+ */
+class BlobView {
+public:
+  explicit BlobView(const Object &object) : m_object(object) {}
+
+  bool valid() const { return m_object.type() == ObjectType::Blob; }
+
+  std::string_view content() const {
+    const std::span<const char> payload = m_object.payload();
+    return valid() ? std::string_view(payload.data(), payload.size()) : std::string_view();
+  }
+
+  // The path recorded with the blob, empty for raw blobs.
+  std::string_view path() const {
+    const std::string_view header = m_object.header();
+    return header.size() > 6 ? header.substr(6) : std::string_view();
+  }
+
+private:
+  const Object &m_object;
+};
+
+/**
+ * A tree read in place, its entries are iterated as with TreeFormat::View.
+ */
+class TreeView : public TreeFormat::View {
+public:
+  explicit TreeView(const Object &object)
+      : TreeFormat::View(object.type() == ObjectType::Tree ? object.data() : std::string_view()) {}
+};
+
+/**
+ * A commit read in place. Each field is found by a scan of the few lines of
+ * the commit.
+ */
+class CommitView {
+public:
+  explicit CommitView(const Object &object) : m_object(object) {}
+
+  bool valid() const { return m_object.type() == ObjectType::Commit; }
+
+  std::string_view author() const { return field("name:"); }
+  std::string_view timestamp() const { return field("timestamp:"); }
+  std::string_view message() const { return field("message:"); }
+
+  // The root tree, null if the commit has none.
+  ObjectId treeHash() const { return ObjectId::parse(field("treehash:")); }
+
+private:
+  std::string_view field(std::string_view name) const {
+    if (!valid()) return {};
+
+    const std::span<const char> payload = m_object.payload();
+    std::string_view rest(payload.data(), payload.size());
+    while (!rest.empty()) {
+      const size_t end = std::min(rest.find('\n'), rest.size());
+      if (rest.starts_with(name)) return rest.substr(name.size(), end - name.size());
+      rest.remove_prefix(std::min(end + 1, rest.size()));
+    }
+    return {};
+  }
+
+  const Object &m_object;
+};
+
+/**
+ * Moves every loose object into a new pack, then removes the loose files.
+ * They are only removed once the pack is written and reads back, on any
+ * error the partial pack is removed and the loose objects stay.
+ *
+ * @return The number of objects packed, nothing if the pack could not be
+ *         written.
+ */
+inline std::optional<size_t> repack() {
+  std::vector<ObjectId> ids;
+  std::error_code ec;
+
+  for (const auto &dir : fs::directory_iterator(OBJECTS_PATH, ec)) {
+    const std::string prefix = dir.path().filename().string();
+    if (!dir.is_directory() || prefix.size() != 2) continue;
+
+    for (const auto &file : fs::directory_iterator(dir.path())) {
+      ObjectId id;
+      if (file.is_regular_file() && ObjectId::fromHex(prefix + file.path().filename().string(), id) &&
+          !findPacked(id)) {
+        ids.push_back(id);
+      }
+    }
+  }
+
+  if (ids.empty()) return 0;
+  std::sort(ids.begin(), ids.end());
+
+  // The pack is named after the objects it holds.
+  SHA256 nameSha;
+  for (const ObjectId &id : ids) {
+    const std::array<char, ObjectId::HEX_SIZE> hex = id.hexChars();
+    nameSha.update(reinterpret_cast<const uint8_t *>(hex.data()), hex.size());
+  }
+  uint8_t *nameDigest = nameSha.digest();
+  const std::string name = "pack-" + SHA256::toString(nameDigest);
+  delete[] nameDigest;
+
+  fs::create_directories(PACK_PATH);
+  const fs::path packPath = PACK_PATH / (name + ".pack");
+  const fs::path idxPath = PACK_PATH / (name + ".idx");
+  const fs::path packTmp = packPath.string() + ".tmp", idxTmp = idxPath.string() + ".tmp";
+
+  std::ofstream pack(packTmp, std::ios::binary | std::ios::trunc);
+  if (pack.fail()) {
+    std::cerr << "Error creating pack file: " << packPath << std::endl;
+    return std::nullopt;
+  }
+
+  // Nothing was packed: the loose objects stay, the partial files go.
+  auto abandon = [&](const std::string &error) {
+    std::cerr << error << " The loose objects are kept." << std::endl;
+    fs::remove(packTmp, ec);
+    fs::remove(idxTmp, ec);
+    return std::nullopt;
+  };
+
+  SHA256 packSha;
+  auto writePack = [&pack, &packSha](const void *data, size_t size) {
+    pack.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+    packSha.update(static_cast<const uint8_t *>(data), size);
+  };
+
+  const uint64_t count = ids.size();
+  const uint32_t version = Pack::VERSION;
+  writePack("GPCK", 4);
+  writePack(&version, sizeof(version));
+  writePack(&count, sizeof(count));
+
+  std::vector<uint64_t> offsets, sizes;
+  std::vector<char> buffer(1 << 20);
+  uint64_t offset = Pack::HEADER_SIZE;
+
+  for (const ObjectId &id : ids) {
+    std::ifstream loose(loosePath(id).c_str(), std::ios::binary);
+    uint64_t size = 0;
+
+    while (loose.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || loose.gcount() > 0) {
+      writePack(buffer.data(), static_cast<size_t>(loose.gcount()));
+      size += static_cast<uint64_t>(loose.gcount());
+    }
+    if (!loose.is_open() || loose.bad()) {
+      pack.close();
+      return abandon("Error reading object " + id.hex() + ".");
+    }
+
+    offsets.push_back(offset);
+    sizes.push_back(size);
+    offset += size;
+  }
+
+  uint8_t *packDigest = packSha.digest();
+  pack.write(reinterpret_cast<const char *>(packDigest), 32);
+  pack.flush();
+  pack.close();
+  if (pack.fail()) {
+    delete[] packDigest;
+    return abandon("Error writing pack file: " + packPath.string() + ".");
+  }
+
+  // The index: fanout, hashes, offsets, sizes, checksums.
+  std::string idx("GIDI", 4);
+  idx.append(reinterpret_cast<const char *>(&version), sizeof(version));
+  idx.append(reinterpret_cast<const char *>(&count), sizeof(count));
+
+  uint32_t fanout[256] = {};
+  std::string rawHashes;
+  for (const ObjectId &id : ids) {
+    fanout[id.bytes[0]]++;
+    rawHashes.append(reinterpret_cast<const char *>(id.data()), ObjectId::SIZE);
+  }
+  for (size_t i = 1; i < 256; i++) fanout[i] += fanout[i - 1];
+
+  idx.append(reinterpret_cast<const char *>(fanout), sizeof(fanout));
+  idx += rawHashes;
+  idx.append(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+  idx.append(reinterpret_cast<const char *>(sizes.data()), sizes.size() * sizeof(uint64_t));
+  idx.append(reinterpret_cast<const char *>(packDigest), 32);
+  delete[] packDigest;
+
+  SHA256 idxSha;
+  idxSha.update(idx);
+  uint8_t *idxDigest = idxSha.digest();
+  idx.append(reinterpret_cast<const char *>(idxDigest), 32);
+  delete[] idxDigest;
+
+  std::ofstream idxFile(idxTmp, std::ios::binary | std::ios::trunc);
+  idxFile.write(idx.data(), static_cast<std::streamsize>(idx.size()));
+  idxFile.flush();
+  idxFile.close();
+  if (idxFile.fail()) return abandon("Error writing pack index: " + idxPath.string() + ".");
+
+  // The pack goes first, a pack is only used once its index shows up.
+  fs::rename(packTmp, packPath, ec);
+  if (!ec) fs::rename(idxTmp, idxPath, ec);
+  if (ec) {
+    fs::remove(packPath, ec);
+    return abandon("Error installing pack " + name + ".");
+  }
+
+  // The loose objects are only removed once the pack reads back whole.
+  if (const Pack written(idxPath); !written.valid() || written.count() != ids.size()) {
+    fs::remove(idxPath, ec);
+    fs::remove(packPath, ec);
+    return abandon("The new pack " + name + " can not be read back.");
+  }
+
+  for (const ObjectId &id : ids) {
+    const fs::path path = loosePath(id);
+    fs::remove(path);
+    if (fs::is_empty(path.parent_path())) fs::remove(path.parent_path());
+  }
+
+  packs(true);
+  return ids.size();
+}
+
+} // namespace ObjectStore
+
+#endif
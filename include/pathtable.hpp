@@ -0,0 +1,150 @@
+#ifndef PATHTABLE_HPP
+#define PATHTABLE_HPP
+
+#include "flatmap.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+
+/*
+ * The paths a command works with, each stored once. A path is interned into
+ * an arena the first time it is seen and from then on handled as a PathId,
+ * a pointer to that single copy: trees, the index and the sets of paths seen
+ * by add hold ids, compare them by address and hash them without reading
+ * the characters, and names are slices of the interned path.
+ *
+ * Nothing is freed path by path. The arenas are dropped in one go by
+ * Paths::release() once the command is done, which invalidates every id.
+ * The table is split in shards with their own lock and arena, so the tasks
+ * building a tree intern their paths without waiting on each other much.
+ */
+
+class PathId {
+public:
+  PathId() = default;
+
+  std::string_view view() const { return m_data ? std::string_view(m_data, length()) : std::string_view(); }
+
+  // Interned paths are NUL terminated, for the system calls.
+  const char *c_str() const { return m_data ? m_data : ""; }
+
+  // The last component, what tree objects record.
+  std::string_view name() const {
+    const std::string_view path = view();
+    return path.substr(path.rfind('/') + 1);
+  }
+
+  explicit operator bool() const { return m_data != nullptr; }
+  bool operator==(const PathId &other) const { return m_data == other.m_data; }
+
+  struct Hash {
+    size_t operator()(const PathId &id) const { return std::hash<const char *>()(id.m_data); }
+  };
+
+private:
+  friend class PathTable;
+  explicit PathId(const char *data) : m_data(data) {}
+
+  // The length is stored right before the characters.
+  uint32_t length() const {
+    uint32_t size;
+    std::memcpy(&size, m_data - sizeof(size), sizeof(size));
+    return size;
+  }
+
+  const char *m_data = nullptr;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const PathId &id) { return out << id.view(); }
+
+using PathSet = FlatSet<PathId, PathId::Hash>;
+
+class PathTable {
+public:
+  /**
+   * The id of a path, interning it the first time.
+   *
+   * @param path Any string, usually an absolute path.
+   */
+  PathId intern(std::string_view path) {
+    const size_t hash = std::hash<std::string_view>()(path);
+    Shard &shard = m_shards[hash % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.state->paths.find(path);
+    if (it != shard.state->paths.end()) return PathId(it->data());
+
+    // [u32 length][characters]['\0'], the length is read back by PathId.
+    const uint32_t size = static_cast<uint32_t>(path.size());
+    char *block = static_cast<char *>(shard.state->arena.allocate(sizeof(size) + path.size() + 1, alignof(uint32_t)));
+    std::memcpy(block, &size, sizeof(size));
+    std::memcpy(block + sizeof(size), path.data(), path.size());
+    block[sizeof(size) + path.size()] = '\0';
+
+    const std::string_view interned(block + sizeof(size), path.size());
+    shard.state->paths.insert(interned);
+    return PathId(interned.data());
+  }
+
+  // The id of a path if it was interned, a null id otherwise.
+  PathId find(std::string_view path) const {
+    const Shard &shard = m_shards[std::hash<std::string_view>()(path) % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.state->paths.find(path);
+    return it == shard.state->paths.end() ? PathId() : PathId(it->data());
+  }
+
+  // Frees every path at once, no id may be used afterwards.
+  void release() {
+    for (Shard &shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.state = std::make_unique<State>();
+    }
+  }
+
+private:
+  static constexpr size_t SHARDS = 16;
+  static constexpr size_t ARENA_BLOCK = 64 * 1024;
+
+  // The set lives in the arena too, with the paths it points to. The arena
+  // never frees, the arrays it outgrows stay until release(), at most as
+  // much again as the final ones.
+  struct State {
+    std::pmr::monotonic_buffer_resource arena{ARENA_BLOCK};
+    FlatSet<std::string_view, std::hash<std::string_view>, std::equal_to<>,
+            std::pmr::polymorphic_allocator<std::string_view>>
+        paths{&arena};
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unique_ptr<State> state = std::make_unique<State>();
+  };
+
+  std::array<Shard, SHARDS> m_shards;
+};
+
+namespace Paths {
+
+// The table of the running command.
+inline PathTable &table() {
+  static PathTable paths;
+  return paths;
+}
+
+inline PathId intern(std::string_view path) { return table().intern(path); }
+inline PathId find(std::string_view path) { return table().find(path); }
+
+// Called once the command is done, see PathTable::release().
+inline void release() { table().release(); }
+
+} // namespace Paths
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class TaskGroup;
+
+/**
+ * A work-stealing thread pool. Every thread has its own deque: it pushes and
+ * pops its own tasks at the back, so nested work stays hot in its cache, and
+ * idle threads steal from the front of the others, taking the oldest and
+ * usually biggest tasks.
+ *
+ * Tasks are run through a TaskGroup. A thread waiting on a group keeps running
+ * tasks meanwhile, so tasks can spawn and wait on their own groups without
+ * tying up the pool. With a single thread everything runs on the caller.
+ *
+ * The number of threads comes from setThreads() (the -j option), then the
+ * GID_THREADS environment variable, then the number of cores.
+ */
+class Scheduler {
+public:
+  using Task = std::function<void()>;
+
+  explicit Scheduler(size_t threads) : m_workers(std::max<size_t>(threads, 1)) {
+    for (size_t i = 0; i + 1 < m_workers.size(); i++) {
+      m_threads.emplace_back([this, i] { workerLoop(i); });
+    }
+  }
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  ~Scheduler() {
+    {
+      std::lock_guard<std::mutex> lock(m_sleepMutex);
+      m_stop = true;
+    }
+    m_wakeUp.notify_all();
+    for (std::thread &thread : m_threads) thread.join();
+  }
+
+  size_t threads() const { return m_workers.size(); }
+
+  // Sets the thread count of the shared scheduler, before its first use.
+  static void setThreads(size_t threads) { requestedThreads() = threads; }
+
+  static size_t defaultThreads() {
+    if (requestedThreads() > 0) return requestedThreads();
+
+    if (const char *env = std::getenv("GID_THREADS")) {
+      const long threads = std::atol(env);
+      if (threads > 0) return static_cast<size_t>(threads);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // The scheduler shared by the whole program.
+  static Scheduler &instance() {
+    static Scheduler scheduler(defaultThreads());
+    return scheduler;
+  }
+
+private:
+  friend class TaskGroup;
+
+  struct Job {
+    Task task;
+    TaskGroup *group;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  static size_t &requestedThreads() {
+    static size_t threads = 0;
+    return threads;
+  }
+
+  // The deque of the calling thread. Threads outside the pool share the last one.
+  size_t self() const {
+    const size_t index = currentWorker();
+    return index < m_workers.size() - 1 ? index : m_workers.size() - 1;
+  }
+
+  static size_t &currentWorker() {
+    thread_local size_t index = SIZE_MAX;
+    return index;
+  }
+
+  void push(Job job) {
+    Worker &worker = m_workers[self()];
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.jobs.push_back(std::move(job));
+    }
+    m_queued.fetch_add(1, std::memory_order_release);
+
+    if (m_sleeping.load(std::memory_order_acquire) > 0) {
+      std::lock_guard<std::mutex> lock(m_sleepMutex);
+      m_wakeUp.notify_one();
+    }
+  }
+
+  // Pops from the own deque first, then steals from the others.
+  bool pop(Job &job) {
+    if (m_queued.load(std::memory_order_acquire) == 0) return false;
+    const size_t own = self();
+
+    {
+      Worker &worker = m_workers[own];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (!worker.jobs.empty()) {
+        job = std::move(worker.jobs.back());
+        worker.jobs.pop_back();
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    for (size_t offset = 1; offset < m_workers.size(); offset++) {
+      Worker &victim = m_workers[(own + offset) % m_workers.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty()) {
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  inline void run(Job &job);
+
+  // Blocks a thread waiting on a group until a task is queued or `done`
+  // holds. Like a worker it wakes up on its own after a while, in case a push
+  // missed it while it was going to sleep.
+  template <typename Done> void sleep(Done done) {
+    std::unique_lock<std::mutex> lock(m_sleepMutex);
+    m_sleeping.fetch_add(1, std::memory_order_acq_rel);
+    m_wakeUp.wait_for(lock, std::chrono::milliseconds(10),
+                      [this, &done] { return m_stop || m_queued.load(std::memory_order_acquire) > 0 || done(); });
+    m_sleeping.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  // Wakes the threads sleeping in sleep() once a group is done. A waiter that
+  // goes to sleep later sees the group done under the lock.
+  void groupDone() {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    if (m_sleeping.load(std::memory_order_acquire) > 0) m_wakeUp.notify_all();
+  }
+
+  void workerLoop(size_t index) {
+    currentWorker() = index;
+
+    while (true) {
+      Job job;
+      if (pop(job)) {
+        run(job);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(m_sleepMutex);
+      if (m_stop) return;
+
+      m_sleeping.fetch_add(1, std::memory_order_acq_rel);
+      m_wakeUp.wait_for(lock, std::chrono::milliseconds(10),
+                        [this] { return m_stop || m_queued.load(std::memory_order_acquire) > 0; });
+      m_sleeping.fetch_sub(1, std::memory_order_acq_rel);
+      if (m_stop) return;
+    }
+  }
+
+  std::vector<Worker> m_workers;
+  std::vector<std::thread> m_threads;
+  std::atomic<size_t> m_queued{0};
+  std::atomic<size_t> m_sleeping{0};
+  std::mutex m_sleepMutex;
+  std::condition_variable m_wakeUp;
+  bool m_stop = false;
+};
+
+/**
+ * A set of tasks that is waited on together. The first exception thrown by a
+ * task is rethrown by wait().
+ */
+class TaskGroup {
+public:
+  explicit TaskGroup(Scheduler &scheduler = Scheduler::instance()) : m_scheduler(scheduler) {}
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  ~TaskGroup() {
+    try {
+      wait();
+    } catch (...) {
+    }
+  }
+
+  void run(Scheduler::Task task) {
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+
+    // Nothing to run it in parallel with, run it right away.
+    if (m_scheduler.threads() == 1) {
+      Scheduler::Job job{std::move(task), this};
+      m_scheduler.run(job);
+      return;
+    }
+    m_scheduler.push({std::move(task), this});
+  }
+
+  // Runs tasks, this group's or any other, until every task of the group is
+  // done. With nothing to run it sleeps until a task is pushed or the last
+  // task of the group finishes.
+  void wait() {
+    while (m_pending.load(std::memory_order_acquire) > 0) {
+      Scheduler::Job job;
+      if (m_scheduler.pop(job)) m_scheduler.run(job);
+      else m_scheduler.sleep([this] { return m_pending.load(std::memory_order_acquire) == 0; });
+    }
+
+    std::lock_guard<std::mutex> lock(m_errorMutex);
+    if (m_error) std::rethrow_exception(std::exchange(m_error, nullptr));
+  }
+
+private:
+  friend class Scheduler;
+
+  void finished(std::exception_ptr error) {
+    if (error) {
+      std::lock_guard<std::mutex> lock(m_errorMutex);
+      if (!m_error) m_error = error;
+    }
+
+    // The waiter may destroy the group as soon as the count drops to 0.
+    Scheduler &scheduler = m_scheduler;
+    if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) scheduler.groupDone();
+  }
+
+  Scheduler &m_scheduler;
+  std::atomic<size_t> m_pending{0};
+  std::mutex m_errorMutex;
+  std::exception_ptr m_error;
+};
+
+inline void Scheduler::run(Job &job) {
+  std::exception_ptr error;
+  try {
+    job.task();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  job.group->finished(error);
+}
+
+#endif
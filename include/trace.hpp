@@ -0,0 +1,210 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/*
+ * Where the time of a command goes. Scopes time the functions they are placed
+ * in and counters add up what those functions handled (bytes hashed, objects
+ * written, ...). With `--trace=<file>` or GID_TRACE=<file> every scope is
+ * written to the file as a Chrome trace event (open it in chrome://tracing or
+ * https://ui.perfetto.dev) and a summary table goes to stderr at exit.
+ *
+ * When tracing is off a scope only tests a flag, so they can stay in hot
+ * functions. Each thread records into its own buffer, which is only locked
+ * once per thread.
+ */
+
+namespace Trace {
+
+// Set once by start(), before any thread is created.
+inline bool enabled = false;
+
+namespace detail {
+
+struct Event {
+  const char *name; // A string literal
+  uint64_t start;   // Microseconds since start()
+  uint64_t duration;
+};
+
+struct Buffer {
+  uint32_t thread = 0;
+  std::vector<Event> events;
+};
+
+struct State {
+  std::string path;
+  std::chrono::steady_clock::time_point origin;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Buffer>> buffers; // Outlive their threads
+  std::map<std::string, std::atomic<uint64_t>> counters;
+};
+
+inline State &state() {
+  static State instance;
+  return instance;
+}
+
+inline uint64_t now() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - state().origin)
+          .count());
+}
+
+inline Buffer &buffer() {
+  thread_local Buffer *local = [] {
+    State &trace = state();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    trace.buffers.push_back(std::make_unique<Buffer>());
+    trace.buffers.back()->thread = static_cast<uint32_t>(trace.buffers.size());
+    return trace.buffers.back().get();
+  }();
+  return *local;
+}
+
+// Escapes the few characters a name may need in JSON.
+inline std::string quote(const std::string &text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+} // namespace detail
+
+/**
+ * Times the rest of the enclosing block.
+ *
+ *   Trace::Scope scope("storeObject");
+ *
+ * @param name A string literal, the same for every call of the function.
+ */
+class Scope {
+public:
+  explicit Scope(const char *name) : m_name(name) {
+    if (enabled) m_start = detail::now();
+  }
+
+  ~Scope() {
+    if (enabled) detail::buffer().events.push_back({m_name, m_start, detail::now() - m_start});
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  const char *m_name;
+  uint64_t m_start = 0;
+};
+
+/**
+ * Adds to a counter, shown in the summary and at the end of the trace.
+ *
+ * @param name A string literal.
+ * @param value What to add.
+ */
+inline void count(const char *name, uint64_t value = 1) {
+  if (!enabled) return;
+
+  // A counter is created once, then only its atomic is touched.
+  thread_local std::map<const char *, std::atomic<uint64_t> *> known;
+  std::atomic<uint64_t> *&counter = known[name];
+  if (!counter) {
+    detail::State &trace = detail::state();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    counter = &trace.counters[name];
+  }
+  counter->fetch_add(value, std::memory_order_relaxed);
+}
+
+/**
+ * Turns tracing on.
+ *
+ * @param path Where the Chrome trace is written by finish().
+ */
+inline void start(const std::string &path) {
+  detail::state().path = path;
+  detail::state().origin = std::chrono::steady_clock::now();
+  enabled = true;
+}
+
+// Writes the trace and prints the summary, once every thread is idle.
+inline void finish() {
+  if (!enabled) return;
+  enabled = false;
+
+  detail::State &trace = detail::state();
+  std::lock_guard<std::mutex> lock(trace.mutex);
+  const uint64_t end = detail::now();
+  const long pid = static_cast<long>(::getpid());
+
+  std::ofstream out(trace.path, std::ios::trunc);
+  if (out.fail()) std::cerr << "Error writing the trace: " << trace.path << std::endl;
+
+  struct Total {
+    uint64_t calls = 0, total = 0, max = 0;
+  };
+  std::map<std::string, Total> totals;
+  bool first = true;
+
+  out << "{\"traceEvents\": [\n";
+  for (const auto &buffer : trace.buffers) {
+    out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+        << ", \"tid\": " << buffer->thread << ", \"args\": {\"name\": \""
+        << (buffer->thread == 1 ? "main" : "worker " + std::to_string(buffer->thread - 1)) << "\"}}";
+    first = false;
+
+    for (const detail::Event &event : buffer->events) {
+      out << ",\n{\"name\": " << detail::quote(event.name) << ", \"ph\": \"X\", \"pid\": " << pid
+          << ", \"tid\": " << buffer->thread << ", \"ts\": " << event.start << ", \"dur\": " << event.duration
+          << "}";
+
+      Total &total = totals[event.name];
+      total.calls++;
+      total.total += event.duration;
+      total.max = std::max(total.max, event.duration);
+    }
+  }
+  for (const auto &[name, value] : trace.counters) {
+    out << (first ? "" : ",\n") << "{\"name\": " << detail::quote(name) << ", \"ph\": \"C\", \"pid\": " << pid
+        << ", \"tid\": 1, \"ts\": " << end << ", \"args\": {\"value\": " << value.load() << "}}";
+    first = false;
+  }
+  out << "\n]}\n";
+
+  // Slowest first. Nested scopes are counted in their parents too.
+  std::vector<std::pair<std::string, Total>> rows(totals.begin(), totals.end());
+  std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) { return a.second.total > b.second.total; });
+
+  std::fprintf(stderr, "\n%-28s %10s %12s %12s %12s\n", "scope", "calls", "total ms", "avg us", "max us");
+  for (const auto &[name, total] : rows) {
+    std::fprintf(stderr, "%-28s %10llu %12.3f %12.1f %12llu\n", name.c_str(),
+                 static_cast<unsigned long long>(total.calls), total.total / 1000.0,
+                 static_cast<double>(total.total) / static_cast<double>(total.calls),
+                 static_cast<unsigned long long>(total.max));
+  }
+  for (const auto &[name, value] : trace.counters) {
+    std::fprintf(stderr, "%-28s %10llu\n", name.c_str(), static_cast<unsigned long long>(value.load()));
+  }
+  std::fprintf(stderr, "%-28s %23.3f\n", "wall ms", end / 1000.0);
+}
+
+} // namespace Trace
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef TREEFORMAT_HPP
+#define TREEFORMAT_HPP
+
+#include "objectid.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+/*
+ * How a tree object is laid out. A tree lists the entries of one directory,
+ * sorted by name:
+ *
+ *   "tree: 2\n"
+ *   <type: 1 byte> <name length: 2 bytes, little-endian> <name> <hash: 32 bytes>
+ *   ...
+ *
+ * Names are the last component only, the path of an entry is the path of
+ * its tree followed by its name, so a tree does not depend on where the
+ * repository is. The type byte is 1 for a blob and 2 for a tree.
+ *
+ * Trees written before version 2 are text, read as well:
+ *
+ *   "tree:\n"
+ *   <absolute path> <hex hash> <blob|tree>\n
+ *   ...
+ */
+
+namespace TreeFormat {
+
+constexpr uint8_t VERSION = 2;
+constexpr std::string_view HEADER = "tree: 2\n";
+constexpr std::string_view LEGACY_HEADER = "tree:\n";
+
+enum class Type : uint8_t { Blob = 1, Tree = 2 };
+
+// The size of an entry with a name of `nameSize` bytes.
+constexpr size_t entrySize(size_t nameSize) { return 3 + nameSize + ObjectId::SIZE; }
+
+/**
+ * Appends one entry, after the header and the entries sorted before it.
+ *
+ * @param out The tree being written.
+ * @param name The name of the file or directory, without its parents.
+ */
+inline void append(std::string &out, std::string_view name, Type type, const ObjectId &id) {
+  const uint16_t size = static_cast<uint16_t>(name.size());
+
+  out += static_cast<char>(type);
+  out += static_cast<char>(size & 0xff);
+  out += static_cast<char>(size >> 8);
+  out += name;
+  out.append(reinterpret_cast<const char *>(id.data()), ObjectId::SIZE);
+}
+
+struct Entry {
+  std::string_view name; // Into the tree, valid while it is
+  ObjectId id;
+  Type type = Type::Blob;
+
+  bool isTree() const { return type == Type::Tree; }
+};
+
+/**
+ * The entries of a tree, read in place: iterating copies nothing but the
+ * hashes. A truncated or unknown entry ends the iteration.
+ *
+ *   for (const TreeFormat::Entry &entry : TreeFormat::View(content)) ...
+ */
+class View {
+public:
+  explicit View(std::string_view content) {
+    if (content.substr(0, HEADER.size()) == HEADER) {
+      m_entries = content.substr(HEADER.size());
+    } else if (content.substr(0, LEGACY_HEADER.size()) == LEGACY_HEADER) {
+      m_entries = content.substr(LEGACY_HEADER.size());
+      m_legacy = true;
+    } else {
+      m_valid = false;
+    }
+  }
+
+  // Whether the content is a tree at all.
+  bool valid() const { return m_valid; }
+
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Entry *;
+    using reference = const Entry &;
+
+    iterator() = default;
+    iterator(std::string_view entries, bool legacy) : m_rest(entries), m_legacy(legacy), m_done(false) {
+      ++*this;
+    }
+
+    const Entry &operator*() const { return m_entry; }
+    const Entry *operator->() const { return &m_entry; }
+
+    iterator &operator++() {
+      m_done = m_done || !(m_legacy ? readLine() : readEntry());
+      return *this;
+    }
+
+    bool operator==(const iterator &other) const { return m_done && other.m_done; }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  private:
+    bool readEntry() {
+      if (m_rest.size() < entrySize(0)) return false;
+
+      const auto type = static_cast<uint8_t>(m_rest[0]);
+      const size_t size = static_cast<uint8_t>(m_rest[1]) | static_cast<size_t>(static_cast<uint8_t>(m_rest[2])) << 8;
+      if (m_rest.size() < entrySize(size) || (type != 1 && type != 2)) return false;
+
+      m_entry.type = static_cast<Type>(type);
+      m_entry.name = m_rest.substr(3, size);
+      m_entry.id = ObjectId::fromDigest(reinterpret_cast<const uint8_t *>(m_rest.data()) + 3 + size);
+      m_rest.remove_prefix(entrySize(size));
+      return true;
+    }
+
+    // "<absolute path> <hex hash> <type>", the path may have spaces.
+    bool readLine() {
+      const size_t end = m_rest.find('\n');
+      const std::string_view line = m_rest.substr(0, end);
+      m_rest.remove_prefix(end == std::string_view::npos ? m_rest.size() : end + 1);
+
+      const size_t typeStart = line.rfind(' ');
+      if (typeStart == std::string_view::npos || typeStart < ObjectId::HEX_SIZE + 1) return false;
+
+      const std::string_view type = line.substr(typeStart + 1);
+      const std::string_view path = line.substr(0, typeStart - ObjectId::HEX_SIZE - 1);
+      if (!ObjectId::fromHex(line.substr(typeStart - ObjectId::HEX_SIZE, ObjectId::HEX_SIZE), m_entry.id)) {
+        return false;
+      }
+
+      m_entry.type = type == "tree" ? Type::Tree : Type::Blob;
+      m_entry.name = path.substr(path.rfind('/') + 1);
+      return type == "tree" || type == "blob";
+    }
+
+    std::string_view m_rest;
+    Entry m_entry;
+    bool m_legacy = false;
+    bool m_done = true;
+  };
+
+  iterator begin() const { return m_valid ? iterator(m_entries, m_legacy) : iterator(); }
+  iterator end() const { return iterator(); }
+
+private:
+  std::string_view m_entries;
+  bool m_legacy = false;
+  bool m_valid = true;
+};
+
+} // namespace TreeFormat
+
+#endif
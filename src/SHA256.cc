@@ -3,6 +3,12 @@
 #include <sstream>
 #include <iomanip>
 #include <cstdint>
+#include <cstdlib>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 
 SHA256::SHA256(): m_blocklen(0), m_bitlen(0) {
 	m_state[0] = 0x6a09e667;
@@ -16,16 +22,32 @@ SHA256::SHA256(): m_blocklen(0), m_bitlen(0) {
 }
 
 void SHA256::update(const uint8_t * data, size_t length) {
-	for (size_t i = 0 ; i < length ; i++) {
-		m_data[m_blocklen++] = data[i];
-		if (m_blocklen == 64) {
-			transform();
-
-			// End of the block
-			m_bitlen += 512;
-			m_blocklen = 0;
-		}
+	// Top up a partially filled block first.
+	if (m_blocklen > 0) {
+		size_t take = 64 - m_blocklen < length ? 64 - m_blocklen : length;
+		memcpy(m_data + m_blocklen, data, take);
+		m_blocklen += take;
+		data += take;
+		length -= take;
+
+		if (m_blocklen < 64) return;
+
+		transform();
+		m_bitlen += 512;
+		m_blocklen = 0;
+	}
+
+	// Whole blocks are compressed straight from the input, no copy into m_data.
+	size_t blocks = length / 64;
+	if (blocks > 0) {
+		s_compress.load(std::memory_order_relaxed)(m_state, data, blocks);
+		m_bitlen += 512 * static_cast<uint64_t>(blocks);
+		data += blocks * 64;
+		length -= blocks * 64;
 	}
+
+	memcpy(m_data, data, length);
+	m_blocklen = length;
 }
 
 void SHA256::update(const std::string &data) {
@@ -34,11 +56,14 @@ void SHA256::update(const std::string &data) {
 
 uint8_t * SHA256::digest() {
 	uint8_t * hash = new uint8_t[32];
+	digest(hash);
 
+	return hash;
+}
+
+void SHA256::digest(uint8_t * hash) {
 	pad();
 	revert(hash);
-
-	return hash;
 }
 
 uint32_t SHA256::rotr(uint32_t x, uint32_t n) {
@@ -62,45 +87,61 @@ uint32_t SHA256::sig1(uint32_t x) {
 }
 
 void SHA256::transform() {
-	uint32_t maj, xorA, ch, xorE, sum, newA, newE, m[64];
-	uint32_t state[8];
-
-	for (uint8_t i = 0, j = 0; i < 16; i++, j += 4) { // Split data in 32 bit blocks for the 16 first words
-		m[i] = (m_data[j] << 24) | (m_data[j + 1] << 16) | (m_data[j + 2] << 8) | (m_data[j + 3]);
-	}
+	s_compress.load(std::memory_order_relaxed)(m_state, m_data, 1);
+}
 
-	for (uint8_t k = 16 ; k < 64; k++) { // Remaining 48 blocks
-		m[k] = SHA256::sig1(m[k - 2]) + m[k - 7] + SHA256::sig0(m[k - 15]) + m[k - 16];
-	}
+void SHA256::rounds(uint32_t state[8], const uint32_t wk[64]) {
+	uint32_t maj, xorA, ch, xorE, sum, newA, newE;
+	uint32_t s[8];
 
 	for(uint8_t i = 0 ; i < 8 ; i++) {
-		state[i] = m_state[i];
+		s[i] = state[i];
 	}
 
 	for (uint8_t i = 0; i < 64; i++) {
-		maj   = SHA256::majority(state[0], state[1], state[2]);
-		xorA  = SHA256::rotr(state[0], 2) ^ SHA256::rotr(state[0], 13) ^ SHA256::rotr(state[0], 22);
+		maj   = SHA256::majority(s[0], s[1], s[2]);
+		xorA  = SHA256::rotr(s[0], 2) ^ SHA256::rotr(s[0], 13) ^ SHA256::rotr(s[0], 22);
 
-		ch = choose(state[4], state[5], state[6]);
+		ch = choose(s[4], s[5], s[6]);
 
-		xorE  = SHA256::rotr(state[4], 6) ^ SHA256::rotr(state[4], 11) ^ SHA256::rotr(state[4], 25);
+		xorE  = SHA256::rotr(s[4], 6) ^ SHA256::rotr(s[4], 11) ^ SHA256::rotr(s[4], 25);
 
-		sum  = m[i] + K[i] + state[7] + ch + xorE;
+		sum  = wk[i] + s[7] + ch + xorE;
 		newA = xorA + maj + sum;
-		newE = state[3] + sum;
+		newE = s[3] + sum;
 
-		state[7] = state[6];
-		state[6] = state[5];
-		state[5] = state[4];
-		state[4] = newE;
-		state[3] = state[2];
-		state[2] = state[1];
-		state[1] = state[0];
-		state[0] = newA;
+		s[7] = s[6];
+		s[6] = s[5];
+		s[5] = s[4];
+		s[4] = newE;
+		s[3] = s[2];
+		s[2] = s[1];
+		s[1] = s[0];
+		s[0] = newA;
 	}
 
 	for(uint8_t i = 0 ; i < 8 ; i++) {
-		m_state[i] += state[i];
+		state[i] += s[i];
+	}
+}
+
+void SHA256::compressScalar(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	uint32_t m[64];
+
+	for (; blocks > 0; blocks--, data += 64) {
+		for (uint8_t i = 0, j = 0; i < 16; i++, j += 4) { // Split data in 32 bit blocks for the 16 first words
+			m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
+		}
+
+		for (uint8_t k = 16 ; k < 64; k++) { // Remaining 48 blocks
+			m[k] = SHA256::sig1(m[k - 2]) + m[k - 7] + SHA256::sig0(m[k - 15]) + m[k - 16];
+		}
+
+		for (uint8_t i = 0; i < 64; i++) {
+			m[i] += K[i];
+		}
+
+		rounds(state, m);
 	}
 }
 
@@ -152,3 +193,104 @@ std::string SHA256::toString(const uint8_t * digest) {
 
 	return s.str();
 }
+
+bool SHA256::fromString(const std::string &hex, uint8_t * digest) {
+	if (hex.size() != 64) return false;
+
+	auto nibble = [](char c) -> int {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	};
+
+	for (uint8_t i = 0 ; i < 32 ; i++) {
+		int hi = nibble(hex[2 * i]), lo = nibble(hex[2 * i + 1]);
+		if (hi < 0 || lo < 0) return false;
+		digest[i] = static_cast<uint8_t>(hi << 4 | lo);
+	}
+
+	return true;
+}
+
+/*
+ * Kernel dispatch. The first compression goes through `compressDispatch`, which
+ * probes the CPU once and swaps in the chosen kernel. GID_SHA_KERNEL can be set
+ * to scalar, sse4, avx2 or shani to force a kernel.
+ */
+std::atomic<SHA256::CompressFn> SHA256::s_compress{SHA256::compressDispatch};
+std::atomic<SHA256::Kernel> SHA256::s_kernel{SHA256::Kernel::Auto};
+
+void SHA256::compressDispatch(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	if (s_kernel.load(std::memory_order_relaxed) == Kernel::Auto)
+		setKernel(Kernel::Auto);
+	s_compress.load(std::memory_order_relaxed)(state, data, blocks);
+}
+
+bool SHA256::isSupported(Kernel kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	switch (kernel) {
+	case Kernel::Auto:
+	case Kernel::Scalar:
+		return true;
+	case Kernel::SSE4:
+		return __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+	case Kernel::AVX2:
+		return __builtin_cpu_supports("avx2");
+	case Kernel::SHANI: {
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+		return (ebx & (1u << 29)) && isSupported(Kernel::SSE4);
+	}
+	}
+	return false;
+#else
+	return kernel == Kernel::Auto || kernel == Kernel::Scalar;
+#endif
+}
+
+SHA256::Kernel SHA256::detectKernel() {
+	if (const char * forced = std::getenv("GID_SHA_KERNEL")) {
+		for (Kernel k : {Kernel::Scalar, Kernel::SSE4, Kernel::AVX2, Kernel::SHANI}) {
+			if (std::string(forced) == kernelName(k) && isSupported(k)) return k;
+		}
+	}
+
+	for (Kernel k : {Kernel::SHANI, Kernel::AVX2, Kernel::SSE4}) {
+		if (isSupported(k)) return k;
+	}
+	return Kernel::Scalar;
+}
+
+SHA256::CompressFn SHA256::compressFor(Kernel kernel) {
+	switch (kernel) {
+	case Kernel::SSE4:  return compressSSE4;
+	case Kernel::AVX2:  return compressAVX2;
+	case Kernel::SHANI: return compressSHANI;
+	default:            return compressScalar;
+	}
+}
+
+bool SHA256::setKernel(Kernel kernel) {
+	if (!isSupported(kernel)) return false;
+	if (kernel == Kernel::Auto) kernel = detectKernel();
+
+	s_compress.store(compressFor(kernel), std::memory_order_relaxed);
+	s_kernel.store(kernel, std::memory_order_relaxed);
+	return true;
+}
+
+SHA256::Kernel SHA256::activeKernel() {
+	return s_kernel.load(std::memory_order_relaxed);
+}
+
+const char * SHA256::kernelName(Kernel kernel) {
+	switch (kernel) {
+	case Kernel::Scalar: return "scalar";
+	case Kernel::SSE4:   return "sse4";
+	case Kernel::AVX2:   return "avx2";
+	case Kernel::SHANI:  return "shani";
+	default:             return "auto";
+	}
+}
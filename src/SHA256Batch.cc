@@ -0,0 +1,248 @@
+#include "../include/SHA256Batch.hpp"
+#include "../include/SHA256.hpp"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+/*
+ * The lane kernels are written once with GCC vector extensions and instantiated
+ * for 4, 8 and 16 lanes. They are always_inline so each instantiation is compiled
+ * with the ISA of the target-attributed wrapper that calls it; nothing passes or
+ * returns a vector by value, which keeps the ABI of the default target intact.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GID_TARGET(t) __attribute__((target(t)))
+#else
+#define GID_TARGET(t)
+#endif
+
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
+#define CHOOSE(e, f, g) (((e) & (f)) ^ (~(e) & (g)))
+#define MAJ(a, b, c)    (((a) & ((b) | (c))) | ((b) & (c)))
+#define BSIG0(x)        (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BSIG1(x)        (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SSIG0(x)        (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x)        (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+namespace {
+
+typedef uint32_t VecX4  __attribute__((vector_size(16)));
+typedef uint32_t VecX8  __attribute__((vector_size(32)));
+typedef uint32_t VecX16 __attribute__((vector_size(64)));
+
+constexpr uint32_t IV[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const uint8_t ZERO_BLOCK[64] = {};
+
+inline uint32_t loadBE32(const uint8_t * p) {
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// One block per lane. `state` holds A..H, each vector spans all N lanes.
+template <typename V, size_t N>
+[[gnu::always_inline]] inline void compressLanes(V state[8], const uint8_t * const blocks[N],
+                                                 const uint32_t * k) {
+	V w[16];
+
+	for (size_t t = 0; t < 16; t++) {
+		for (size_t lane = 0; lane < N; lane++) {
+			w[t][lane] = loadBE32(blocks[lane] + 4 * t);
+		}
+	}
+
+	V a = state[0], b = state[1], c = state[2], d = state[3];
+	V e = state[4], f = state[5], g = state[6], h = state[7];
+
+	for (size_t t = 0; t < 64; t++) {
+		if (t >= 16) {
+			V w2 = w[(t - 2) & 15], w15 = w[(t - 15) & 15];
+			w[t & 15] += SSIG1(w2) + w[(t - 7) & 15] + SSIG0(w15);
+		}
+
+		V sum = h + BSIG1(e) + CHOOSE(e, f, g) + k[t] + w[t & 15];
+		V newA = BSIG0(a) + MAJ(a, b, c) + sum;
+
+		h = g; g = f; f = e; e = d + sum;
+		d = c; c = b; b = a; a = newA;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/*
+ * Hashes messages[order[0..count)] N at a time. Full blocks are read in place,
+ * the padded tail of each message (1 or 2 blocks) is built on the stack. Lanes
+ * that already finished keep compressing a zero block, their digest has been
+ * taken out at that point.
+ */
+template <typename V, size_t N>
+[[gnu::always_inline]] inline void hashGroups(const std::vector<std::string_view> &messages,
+                                              const size_t * order, size_t count,
+                                              SHA256Batch::Digest * out, const uint32_t * k) {
+	for (size_t group = 0; group < count; group += N) {
+		const size_t used = std::min(N, count - group);
+
+		uint8_t tail[N][128];
+		const uint8_t * data[N];
+		size_t full[N], total[N], maxTotal = 0;
+
+		for (size_t lane = 0; lane < N; lane++) {
+			if (lane >= used) {
+				data[lane] = ZERO_BLOCK;
+				full[lane] = total[lane] = 0;
+				continue;
+			}
+
+			const std::string_view message = messages[order[group + lane]];
+			const size_t rem = message.size() % 64;
+			const size_t tailBlocks = rem < 56 ? 1 : 2;
+			const uint64_t bits = static_cast<uint64_t>(message.size()) * 8;
+
+			data[lane] = reinterpret_cast<const uint8_t *>(message.data());
+			full[lane] = message.size() / 64;
+			total[lane] = full[lane] + tailBlocks;
+			maxTotal = std::max(maxTotal, total[lane]);
+
+			uint8_t * t = tail[lane];
+			std::memcpy(t, message.data() + full[lane] * 64, rem);
+			t[rem] = 0x80;
+			std::memset(t + rem + 1, 0, tailBlocks * 64 - rem - 1);
+			for (size_t i = 0; i < 8; i++) {
+				t[tailBlocks * 64 - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+			}
+		}
+
+		V state[8];
+		for (size_t i = 0; i < 8; i++) {
+			for (size_t lane = 0; lane < N; lane++) state[i][lane] = IV[i];
+		}
+
+		for (size_t block = 0; block < maxTotal; block++) {
+			const uint8_t * blocks[N];
+
+			for (size_t lane = 0; lane < N; lane++) {
+				if (block < full[lane])       blocks[lane] = data[lane] + 64 * block;
+				else if (block < total[lane]) blocks[lane] = tail[lane] + 64 * (block - full[lane]);
+				else                          blocks[lane] = ZERO_BLOCK;
+			}
+
+			compressLanes<V, N>(state, blocks, k);
+
+			for (size_t lane = 0; lane < used; lane++) {
+				if (block + 1 != total[lane]) continue;
+
+				SHA256Batch::Digest &digest = out[order[group + lane]];
+				for (size_t i = 0; i < 8; i++) {
+					const uint32_t word = state[i][lane];
+					digest[4 * i]     = static_cast<uint8_t>(word >> 24);
+					digest[4 * i + 1] = static_cast<uint8_t>(word >> 16);
+					digest[4 * i + 2] = static_cast<uint8_t>(word >> 8);
+					digest[4 * i + 3] = static_cast<uint8_t>(word);
+				}
+			}
+		}
+	}
+}
+
+} // namespace
+
+std::atomic<SHA256Batch::Width> SHA256Batch::s_width{SHA256Batch::Width::Auto};
+
+void SHA256Batch::hashX4(const std::vector<std::string_view> &messages, const size_t * order,
+                         size_t count, Digest * out) {
+	hashGroups<VecX4, 4>(messages, order, count, out, SHA256::K.data());
+}
+
+GID_TARGET("avx2")
+void SHA256Batch::hashX8(const std::vector<std::string_view> &messages, const size_t * order,
+                         size_t count, Digest * out) {
+	hashGroups<VecX8, 8>(messages, order, count, out, SHA256::K.data());
+}
+
+GID_TARGET("avx512f")
+void SHA256Batch::hashX16(const std::vector<std::string_view> &messages, const size_t * order,
+                          size_t count, Digest * out) {
+	hashGroups<VecX16, 16>(messages, order, count, out, SHA256::K.data());
+}
+
+bool SHA256Batch::isSupported(Width width) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	switch (width) {
+	case Width::Auto:
+	case Width::X4:
+		return true;
+	case Width::X8:
+		return __builtin_cpu_supports("avx2");
+	case Width::X16:
+		return __builtin_cpu_supports("avx512f");
+	}
+	return false;
+#else
+	return width == Width::Auto || width == Width::X4;
+#endif
+}
+
+SHA256Batch::Width SHA256Batch::detectWidth() {
+	for (Width w : {Width::X16, Width::X8}) {
+		if (isSupported(w)) return w;
+	}
+	return Width::X4;
+}
+
+bool SHA256Batch::setWidth(Width width) {
+	if (!isSupported(width)) return false;
+	s_width.store(width == Width::Auto ? detectWidth() : width, std::memory_order_relaxed);
+	return true;
+}
+
+size_t SHA256Batch::lanes() {
+	if (s_width.load(std::memory_order_relaxed) == Width::Auto) setWidth(Width::Auto);
+
+	switch (s_width.load(std::memory_order_relaxed)) {
+	case Width::X16: return 16;
+	case Width::X8:  return 8;
+	default:         return 4;
+	}
+}
+
+std::vector<SHA256Batch::Digest> SHA256Batch::hash(const std::vector<std::string_view> &messages, bool lanesOnly) {
+	std::vector<Digest> digests(messages.size());
+	const size_t width = lanes();
+
+	// Longest first, so the messages sharing a group have similar block counts.
+	std::vector<size_t> order(messages.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&messages](size_t a, size_t b) {
+		return messages[a].size() > messages[b].size();
+	});
+
+	// Whatever does not fill a group of lanes goes through the single buffer path,
+	// which is faster than hashing mostly idle lanes. SHA-NI beats anything
+	// narrower than 16 lanes, so then everything goes that way.
+	if (SHA256::activeKernel() == SHA256::Kernel::Auto) SHA256::setKernel(SHA256::Kernel::Auto);
+	const bool singleFaster = width < 16 && SHA256::activeKernel() == SHA256::Kernel::SHANI;
+	const size_t grouped = lanesOnly     ? order.size()
+	                       : singleFaster ? 0
+	                                      : order.size() - order.size() % width;
+
+	switch (width) {
+	case 16: hashX16(messages, order.data(), grouped, digests.data()); break;
+	case 8:  hashX8(messages, order.data(), grouped, digests.data()); break;
+	default: hashX4(messages, order.data(), grouped, digests.data()); break;
+	}
+
+	for (size_t i = grouped; i < order.size(); i++) {
+		const std::string_view message = messages[order[i]];
+		SHA256 sha;
+		sha.update(reinterpret_cast<const uint8_t *>(message.data()), message.size());
+		sha.digest(digests[order[i]].data());
+	}
+
+	return digests;
+}
@@ -0,0 +1,192 @@
+#include "../include/SHA256.hpp"
+#include <cstdint>
+
+/*
+ * x86 compression kernels for SHA256. Each one is compiled for its own target
+ * so the rest of the program keeps the default ISA, SHA256::setKernel only
+ * installs a kernel after cpuid says the instructions are there.
+ *
+ *  - SSE4:  message schedule 4 words at a time, rounds stay scalar.
+ *  - AVX2:  same schedule, but for two blocks at once (one per 128 bit lane).
+ *  - SHANI: the whole block through the sha256rnds2/msg1/msg2 instructions.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define GID_TARGET(t) __attribute__((target(t)))
+
+namespace {
+
+// Per 32 bit lane byte swap, SHA256 words are big endian.
+GID_TARGET("ssse3") inline __m128i byteSwapMask() {
+	return _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+}
+
+GID_TARGET("sse4.1") inline __m128i rotr128(__m128i x, int n) {
+	return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n));
+}
+
+GID_TARGET("sse4.1") inline __m128i sig0x4(__m128i x) {
+	return _mm_xor_si128(_mm_xor_si128(rotr128(x, 7), rotr128(x, 18)), _mm_srli_epi32(x, 3));
+}
+
+GID_TARGET("sse4.1") inline __m128i sig1x4(__m128i x) {
+	return _mm_xor_si128(_mm_xor_si128(rotr128(x, 17), rotr128(x, 19)), _mm_srli_epi32(x, 10));
+}
+
+/*
+ * Next 4 schedule words from the previous 16 (w0 oldest). W[t] needs W[t-2], so
+ * the upper two words are finished after the lower two are known.
+ */
+GID_TARGET("sse4.1") inline __m128i schedule4(__m128i w0, __m128i w1, __m128i w2, __m128i w3) {
+	__m128i s = _mm_add_epi32(w0, sig0x4(_mm_alignr_epi8(w1, w0, 4)));
+	s = _mm_add_epi32(s, _mm_alignr_epi8(w3, w2, 4));
+	s = _mm_add_epi32(s, sig1x4(_mm_srli_si128(w3, 8)));
+	return _mm_add_epi32(s, _mm_slli_si128(sig1x4(s), 8));
+}
+
+GID_TARGET("avx2") inline __m256i rotr256(__m256i x, int n) {
+	return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+GID_TARGET("avx2") inline __m256i sig0x8(__m256i x) {
+	return _mm256_xor_si256(_mm256_xor_si256(rotr256(x, 7), rotr256(x, 18)), _mm256_srli_epi32(x, 3));
+}
+
+GID_TARGET("avx2") inline __m256i sig1x8(__m256i x) {
+	return _mm256_xor_si256(_mm256_xor_si256(rotr256(x, 17), rotr256(x, 19)), _mm256_srli_epi32(x, 10));
+}
+
+// Same as schedule4, the byte shifts and alignr work per 128 bit lane.
+GID_TARGET("avx2") inline __m256i schedule8(__m256i w0, __m256i w1, __m256i w2, __m256i w3) {
+	__m256i s = _mm256_add_epi32(w0, sig0x8(_mm256_alignr_epi8(w1, w0, 4)));
+	s = _mm256_add_epi32(s, _mm256_alignr_epi8(w3, w2, 4));
+	s = _mm256_add_epi32(s, sig1x8(_mm256_srli_si256(w3, 8)));
+	return _mm256_add_epi32(s, _mm256_slli_si256(sig1x8(s), 8));
+}
+
+} // namespace
+
+GID_TARGET("sse4.1,ssse3")
+void SHA256::compressSSE4(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	alignas(16) uint32_t wk[64];
+	const __m128i mask = byteSwapMask();
+
+	for (; blocks > 0; blocks--, data += 64) {
+		__m128i w[16];
+
+		for (int i = 0; i < 4; i++) {
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i)), mask);
+		}
+		for (int i = 4; i < 16; i++) {
+			w[i] = schedule4(w[i - 4], w[i - 3], w[i - 2], w[i - 1]);
+		}
+		for (int i = 0; i < 16; i++) {
+			__m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i *>(K.data() + 4 * i));
+			_mm_store_si128(reinterpret_cast<__m128i *>(wk + 4 * i), _mm_add_epi32(w[i], k));
+		}
+
+		rounds(state, wk);
+	}
+}
+
+GID_TARGET("avx2")
+void SHA256::compressAVX2(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	alignas(32) uint32_t wk0[64];
+	alignas(32) uint32_t wk1[64];
+	const __m256i mask = _mm256_broadcastsi128_si256(byteSwapMask());
+
+	for (; blocks >= 2; blocks -= 2, data += 128) {
+		__m256i w[16];
+
+		// Low lane holds the first block, high lane the second.
+		for (int i = 0; i < 4; i++) {
+			__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i));
+			__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 64 + 16 * i));
+			w[i] = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), mask);
+		}
+		for (int i = 4; i < 16; i++) {
+			w[i] = schedule8(w[i - 4], w[i - 3], w[i - 2], w[i - 1]);
+		}
+		for (int i = 0; i < 16; i++) {
+			__m256i k = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(K.data() + 4 * i)));
+			__m256i v = _mm256_add_epi32(w[i], k);
+			_mm_store_si128(reinterpret_cast<__m128i *>(wk0 + 4 * i), _mm256_castsi256_si128(v));
+			_mm_store_si128(reinterpret_cast<__m128i *>(wk1 + 4 * i), _mm256_extracti128_si256(v, 1));
+		}
+
+		rounds(state, wk0);
+		rounds(state, wk1);
+	}
+
+	if (blocks > 0) {
+		compressSSE4(state, data, blocks);
+	}
+}
+
+GID_TARGET("sha,sse4.1,ssse3")
+void SHA256::compressSHANI(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	const __m128i mask = byteSwapMask();
+
+	// Rearrange A..H into the ABEF / CDGH halves sha256rnds2 works on.
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0])), 0xB1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4])), 0x1B);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; blocks > 0; blocks--, data += 64) {
+		const __m128i abefSave = state0;
+		const __m128i cdghSave = state1;
+		__m128i w[4];
+
+		for (int i = 0; i < 4; i++) {
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i)), mask);
+		}
+
+#pragma GCC unroll 16
+		for (int i = 0; i < 16; i++) {
+			__m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i *>(K.data() + 4 * i));
+			__m128i msg = _mm_add_epi32(w[i & 3], k);
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+
+			// Words i+4 replace words i, which the rounds above were the last user of.
+			if (i < 12) {
+				__m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+				next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, abefSave);
+		state1 = _mm_add_epi32(state1, cdghSave);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), state0);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), state1);
+}
+
+#else
+
+// No SIMD kernels on this architecture, isSupported() never selects them.
+void SHA256::compressSSE4(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	compressScalar(state, data, blocks);
+}
+
+void SHA256::compressAVX2(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	compressScalar(state, data, blocks);
+}
+
+void SHA256::compressSHANI(uint32_t state[8], const uint8_t * data, size_t blocks) {
+	compressScalar(state, data, blocks);
+}
+
+#endif
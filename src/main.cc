@@ -1,30 +1,122 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
 #include <iostream>
 #include <ostream>
+#include <string>
 #include <typeinfo> 
+#include <vector>
 #include "../include/commands.hpp"
 #include "../include/parser.hpp"
 #include "../include/global.hpp"
-
-// TODO: Write Logs in a Log file Continously.
-// TODO: Make a prototype To keep track of a repo and report if a change has occured.
-
+#include "../include/trace.hpp"
 
 int main(int argc, char const *argv[])
 {    
   CommandLineParser parser;
 
+  // --trace=<file> or GID_TRACE=<file>: write where the time went, see Trace.
+  // The option is taken out so the commands never see it.
+  std::vector<const char *> args(argv, argv + argc);
+  std::string tracePath = std::getenv("GID_TRACE") ? std::getenv("GID_TRACE") : "";
+  for (auto it = args.begin() + 1; it != args.end();) {
+    if (std::string(*it).rfind("--trace=", 0) != 0) {
+      ++it;
+      continue;
+    }
+    tracePath = *it + 8;
+    it = args.erase(it);
+  }
+  argc = static_cast<int>(args.size());
+  argv = args.data();
+  if (!tracePath.empty()) Trace::start(tracePath);
+
+  // -j N or -jN: how many threads build trees, see Scheduler.
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg.rfind("-j", 0) != 0) continue;
+
+    const std::string count = arg.size() > 2 ? arg.substr(2) : (i + 1 < argc ? argv[i + 1] : "");
+    const long threads = std::atol(count.c_str());
+    if (threads > 0) Scheduler::setThreads(static_cast<size_t>(threads));
+  }
+
   CommandLineParser::Option initOption ("init", "Initialize the Repository.", initCommand);
   CommandLineParser::Option addOption ("add", "Adds changes to the stage aka. index file.", addCommand);
   CommandLineParser::Option commitOption ("commit", "Commit the changes inside the index file.", commitCommand);
-  CommandLineParser::Option logOption ("log", "Show the Log of the Commits", logCommand);
+  CommandLineParser::Option logOption ("log", "Show the Log of the Commits", [argv, argc]() {
+    size_t limit = 0;
+    int64_t since = INT64_MIN, until = INT64_MAX;
+
+    for (int i = 2; i < argc; i++) {
+      const std::string arg = argv[i];
+      const bool hasValue = i + 1 < argc;
+
+      if (arg == "-n" && hasValue) {
+        limit = static_cast<size_t>(std::max(0L, std::atol(argv[++i])));
+      } else if ((arg == "--since" || arg == "--until") && hasValue) {
+        if (!CommitGraph::parseDate(argv[++i], arg == "--since" ? since : until)) {
+          std::cout << "Dates are written as YYYY-MM-DD, \"YYYY-MM-DD HH:MM:SS\" or @<seconds>." << std::endl;
+          return;
+        }
+      } else {
+        std::cout << "Usage: <program_name> log [-n <count>] [--since <date>] [--until <date>]" << std::endl;
+        return;
+      }
+    }
+
+    logCommand(limit, since, until);
+  });
+  CommandLineParser::Option repackOption ("repack", "Move the loose objects into a pack.", repackCommand);
 
   CommandLineParser::Option retrieveOption ("retrieve", "Retrieve a specific commit.", [argv, argc]() {
-    if (argc != 3) {
-        std::cout << "Usage: <program_name> retrieve <commit_hash>" << std::endl;
+    std::vector<std::string> commits;
+    for (int i = 2; i < argc; i++) {
+      const std::string arg = argv[i];
+      Checkout::Mode mode;
+
+      if (arg == "-j") i++; // The thread count, read above.
+      else if (arg.rfind("--", 0) == 0 && Checkout::modeFromName(arg.substr(2), mode)) Checkout::setMode(mode);
+      else if (arg.rfind("-j", 0) != 0) commits.push_back(arg);
+    }
+
+    if (commits.size() != 1) {
+        std::cout << "Usage: <program_name> retrieve [-j <threads>] [--reflink | --hardlink | --copy] <commit_hash>" << std::endl;
+        return;
+    }
+
+    retrieveCommand(commits[0]); 
+  });
+
+  CommandLineParser::Option diffOption ("diff", "Show the changes against a commit, or between two commits.", [argv, argc]() {
+    std::vector<std::string> commits;
+    Diff::Algorithm algorithm = Diff::Algorithm::Histogram;
+
+    for (int i = 2; i < argc; i++) {
+      const std::string arg = argv[i];
+      if (arg == "--myers") algorithm = Diff::Algorithm::Myers;
+      else if (arg == "--histogram") algorithm = Diff::Algorithm::Histogram;
+      else commits.push_back(arg);
+    }
+
+    if (commits.size() > 2) {
+        std::cout << "Usage: <program_name> diff [--myers | --histogram] [commit_hash] [commit_hash]" << std::endl;
         return;
     }
 
-    retrieveCommand(argv[2]); 
+    diffCommand(commits, algorithm);
+  });
+
+  CommandLineParser::Option monitorOption ("monitor", "Watch the worktree so add only looks at what changed.", [argv, argc]() {
+    const std::string arg = argc > 2 ? argv[2] : "";
+
+    if (argc == 2 || (argc == 3 && arg == "--foreground")) {
+      Monitor::start(argc == 3);
+    } else if (argc == 3 && arg == "stop") {
+      Monitor::stop();
+    } else {
+      std::cout << "Usage: <program_name> monitor [--foreground | stop]" << std::endl;
+    }
   });
 
   CommandLineParser::Option helpOption ("--help", "Get help.", []() {
@@ -32,8 +124,13 @@ int main(int argc, char const *argv[])
                 << "1. with `./gid init` command Initialize a Repository.\n"
                 << "2. with `./gid add` command add changes if you got any.\n"
                 << "3. with `./gid commit` command push the changes to the repo.\n"
-                << "4. with `./gid log` command see the Commits you made.\n"
-                << "5. retrieve the commit by Using `./gid retrieve <commit_hash>`." 
+                << "4. with `./gid log [-n <count>] [--since <date>] [--until <date>]` command see the Commits you made.\n"
+                << "5. retrieve the commit by Using `./gid retrieve [-j <threads>] [--reflink | --hardlink | --copy] <commit_hash>`.\n"
+                << "6. with `./gid repack` command move the loose objects into a pack.\n"
+                << "7. with `./gid diff [commit_hash] [commit_hash]` see what changed.\n"
+                << "8. with `./gid monitor` watch the worktree so `add` only looks at what changed, `./gid monitor stop` stops it.\n"
+                << "Any command takes `--trace=<file>` (or GID_TRACE) to write a Chrome trace of where the time went.\n"
+                << "init, commit and retrieve take `-j <threads>` (or GID_THREADS) to hash or write files on several threads." 
                 << std::endl;
   });
  
@@ -42,6 +139,9 @@ int main(int argc, char const *argv[])
   parser.add_custom_option(commitOption);
   parser.add_custom_option(logOption);
   parser.add_custom_option(retrieveOption);
+  parser.add_custom_option(repackOption);
+  parser.add_custom_option(diffOption);
+  parser.add_custom_option(monitorOption);
   parser.add_custom_option(helpOption);
 
   if (argc == 1) {
@@ -49,6 +149,8 @@ int main(int argc, char const *argv[])
   }
 
   parser.parse(argc, argv);
+  Paths::release();
+  Trace::finish();
   return 0;
 }
 
@@ -0,0 +1,53 @@
+#!/bin/bash
+# A commit records the staged changes only: edits made after add, new files
+# never added and files removed without add stay out of it, both in a
+# directory with nothing staged and in one rebuilt for a staged change. A
+# directory replaced by a file is committed as the file.
+#
+#   bash test/commit_test.sh ./gid
+
+GID=$(realpath "$1")
+W=$(mktemp -d)
+trap 'rm -rf "$W"' EXIT
+mkdir -p "$W/proj/clean" "$W/proj/rebuilt" && cd "$W/proj" || exit 1
+
+for dir in clean rebuilt; do
+  echo old > $dir/edited.txt
+  echo old > $dir/removed.txt
+done
+echo old > rebuilt/staged.txt
+mkdir rebuilt/shape && echo old > rebuilt/shape/inner.txt
+"$GID" init >/dev/null
+
+echo new > rebuilt/staged.txt
+rm -r rebuilt/shape && echo file > rebuilt/shape
+"$GID" add >/dev/null
+
+for dir in clean rebuilt; do
+  echo unstaged > $dir/edited.txt
+  echo untracked > $dir/untracked.txt
+  rm $dir/removed.txt
+done
+"$GID" commit >/dev/null
+
+last=$("$GID" log | awk '/Commit Hash/ {hash = $4} END {print hash}')
+"$GID" retrieve "$last" >/dev/null 2>&1
+
+failed=0
+expect() {
+  if [ "$(cat "../repo/$1" 2>/dev/null)" != "$2" ]; then
+    echo "commit  FAILED, $1 should be '$2' in the commit, is '$(cat "../repo/$1" 2>/dev/null)'" >&2
+    failed=1
+  fi
+}
+
+expect rebuilt/staged.txt new
+expect rebuilt/shape file
+for dir in clean rebuilt; do
+  expect $dir/edited.txt old
+  expect $dir/removed.txt old
+  expect $dir/untracked.txt ""
+done
+
+[ $failed = 0 ] || exit 1
+echo "commit  ok"
@@ -0,0 +1,119 @@
+// Round trip test for the binary deltas: apply(base, create(base, target))
+// must give the target back, for unrelated random inputs and for targets made
+// from the base by inserts, deletes, replacements and moved blocks, with the
+// edges that bypass the matcher (empty and shorter than a block) included.
+// An edited target must also reuse enough of the base to be stored as a delta.
+//
+//   make test
+
+#include "delta.hpp"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937_64 rng(1);
+
+static std::string randomBytes(size_t size, int alphabet = 256) {
+  std::string bytes(size, '\0');
+  for (char &c : bytes) c = static_cast<char>(rng() % alphabet);
+  return bytes;
+}
+
+// A few random edits of the base, each a span of up to 200 bytes.
+static std::string edit(std::string text, int edits) {
+  for (int i = 0; i < edits; i++) {
+    const size_t at = text.empty() ? 0 : rng() % text.size();
+    const size_t length = std::min<size_t>(rng() % 200, text.size() - at);
+
+    switch (rng() % 4) {
+    case 0:
+      text.insert(at, randomBytes(rng() % 200));
+      break;
+    case 1:
+      text.erase(at, length);
+      break;
+    case 2:
+      text.replace(at, length, randomBytes(length));
+      break;
+    default: { // Move the span to the end
+      const std::string moved = text.substr(at, length);
+      text.erase(at, length);
+      text += moved;
+    }
+    }
+  }
+  return text;
+}
+
+static bool roundTrip(const std::string &base, const std::string &target, size_t *deltaSize = nullptr) {
+  std::string delta;
+  Delta::create(base, target, delta);
+  if (deltaSize) *deltaSize = delta.size();
+
+  std::string rebuilt(target.size(), '\0');
+  return Delta::apply(base, delta, rebuilt.data(), rebuilt.size()) && rebuilt == target;
+}
+
+int main() {
+  int failures = 0;
+  auto report = [&failures](const char *name, int caseFailures) {
+    std::printf("%-7s %s\n", name, caseFailures ? "FAILED" : "ok");
+    failures += caseFailures;
+  };
+
+  int edgeFailures = 0;
+  const std::string block(Delta::BLOCK, 'x');
+  const std::vector<std::pair<std::string, std::string>> edges = {
+      {"", ""},
+      {"", "target"},
+      {"base", ""},
+      {block.substr(1), block},
+      {block, block.substr(1)},
+      {block, block},
+      {std::string(5000, 'a'), std::string(7000, 'a')},
+      {std::string(7000, 'a'), std::string(5000, 'a')},
+  };
+  for (const auto &[base, target] : edges) {
+    if (!roundTrip(base, target)) {
+      std::fprintf(stderr, "edges: %zu byte target from a %zu byte base not rebuilt\n", target.size(),
+                   base.size());
+      edgeFailures++;
+    }
+  }
+  report("edges", edgeFailures);
+
+  // Unrelated inputs, over a full and a two letter alphabet so blocks of the
+  // base keep turning up in the target by chance.
+  int randomFailures = 0;
+  for (int i = 0; i < 400; i++) {
+    const int alphabet = i % 2 ? 256 : 2;
+    const std::string base = randomBytes(rng() % 5000, alphabet), target = randomBytes(rng() % 5000, alphabet);
+    if (!roundTrip(base, target)) {
+      std::fprintf(stderr, "random: %zu byte target from a %zu byte base not rebuilt\n", target.size(),
+                   base.size());
+      randomFailures++;
+    }
+  }
+  report("random", randomFailures);
+
+  int editedFailures = 0;
+  for (int i = 0; i < 400; i++) {
+    const std::string base = randomBytes(16384 + rng() % 50000, i % 3 ? 256 : 4);
+    const std::string target = edit(base, 1 + static_cast<int>(rng() % 8));
+
+    size_t deltaSize;
+    if (!roundTrip(base, target, &deltaSize)) {
+      std::fprintf(stderr, "edited: %zu byte target from a %zu byte base not rebuilt\n", target.size(),
+                   base.size());
+      editedFailures++;
+    } else if (deltaSize > target.size() / 2) {
+      std::fprintf(stderr, "edited: %zu byte delta for a %zu byte target, the base is not reused\n", deltaSize,
+                   target.size());
+      editedFailures++;
+    }
+  }
+  report("edited", editedFailures);
+
+  return failures ? 1 : 0;
+}
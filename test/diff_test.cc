@@ -0,0 +1,141 @@
+// Round trip test for the line diffs: with both Myers and histogram, the
+// changes between two texts must be in order, in range, leave only equal lines
+// between them and rebuild the new text from the old one. Covered are empty
+// texts, a missing newline at the end, binary content and random texts with
+// many repeated lines, edited and unrelated.
+//
+//   make test
+
+#include "diff.hpp"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937_64 rng(1);
+
+// Lines drawn from a small set, so equal lines keep turning up in both texts.
+static std::string randomText(size_t lines, size_t distinct) {
+  std::string text;
+  for (size_t i = 0; i < lines; i++) text += "line " + std::to_string(rng() % distinct) + "\n";
+  return text;
+}
+
+static std::string edit(const std::vector<std::string_view> &lines) {
+  std::string text;
+  for (std::string_view line : lines) {
+    switch (rng() % 10) {
+    case 0: // Dropped
+      break;
+    case 1:
+      text += "inserted " + std::to_string(rng() % 4) + "\n";
+      text += line;
+      break;
+    case 2:
+      text += "replaced\n";
+      break;
+    default:
+      text += line;
+    }
+  }
+  return text;
+}
+
+/**
+ * Applies the changes to the old lines.
+ *
+ * @return false if a change is out of order or out of range, or if a line
+ * left between two changes differs in the two texts.
+ */
+static bool rebuild(const std::vector<std::string_view> &oldLines, const std::vector<std::string_view> &newLines,
+                    const std::vector<Diff::Change> &changes, std::string &out) {
+  size_t oldPos = 0, newPos = 0;
+
+  auto keep = [&](size_t oldEnd, size_t newEnd) {
+    if (oldEnd - oldPos != newEnd - newPos) return false;
+    for (; oldPos < oldEnd; oldPos++, newPos++) {
+      if (oldLines[oldPos] != newLines[newPos]) return false;
+      out += oldLines[oldPos];
+    }
+    return true;
+  };
+
+  for (const Diff::Change &change : changes) {
+    if (change.oldStart < oldPos || change.newStart < newPos || change.oldCount + change.newCount == 0 ||
+        change.oldStart + change.oldCount > oldLines.size() || change.newStart + change.newCount > newLines.size())
+      return false;
+    if (!keep(change.oldStart, change.newStart)) return false;
+
+    for (size_t i = 0; i < change.newCount; i++) out += newLines[change.newStart + i];
+    oldPos += change.oldCount;
+    newPos += change.newCount;
+  }
+
+  return keep(oldLines.size(), newLines.size());
+}
+
+static int check(const char *name, const std::string &oldText, const std::string &newText) {
+  const std::vector<std::string_view> oldLines = Diff::splitLines(oldText), newLines = Diff::splitLines(newText);
+  int failures = 0;
+
+  for (Diff::Algorithm algorithm : {Diff::Algorithm::Myers, Diff::Algorithm::Histogram}) {
+    std::string rebuilt;
+    if (!rebuild(oldLines, newLines, Diff::diffLines(oldLines, newLines, algorithm), rebuilt) ||
+        rebuilt != newText) {
+      std::fprintf(stderr, "%s: %s changes from %zu to %zu lines do not rebuild the new text\n", name,
+                   algorithm == Diff::Algorithm::Myers ? "Myers" : "histogram", oldLines.size(), newLines.size());
+      failures++;
+    }
+  }
+
+  return failures;
+}
+
+int main() {
+  int failures = 0;
+  auto report = [&failures](const char *name, int caseFailures) {
+    std::printf("%-7s %s\n", name, caseFailures ? "FAILED" : "ok");
+    failures += caseFailures;
+  };
+
+  int edgeFailures = 0;
+  edgeFailures += check("edges", "", "");
+  edgeFailures += check("edges", "", "a\nb\n");
+  edgeFailures += check("edges", "a\nb\n", "");
+  edgeFailures += check("edges", "a\nb\n", "a\nb\n");
+  edgeFailures += check("edges", "a\nb", "a\nb\n");
+  edgeFailures += check("edges", "a\nb\n", "a\nb");
+  edgeFailures += check("edges", "a\nb", "a\nc");
+  edgeFailures += check("edges", "\n\n\n", "\n\n");
+  report("edges", edgeFailures);
+
+  // Zero bytes and lone carriage returns, diffed like any other line.
+  int binaryFailures = 0;
+  std::string binary(3000, '\0');
+  for (char &c : binary) c = static_cast<char>(rng() % 8 == 0 ? '\n' : rng() % 256);
+  if (!Diff::isBinary(binary) || Diff::isBinary(randomText(100, 10))) {
+    std::fprintf(stderr, "binary: a text is not told apart from binary content\n");
+    binaryFailures++;
+  }
+  std::string edited = binary;
+  edited.replace(1000, 200, std::string(300, '\0'));
+  edited.insert(2000, "\r\n\r");
+  binaryFailures += check("binary", binary, edited);
+  binaryFailures += check("binary", binary, randomText(50, 5));
+  report("binary", binaryFailures);
+
+  int editedFailures = 0;
+  for (int i = 0; i < 300; i++) {
+    const std::string oldText = randomText(rng() % 400, 1 + rng() % 30);
+    editedFailures += check("edited", oldText, edit(Diff::splitLines(oldText)));
+  }
+  report("edited", editedFailures);
+
+  int randomFailures = 0;
+  for (int i = 0; i < 300; i++) {
+    randomFailures += check("random", randomText(rng() % 300, 1 + rng() % 20), randomText(rng() % 300, 1 + rng() % 20));
+  }
+  report("random", randomFailures);
+
+  return failures ? 1 : 0;
+}
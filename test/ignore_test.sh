@@ -0,0 +1,27 @@
+#!/bin/bash
+# A committed file that .gidignore lists afterwards leaves the next commit,
+# the cached trees above it must not bring it back.
+#
+#   bash test/ignore_test.sh ./gid
+
+GID=$(realpath "$1")
+W=$(mktemp -d)
+trap 'rm -rf "$W"' EXIT
+mkdir -p "$W/proj/sub/deep" && cd "$W/proj" || exit 1
+
+echo data > sub/deep/bin.dat
+echo text > sub/deep/notes.txt
+"$GID" init >/dev/null
+
+echo '*.dat' > .gidignore
+"$GID" add >/dev/null
+"$GID" commit >/dev/null
+
+last=$("$GID" log | awk '/Commit Hash/ {hash = $4} END {print hash}')
+"$GID" retrieve "$last" >/dev/null 2>&1
+
+if [ -e ../repo/sub/deep/bin.dat ] || [ ! -e ../repo/sub/deep/notes.txt ]; then
+  echo "ignore  FAILED, the ignored file is still committed" >&2
+  exit 1
+fi
+echo "ignore  ok"
@@ -0,0 +1,55 @@
+#!/bin/bash
+# Retrieving commit after commit into the same directory only applies the
+# differences, and must still end with exactly the files of the commit: new,
+# changed and removed files, a file that became a directory and back, and
+# untouched subtrees that are never read.
+#
+#   bash test/retrieve_test.sh ./gid
+
+GID=$(realpath "$1")
+W=$(mktemp -d)
+trap 'rm -rf "$W"' EXIT
+mkdir -p "$W/proj/same/deep" "$W/proj/changing" "$W/snapshots" && cd "$W/proj" || exit 1
+
+snapshot() {
+  mkdir -p "$W/snapshots/$1"
+  tar -c --exclude=.gid . | tar -x -C "$W/snapshots/$1"
+}
+
+for i in 1 2 3; do echo "same $i" > same/deep/$i.txt; done
+echo a > changing/kept.txt
+echo a > changing/edited.txt
+echo a > changing/removed.txt
+echo a > changing/shape
+"$GID" init >/dev/null
+snapshot 1
+
+echo b > changing/edited.txt
+rm changing/removed.txt
+echo b > changing/added.txt
+rm changing/shape
+mkdir -p changing/shape/inner
+echo b > changing/shape/inner/file.txt
+"$GID" add >/dev/null
+"$GID" commit >/dev/null
+snapshot 2
+
+rm -r changing/shape
+echo c > changing/shape
+"$GID" add >/dev/null
+"$GID" commit >/dev/null
+snapshot 3
+
+commits=($("$GID" log | awk '/Commit Hash/ {print $4}'))
+failed=0
+for n in 1 2 3 2 1 3 1; do
+  "$GID" retrieve "${commits[n - 1]}" >/dev/null 2>&1
+  if ! diff -r "$W/snapshots/$n" ../repo >/dev/null; then
+    echo "retrieve FAILED, commit $n differs after an incremental retrieve:" >&2
+    diff -r "$W/snapshots/$n" ../repo >&2
+    failed=1
+  fi
+done
+
+[ $failed = 0 ] || exit 1
+echo "retrieve ok"
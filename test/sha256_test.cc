@@ -0,0 +1,138 @@
+// Known-answer test for the SHA256 kernels: every kernel the CPU supports
+// must give the NIST digests, and the same digest as OpenSSL for messages of
+// every length up to 2000 bytes fed through uneven update() calls. The lane
+// kernels of SHA256Batch are checked the same way at every supported width,
+// on batches of mixed lengths that leave groups partly filled.
+//
+//   make test
+
+#include "SHA256.hpp"
+#include "SHA256Batch.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <openssl/evp.h>
+
+static std::string hashWith(const std::string &message, const std::vector<size_t> &pieces) {
+  SHA256 sha;
+  size_t offset = 0;
+  for (size_t piece : pieces) {
+    sha.update(reinterpret_cast<const uint8_t *>(message.data()) + offset, piece);
+    offset += piece;
+  }
+  sha.update(reinterpret_cast<const uint8_t *>(message.data()) + offset, message.size() - offset);
+
+  uint8_t digest[32];
+  sha.digest(digest);
+  return SHA256::toString(digest);
+}
+
+static std::string reference(const std::string &message) {
+  uint8_t digest[32];
+  EVP_Digest(message.data(), message.size(), digest, nullptr, EVP_sha256(), nullptr);
+  return SHA256::toString(digest);
+}
+
+int main() {
+  struct Vector {
+    std::string message;
+    const char *digest;
+  };
+  const std::vector<Vector> vectors = {
+      {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+      {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+      {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+       "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+      {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrst"
+       "nopqrstu",
+       "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+      {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+  };
+
+  std::mt19937_64 rng(1);
+  std::string random(2000, '\0');
+  for (char &c : random) c = static_cast<char>(rng());
+
+  int failures = 0;
+  for (SHA256::Kernel kernel : {SHA256::Kernel::Scalar, SHA256::Kernel::SSE4, SHA256::Kernel::AVX2,
+                                SHA256::Kernel::SHANI}) {
+    if (!SHA256::setKernel(kernel)) {
+      std::printf("%-7s skipped, not supported by this CPU\n", SHA256::kernelName(kernel));
+      continue;
+    }
+
+    int kernelFailures = 0;
+    for (const Vector &vector : vectors) {
+      if (hashWith(vector.message, {}) != vector.digest) {
+        std::fprintf(stderr, "%s: wrong digest for a %zu byte NIST message\n", SHA256::kernelName(kernel),
+                     vector.message.size());
+        kernelFailures++;
+      }
+    }
+
+    for (size_t length = 0; length <= random.size(); length++) {
+      const std::string message = random.substr(0, length);
+
+      // Pieces of 0 to 130 bytes, so updates start and end anywhere in a block.
+      std::vector<size_t> pieces;
+      for (size_t left = length; left > 0;) {
+        const size_t piece = std::min<size_t>(left, rng() % 131);
+        pieces.push_back(piece);
+        left -= piece;
+      }
+
+      if (hashWith(message, pieces) != reference(message)) {
+        std::fprintf(stderr, "%s: digest of %zu random bytes differs from OpenSSL\n", SHA256::kernelName(kernel),
+                     length);
+        kernelFailures++;
+      }
+    }
+
+    std::printf("%-7s %s\n", SHA256::kernelName(kernel), kernelFailures ? "FAILED" : "ok");
+    failures += kernelFailures;
+  }
+
+  SHA256::setKernel(SHA256::Kernel::Auto);
+
+  struct Width {
+    SHA256Batch::Width width;
+    const char *name;
+  };
+  for (const Width &width : {Width{SHA256Batch::Width::X4, "x4"}, Width{SHA256Batch::Width::X8, "x8"},
+                             Width{SHA256Batch::Width::X16, "x16"}}) {
+    if (!SHA256Batch::setWidth(width.width)) {
+      std::printf("%-7s skipped, not supported by this CPU\n", width.name);
+      continue;
+    }
+
+    // Every length once, at every offset mod 64, in batches of 1 to 50
+    // messages, so groups end full and partly filled.
+    const std::string source = random + random.substr(0, 64);
+    int widthFailures = 0;
+    for (size_t begin = 0, count = 1; begin <= random.size(); begin += count, count = count % 50 + 1) {
+      std::vector<std::string_view> messages;
+      for (size_t length = begin; length < begin + count && length <= random.size(); length++) {
+        messages.push_back(std::string_view(source).substr(length % 64, length));
+      }
+
+      const std::vector<SHA256Batch::Digest> digests = SHA256Batch::hash(messages, true);
+      for (size_t i = 0; i < messages.size(); i++) {
+        if (SHA256::toString(digests[i].data()) != reference(std::string(messages[i]))) {
+          std::fprintf(stderr, "%s: digest of %zu batched bytes differs from OpenSSL\n", width.name,
+                       messages[i].size());
+          widthFailures++;
+        }
+      }
+    }
+
+    std::printf("%-7s %s\n", width.name, widthFailures ? "FAILED" : "ok");
+    failures += widthFailures;
+  }
+
+  SHA256Batch::setWidth(SHA256Batch::Width::Auto);
+  return failures ? 1 : 0;
+}